@@ -11,7 +11,9 @@ tokens {
     EXPR_TOKEN,
     BLOCK_TOKEN,
     PARENTHESIS_TOKEN,
-    INDEX_TOKEN
+    INDEX_TOKEN,
+    MATRIX_GENERATOR_TOKEN,
+    MATRIX_INDEX_TOKEN
 }
 
 compilationUnit: statement* EOF;
@@ -34,18 +36,21 @@ block: statement* ;
 expression: expr ;
 expr: 
     '(' expr ')'                                # Parenthesis
+    | expr op1='[' expr ',' expr op2=']'        # MatrixIndex
     | expr op1='[' expr op2=']'                 # Index
     | expr op='..' expr                         # Range
-    | expr op=('*' | '/') expr                  # MulDiv
+    | expr op=('*' | '/' | '**') expr           # MulDiv
     | expr op=('+' | '-') expr                  # AddSub
     | expr op=('>' | '<') expr                  # GreaterThanLessThan
     | expr op=('==' | '!=') expr                # IsEqualIsNotEqual
+    | '[' ID IN expression ',' ID IN expression '|' expression ']'  # MatrixGenerator
     | '[' ID IN expression '|' expression ']'   # Generator
     | '[' ID IN expression '&' expression ']'   # Filter
+    | op=(SUM | MIN | MAX | COUNT | PRODUCT) '(' expression ')' # Reduction
     | ID                                        # IDAtom
     | INTEGER                                   # IntegerAtom
     ;
-type: INT | VECTOR ;
+type: INT | VECTOR | MATRIX ;
 
 IF: 'if' ;
 FI: 'fi' ;
@@ -53,12 +58,19 @@ LOOP: 'loop' ;
 POOL: 'pool' ;
 INT: 'int' ;
 VECTOR: 'vector' ;
+MATRIX: 'matrix' ;
 IN: 'in' ;
 PRINT: 'print' ;
+SUM: 'sum' ;
+MIN: 'min' ;
+MAX: 'max' ;
+COUNT: 'count' ;
+PRODUCT: 'product' ;
 
 RANGE: '..' ;
 ADD: '+' ;
 SUB: '-' ;
+MATMUL: '**' ;
 MUL: '*' ;
 DIV: '/' ;
 LESSTHAN: '<' ;
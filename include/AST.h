@@ -6,6 +6,7 @@
 #include "Type.h"
 #include "Scope.h"
 #include "Symbol.h"
+#include "ValueRange.h"
 
 #include <vector>
 #include <string>
@@ -24,6 +25,24 @@ namespace vcalc {
         std::shared_ptr<Symbol> symbol; // Populate by DefRef pass
         std::shared_ptr<Type> evalType;  // Populate by Type pass
         std::shared_ptr<Type> promoteToType;  // Populate by Type pass
+        bool isLastUse = false;  // Populate by Liveness pass
+        std::shared_ptr<AST> reuseOperand;  // Populate by Liveness pass
+        ValueRange range;  // Populate by RangeAnalysis pass: value of an int, elements of a vector
+        ValueRange lengthRange;  // Populate by RangeAnalysis pass
+        bool indexInBounds = false;  // Populate by RangeAnalysis pass
+        bool hoistDivisor = false;  // Populate by DivisorHoisting pass
+        bool isPredicable = false;  // Populate by IfConversion pass: a conditional codegen may run as selects
+        std::shared_ptr<AST> valueNumberOf;  // Populate by ValueNumbering pass: earlier identical vector whose buffer this reuses
+        bool keepValue = false;  // Populate by ValueNumbering pass: later nodes reuse this one's buffer
+        bool isLastValueUse = false;  // Populate by ValueNumbering pass: the last of those reuses
+        bool isProgression = false;  // Populate by AffineRecognition pass: elements are start, start + step, ... known at compile time
+        int32_t progressionStart = 0;  // Populate by AffineRecognition pass
+        int32_t progressionStep = 0;  // Populate by AffineRecognition pass
+        int32_t progressionCount = 0;  // Populate by AffineRecognition pass
+        bool isLoopInvariant = false;  // Populate by LoopInvariantHoisting pass: built once before the enclosing loop
+        std::vector<std::shared_ptr<AST>> loopInvariants;  // Populate by LoopInvariantHoisting pass: on a loop, what to build before it
+        bool isSlice = false;  // Populate by Type pass: v[a..b] is a view into v
+        bool isMask = false;  // Populate by Type pass: a vector comparison kept as one bit per element
         llvm::Value *llvmValue;
 
         AST(); // for making nil-rooted nodes
@@ -38,6 +57,10 @@ namespace vcalc {
         void addChild(std::any t);
         void addChild(std::shared_ptr<AST> t);
         bool isNil();
+        /** Source line of this node, taken from the first child for imaginary tokens */
+        size_t getLine();
+        /** 1-based source column matching getLine(), or 0 when there is none */
+        size_t getColumn();
 
         /** Compute string for single node */
         std::string toString();
@@ -15,13 +15,16 @@ namespace vcalc {
         
         std::any visitParenthesis(VCalcParser::ParenthesisContext *ctx) override;
         std::any visitIndex(VCalcParser::IndexContext *ctx) override;
+        std::any visitMatrixIndex(VCalcParser::MatrixIndexContext *ctx) override;
         std::any visitRange(VCalcParser::RangeContext *ctx) override;
         std::any visitMulDiv(VCalcParser::MulDivContext *ctx) override;
         std::any visitAddSub(VCalcParser::AddSubContext *ctx) override;
         std::any visitGreaterThanLessThan(VCalcParser::GreaterThanLessThanContext *ctx) override;
         std::any visitIsEqualIsNotEqual(VCalcParser::IsEqualIsNotEqualContext *ctx) override;
         std::any visitGenerator(VCalcParser::GeneratorContext *ctx) override;
+        std::any visitMatrixGenerator(VCalcParser::MatrixGeneratorContext *ctx) override;
         std::any visitFilter(VCalcParser::FilterContext *ctx) override;
+        std::any visitReduction(VCalcParser::ReductionContext *ctx) override;
         std::any visitIDAtom(VCalcParser::IDAtomContext *ctx) override;
         std::any visitIntegerAtom(VCalcParser::IntegerAtomContext *ctx) override;
     };
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+#include "AST.h"
+#include "Symbol.h"
+
+namespace vcalc {
+    /** Finds ranges, generators and filters whose elements form an
+     *  arithmetic progression that is known at compile time: a range with
+     *  constant bounds, a generator whose body is scale * i + offset over
+     *  such a domain, or a filter keeping the multiples of a constant
+     *  between constant bounds. Codegen then fills them in with a strided
+     *  iota instead of evaluating the body once per element. */
+    class AffineRecognition {
+    private:
+        /** {i : i is a multiple of modulus, low <= i <= high} */
+        struct Progression {
+            int64_t modulus;
+            int64_t low;
+            int64_t high;
+        };
+
+        std::shared_ptr<AST> strip(std::shared_ptr<AST> t);
+        bool isDomainVariable(std::shared_ptr<AST> t, std::shared_ptr<Symbol> var);
+        bool isConstant(std::shared_ptr<AST> t, int64_t &value);
+        bool isPure(std::shared_ptr<AST> t);
+        bool matchAffine(std::shared_ptr<AST> t, std::shared_ptr<Symbol> var, uint32_t &scale, uint32_t &offset);
+        bool matchMultipleTest(std::shared_ptr<AST> t, std::shared_ptr<Symbol> var, int64_t &modulus);
+        bool matchPredicate(std::shared_ptr<AST> t, std::shared_ptr<Symbol> var, Progression &kept);
+        void markProgression(std::shared_ptr<AST> t, int64_t start, int64_t step, int64_t count);
+    public:
+        AffineRecognition();
+        void visit(std::shared_ptr<AST> t);
+        void visitChildren(std::shared_ptr<AST> t);
+        void visitRANGE(std::shared_ptr<AST> t);
+        void visitGENERATOR_TOKEN(std::shared_ptr<AST> t);
+        void visitFILTER_TOKEN(std::shared_ptr<AST> t);
+    };
+}
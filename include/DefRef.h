@@ -19,6 +19,7 @@ namespace vcalc {
         void visitASSIGNMENT_TOKEN(std::shared_ptr<AST> t);
         void visitGENERATOR_TOKEN(std::shared_ptr<AST> t);
         void visitFILTER_TOKEN(std::shared_ptr<AST> t);
+        void visitMATRIX_GENERATOR_TOKEN(std::shared_ptr<AST> t);
         void visitID(std::shared_ptr<AST> t);
     };
 }
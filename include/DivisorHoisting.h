@@ -0,0 +1,25 @@
+#pragma once
+
+#include <vector>
+
+#include "AST.h"
+#include "Symbol.h"
+
+namespace vcalc {
+    /** Marks divisions inside generator and filter bodies whose divisor does
+     *  not depend on the domain variable, so codegen can compute the
+     *  divisor's magic multiplier once per generator instead of dividing
+     *  for every element. */
+    class DivisorHoisting {
+    private:
+        std::vector<std::shared_ptr<Symbol>> domainVariables; // Innermost generator last
+        bool references(std::shared_ptr<AST> t, std::shared_ptr<Symbol> sym);
+    public:
+        DivisorHoisting();
+        void visit(std::shared_ptr<AST> t);
+        void visitChildren(std::shared_ptr<AST> t);
+        void visitGENERATOR_TOKEN(std::shared_ptr<AST> t);
+        void visitMATRIX_GENERATOR_TOKEN(std::shared_ptr<AST> t);
+        void visitDIV(std::shared_ptr<AST> t);
+    };
+}
@@ -8,15 +8,21 @@ namespace vcalc {
     private:
         std::shared_ptr<SymbolTable> symtab;
         size_t numExprAncestors;
+        size_t numErrors;  // Type errors reported so far
+        void markMask(std::shared_ptr<AST> t);
     public:
         ExpressionTypeComputation(std::shared_ptr<SymbolTable> symtab);
+        size_t getNumErrors();
         void visit(std::shared_ptr<AST> t);
         void visitChildren(std::shared_ptr<AST> t);
         void visitEXPR_TOKEN(std::shared_ptr<AST> t);
         void visitINTEGER(std::shared_ptr<AST> t);
         void visitRANGE(std::shared_ptr<AST> t);
         void visitINDEX_TOKEN(std::shared_ptr<AST> t);
+        void visitMATRIX_INDEX_TOKEN(std::shared_ptr<AST> t);
+        void visitMATRIX_GENERATOR_TOKEN(std::shared_ptr<AST> t);
         void visitBinaryOperationToken(std::shared_ptr<AST> t);
+        void visitReductionToken(std::shared_ptr<AST> t);
         void visitPARENTHESIS_TOKEN(std::shared_ptr<AST> t);
         void visitID(std::shared_ptr<AST> t);
     };
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "AST.h"
+#include "ProfileData.h"
+
+namespace vcalc {
+    /** Marks conditionals whose block is small and cannot fail or print, so
+     *  codegen can run the block unconditionally and keep each assignment's
+     *  effect with a select on the condition instead of branching. Data
+     *  dependent conditions then never mispredict, and loops around them
+     *  stay straight-line code the vectorizer can work on. With profile data,
+     *  conditionals that nearly always went the same way keep their branch,
+     *  which the predictor gets right and which skips the block. */
+    class IfConversion {
+    private:
+        const ProfileData *profile;
+        bool isPredictable(std::shared_ptr<AST> t);
+        bool isSafeStatement(std::shared_ptr<AST> t);
+        bool isSafeExpression(std::shared_ptr<AST> t);
+        size_t countNodes(std::shared_ptr<AST> t);
+    public:
+        IfConversion(const ProfileData *profile = nullptr);
+        void visit(std::shared_ptr<AST> t);
+        void visitChildren(std::shared_ptr<AST> t);
+        void visitCONDITIONAL_TOKEN(std::shared_ptr<AST> t);
+    };
+}
@@ -1,43 +1,180 @@
 #pragma once
 
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
 #include <string>
+#include <vector>
 
+#include "llvm/IR/DIBuilder.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
 
 #include "AST.h"
+#include "ProfileData.h"
 #include "SymbolTable.h"
 
 namespace vcalc {
+    /** What the compiler writes to its output file */
+    enum OutputKind {
+        OUTPUT_IR,         // Textual LLVM IR, for lli
+        OUTPUT_BITCODE,    // LLVM bitcode
+        OUTPUT_OBJECT,     // Native object file (-c)
+        OUTPUT_EXECUTABLE  // Native executable (-o)
+    };
+
+    /** Command line choices that change the code we generate */
+    struct CodegenOptions {
+        bool profile = false;    // Time statements, loop bodies, generators and filters at runtime
+        bool debugInfo = false;  // Attach DWARF source locations
+        std::string sourceFileName;
+        std::string entryName = "main";  // The REPL and partitions give every function its own name
+        bool optimize = true;   // Run the O2 pipeline over each partition
+        unsigned vectorBits = 128;  // Widest SIMD register, which sets how many lanes a vector instruction covers
+        OutputKind output = OUTPUT_IR;
+        std::string runtimeBitcode;  // libvcalcrt as bitcode, linked in before optimization when set
+        std::string runtimeLibrary;  // libvcalcrt.so, for executables that could not link the bitcode
+        bool tasks = false;  // Run independent top-level statements concurrently
+        std::shared_ptr<const ProfileData> profileData;  // Counts from an earlier --profile run, when given
+    };
+
+    /** A top-level variable the REPL keeps in globals so later statements' modules can reach it */
+    struct PersistentVariable {
+        std::string globalName;
+        int32_t size = 0;           // vectors: length after the last statement that bound it, or -1 to read it at runtime
+        unsigned elementBits = 32;  // vectors: width of the stored elements
+        int32_t columns = 0;        // matrices: row length, with size counting every element
+    };
+
     class LLVMIRGenerator {
     public:
-        llvm::LLVMContext globalCtx;
+        std::unique_ptr<llvm::LLVMContext> ownedCtx;  // Handed over by takeModule()
+        std::unique_ptr<llvm::Module> ownedMod;
+        llvm::LLVMContext &globalCtx;
         llvm::IRBuilder<> ir;
-        llvm::Module mod;
+        llvm::Module &mod;
         llvm::Function *mainFunction;
         size_t numBasicBlocks;
         size_t numVariables;
         size_t numExprAncestors;
+        CodegenOptions options;
+        std::unique_ptr<llvm::DIBuilder> debugBuilder;  // Only with debug info
+        llvm::DISubprogram *debugScope;
+
+        /** Regions a profiling build times. Matches runtime/include/profile.h */
+        enum ProfileRegion {
+            PROFILE_STATEMENT = 0,
+            PROFILE_LOOP_BODY = 1,
+            PROFILE_GENERATOR = 2,
+            PROFILE_FILTER = 3
+        };
+
+        /** Reciprocal of a divisor, computed once and reused by every element it divides */
+        struct DivisorMagic {
+            llvm::Value *multiplier; // floor(2^shift / |d|) + 1, as i64
+            llvm::Value *shift;      // 32 + ceil(log2 |d|), as i64
+            llvm::Value *sign;       // 0 or -1
+        };
+        std::map<std::shared_ptr<AST>, DivisorMagic> hoistedDivisors;
+        static const int STREAM_CHUNK = 16384;  // Matches VCALC_STREAM_CHUNK in runtime/include/print.h
+        std::map<llvm::Value *, llvm::Value *> vectorSizes;  // Length of every vector value
+        std::map<llvm::Value *, llvm::Value *> sliceBases;   // Buffer each slice points into
+        std::vector<llvm::Value *> statementBuffers;         // Buffers created by the current statement
+        std::set<llvm::Value *> masks;  // Comparisons packed one bit per element into i64 words; vectorSizes counts elements
+
+        /** A matrix is a row-major vector buffer; vectorSizes holds rows * columns */
+        struct MatrixShape {
+            llvm::Value *rows;
+            llvm::Value *columns;
+        };
+        std::map<llvm::Value *, MatrixShape> matrixShapes;  // Shape of every matrix value
+        llvm::Value *predicate = nullptr;  // Inside an if-converted block: when its int assignments take effect
+        std::map<std::shared_ptr<AST>, llvm::Value *> numberedValues;  // Vectors ValueNumbering found reused later
+        std::map<std::shared_ptr<AST>, llvm::Value *> hoistedValues;   // Loop invariant vectors, while their loop is generated
 
         std::string &outputFileName;
-        LLVMIRGenerator(std::string &outputFileName);
+        LLVMIRGenerator(std::string &outputFileName, const CodegenOptions &options);
+        void finalize();
+        void createReturn();
+        llvm::orc::ThreadSafeModule takeModule();
+        void importVariable(std::shared_ptr<Symbol> sym, const PersistentVariable &var);
+        void exportVariable(std::shared_ptr<Symbol> sym, PersistentVariable &var, bool define);
         void visit(std::shared_ptr<AST> t);
         void visitChildren(std::shared_ptr<AST> t);
         void visitBLOCK_TOKEN(std::shared_ptr<AST> t);
         void visitVAR_DECLARATION_TOKEN(std::shared_ptr<AST> t);
         void visitASSIGNMENT_TOKEN(std::shared_ptr<AST> t);
         void visitBinaryOperationToken(std::shared_ptr<AST> t);
+        void visitReductionToken(std::shared_ptr<AST> t);
         void visitRANGE(std::shared_ptr<AST> t);
         void visitGENERATOR_TOKEN(std::shared_ptr<AST> t);
         void visitFILTER_TOKEN(std::shared_ptr<AST> t);
         void visitID(std::shared_ptr<AST> t);
         void visitINTEGER(std::shared_ptr<AST> t);
         void visitPARENTHESIS_TOKEN(std::shared_ptr<AST> t);
-        void visitPRINT(std::shared_ptr<AST> t);
+        void visitPRINT_TOKEN(std::shared_ptr<AST> t);
         void visitEXPR_TOKEN(std::shared_ptr<AST> t);
         void visitLOOP_TOKEN(std::shared_ptr<AST> t);
         void visitCONDITIONAL_TOKEN(std::shared_ptr<AST> t);
         void visitINDEX_TOKEN(std::shared_ptr<AST> t);
+        void visitSlice(std::shared_ptr<AST> t);
+        void visitGather(std::shared_ptr<AST> t);
+        void visitMATRIX_INDEX_TOKEN(std::shared_ptr<AST> t);
+        void visitMATRIX_GENERATOR_TOKEN(std::shared_ptr<AST> t);
+        void createMatrixOperation(std::shared_ptr<AST> t);
+        bool hasNumberedValue(std::shared_ptr<AST> t);
+        void reuseNumberedValue(std::shared_ptr<AST> t);
+        void reuseHoistedValue(std::shared_ptr<AST> t);
+
+        llvm::Value *createBinaryOperation(size_t op, llvm::Value *lhs, llvm::Value *rhs);
+        llvm::Value *allocateVector(llvm::Type *elementTy, llvm::Value *size);
+        llvm::Value *allocateResultBuffer(std::shared_ptr<AST> t, llvm::Value *size);
+        llvm::Value *allocateMatrix(llvm::Value *rows, llvm::Value *columns);
+        llvm::Value *createEntryAlloca(llvm::Type *type);
+        void bindDomainVariable(std::shared_ptr<AST> id, llvm::Value *element);
+        void collectRebound(std::shared_ptr<AST> t, std::set<std::shared_ptr<Symbol>> &rebound, std::set<std::shared_ptr<Symbol>> &declared);
+        llvm::Value *widenVector(llvm::Value *vector, llvm::Type *elementTy);
+        llvm::Value *mergeVector(llvm::Value *first, llvm::BasicBlock *firstBlock, llvm::Value *second, llvm::BasicBlock *secondBlock);
+        llvm::Value *getBuffer(llvm::Value *vector);
+        void retainVector(llvm::Value *vector);
+        void releaseVector(llvm::Value *vector);
+        void releaseStatementBuffers();
+        llvm::Type *getElementType(std::shared_ptr<AST> t);
+        llvm::Value *getVectorSize(llvm::Value *array);
+        llvm::Type *getVectorElementType(llvm::Value *array);
+        int getArraySizeInteger(llvm::Value *array);
+        llvm::Value *loadElement(llvm::Value *array, llvm::Value *index);
+        void storeElement(llvm::Value *array, llvm::Value *index, llvm::Value *value);
+        llvm::Value *loadChunk(llvm::Value *array, llvm::Value *index, unsigned lanes);
+        void storeChunk(llvm::Value *array, llvm::Value *index, llvm::Value *chunk);
+        llvm::Value *splatLike(llvm::Value *scalar, llvm::Type *like);
+        void createElementLoop(llvm::Value *size, const std::function<void(llvm::Value *)> &body, uint64_t expectedTrips = 0);
+        void createRuntimeCheck(llvm::Value *failed, llvm::FunctionCallee handler, llvm::ArrayRef<llvm::Value *> args);
+        void createDivisionCheck(std::shared_ptr<AST> t, llvm::Value *divisor, llvm::Value *evaluated = nullptr);
+        DivisorMagic prepareDivisor(std::shared_ptr<AST> t, llvm::Value *divisor, llvm::Value *evaluated = nullptr);
+        void prepareHoistedDivisors(std::shared_ptr<AST> t, llvm::Value *size);
+        llvm::Value *createMagicDivision(llvm::Value *dividend, DivisorMagic magic);
+        llvm::Value *createFusedReduction(std::shared_ptr<AST> t, std::shared_ptr<AST> producer);
+        llvm::Value *createProgression(std::shared_ptr<AST> t);
+        llvm::Value *createProgressionReduction(std::shared_ptr<AST> t, std::shared_ptr<AST> producer);
+        llvm::Value *allocateMask(llvm::Value *size);
+        llvm::Value *createMask(std::shared_ptr<AST> t);
+        bool createMaskPredicate(std::shared_ptr<AST> t, llvm::Value *mask);
+        llvm::Value *createMaskReduction(std::shared_ptr<AST> t, llvm::Value *mask);
+        llvm::Value *widenMask(llvm::Value *mask);
+        void createStreamingPrint(std::shared_ptr<AST> value);
+        void createPrecomputedOutput(const std::string &text);
+        void setDebugLocation(std::shared_ptr<AST> t);
+        void profileEnter(std::shared_ptr<AST> t, ProfileRegion region);
+        void profileExit(llvm::Value *iterations, llvm::Value *elements);
+        void profileBranch(std::shared_ptr<AST> t, llvm::Value *condition);
+        llvm::MDNode *profiledBranchWeights(std::shared_ptr<AST> t);
+        uint64_t profiledTripCount(std::shared_ptr<AST> t, ProfileRegion region);
+        /** Names for new values and blocks. Empty unless debugging, since only a reader of the IR needs them */
+        std::string nextVariableName();
+        std::string nextBasicBlockName();
     };
 }
\ No newline at end of file
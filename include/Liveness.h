@@ -0,0 +1,38 @@
+#pragma once
+
+#include <map>
+#include <set>
+
+#include "AST.h"
+#include "Symbol.h"
+
+namespace vcalc {
+    /** Backward live-variable analysis over the typed AST. Marks vector
+     *  operands whose storage is not read again so that codegen can write
+     *  element-wise results into them instead of allocating a new buffer. */
+    class Liveness {
+    private:
+        std::set<std::shared_ptr<Symbol>> live;     // Symbols read after the current statement
+        std::set<std::shared_ptr<Symbol>> aliased;  // Vector symbols bound to or viewed by a slice
+        std::map<std::shared_ptr<Symbol>, size_t> statementRefs; // Reference counts within the current statement
+        bool marking;  // False while iterating loops to a fixpoint
+
+        void collectAliases(std::shared_ptr<AST> t);
+        void collectUses(std::shared_ptr<AST> t, std::set<std::shared_ptr<Symbol>> &uses);
+        void countRefs(std::shared_ptr<AST> t);
+        std::shared_ptr<AST> stripWrappers(std::shared_ptr<AST> t);
+        bool isVector(std::shared_ptr<AST> t);
+        bool isDead(std::shared_ptr<AST> operand);
+        void markExpression(std::shared_ptr<AST> t);
+        void useExpression(std::shared_ptr<AST> t);
+    public:
+        Liveness();
+        void visit(std::shared_ptr<AST> t);
+        void visitStatements(std::shared_ptr<AST> t);
+        void visitVAR_DECLARATION_TOKEN(std::shared_ptr<AST> t);
+        void visitASSIGNMENT_TOKEN(std::shared_ptr<AST> t);
+        void visitPRINT_TOKEN(std::shared_ptr<AST> t);
+        void visitCONDITIONAL_TOKEN(std::shared_ptr<AST> t);
+        void visitLOOP_TOKEN(std::shared_ptr<AST> t);
+    };
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <set>
+#include <vector>
+
+#include "AST.h"
+#include "Symbol.h"
+
+namespace vcalc {
+    /** Finds the ranges, generators, filters and element-wise vector
+     *  expressions inside a loop that only read variables the loop never
+     *  assigns, declares or overwrites in place, so codegen can build them
+     *  once before the loop and reuse the buffer on every iteration. LLVM
+     *  cannot hoist them itself since they are runtime allocations and
+     *  kernel calls. Only expressions that cannot fail are hoisted, as the
+     *  loop may run no iterations or fail first on something else. */
+    class LoopInvariantHoisting {
+    private:
+        void collectVarying(std::shared_ptr<AST> t, std::set<std::shared_ptr<Symbol>> &varying);
+        void hoistStatements(std::shared_ptr<AST> block, std::set<std::shared_ptr<Symbol>> &varying, std::vector<std::shared_ptr<AST>> &invariants);
+        void hoist(std::shared_ptr<AST> t, std::set<std::shared_ptr<Symbol>> &varying, std::vector<std::shared_ptr<AST>> &invariants);
+        bool isCandidate(std::shared_ptr<AST> t);
+        bool isInvariant(std::shared_ptr<AST> t, const std::set<std::shared_ptr<Symbol>> &varying);
+        bool isSafe(std::shared_ptr<AST> t);
+        void keepInvariantsIntact(std::shared_ptr<AST> t);
+    public:
+        LoopInvariantHoisting();
+        void visit(std::shared_ptr<AST> t);
+        void visitChildren(std::shared_ptr<AST> t);
+        void visitLOOP_TOKEN(std::shared_ptr<AST> t);
+    };
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "llvm/IR/Module.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include "LLVMIRGenerator.h"
+
+namespace vcalc {
+    /** Turns finished program modules into the requested output. When the
+     *  runtime's bitcode is available, the runtime functions a module calls
+     *  are linked into it as available_externally copies before it is
+     *  optimized, so calls into libvcalcrt can be inlined into the generated
+     *  code. The definitions it links against are compiled into an object of
+     *  their own, or for bitcode output linked in after optimization, so every
+     *  module shares the one copy of the runtime's state.
+     *
+     *  Objects and executables are produced for the host with a
+     *  TargetMachine, and linked by the system C compiler. A TargetMachine
+     *  must not be shared between threads, so each thread needs an emitter of
+     *  its own. */
+    class ModuleEmitter {
+    private:
+        CodegenOptions options;
+        std::unique_ptr<llvm::TargetMachine> targetMachine;  // Only for native output
+
+        std::unique_ptr<llvm::Module> loadRuntime(llvm::LLVMContext &ctx);
+        bool linkRuntime(llvm::Module &mod, bool inlineOnly);
+    public:
+        ModuleEmitter(const CodegenOptions &options);
+        /** The O2 pipeline, tuned for `targetMachine` when there is one */
+        static void optimize(llvm::Module &mod, llvm::TargetMachine *targetMachine = nullptr);
+        /** A new, empty object file in the temporary directory, for linkObjects() */
+        static bool createTemporaryObject(std::string &objectFileName);
+        /** Adds the functions and variables `mod` uses but does not define to `names` */
+        static void collectUndefined(llvm::Module &mod, std::set<std::string> &names);
+        /** Targets `mod` and optimizes it, with the runtime functions it calls open to the inliner */
+        bool prepare(llvm::Module &mod);
+        /** Writes a prepared module as a native object */
+        bool writeObject(llvm::Module &mod, const std::string &objectFileName);
+        /** Writes the runtime functions and variables in `names`, and everything they use, as a native object */
+        bool writeRuntimeObject(const std::set<std::string> &names, const std::string &objectFileName);
+        /** Links native objects into the requested object or executable. Without `runtimeLinked`, against libvcalcrt.so */
+        bool linkObjects(const std::vector<std::string> &objectFileNames, const std::string &outputFileName, bool runtimeLinked);
+        /** Writes `mod` to `outputFileName`. `optimized` says whether it has already been through prepare() */
+        bool emit(llvm::Module &mod, const std::string &outputFileName, bool optimized);
+    };
+}
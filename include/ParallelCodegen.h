@@ -0,0 +1,59 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "AST.h"
+#include "LLVMIRGenerator.h"
+#include "SymbolTable.h"
+
+namespace vcalc {
+    /** Splits the top-level statements into partitions, each generated into a
+     *  module and context of its own beside one for a `main` that runs the
+     *  partitions in order. The modules are optimized on `jobs` threads and,
+     *  for native output, compiled to objects there too and linked by the
+     *  system linker; otherwise they are linked back into one module.
+     *  Variables cross partitions through globals, and a cut is only made
+     *  where every vector in scope has a length RangeAnalysis knows exactly,
+     *  so codegen keeps constant lengths.
+     *
+     *  With task parallelism every statement that works on vectors becomes a
+     *  partition of its own, lengths not known exactly are read from the
+     *  globals, and `main` hands the partitions to the runtime as tasks that
+     *  wait only for the earlier ones they depend on. */
+    class ParallelCodegen {
+    private:
+        struct Partition {
+            std::shared_ptr<AST> statements;
+            std::map<std::shared_ptr<Symbol>, int32_t> entryLengths;  // Vector lengths known exactly when the partition starts
+        };
+
+        std::shared_ptr<SymbolTable> symtab;
+        CodegenOptions options;
+        unsigned jobs;
+        bool tasks;  // Run partitions as concurrent tasks
+        std::map<std::shared_ptr<Symbol>, PersistentVariable> variables;  // Bound by an earlier partition
+        size_t numGlobals;
+
+        bool isGlobal(std::shared_ptr<Symbol> sym);
+        size_t countNodes(std::shared_ptr<AST> t);
+        bool worksOnVectors(std::shared_ptr<AST> t);
+        bool isCheap(std::shared_ptr<AST> t);
+        bool containsPrint(std::shared_ptr<AST> t);
+        void collectAssigned(std::shared_ptr<AST> t, std::set<std::shared_ptr<Symbol>> &assigned);
+        void collectClobbered(std::shared_ptr<AST> t, std::set<std::shared_ptr<Symbol>> &clobbered);
+        void collectReferences(std::shared_ptr<AST> t, std::set<std::shared_ptr<Symbol>> &refs);
+        void collectBindings(std::shared_ptr<AST> t, std::vector<std::shared_ptr<Symbol>> &bound);
+        std::vector<Partition> partition(std::shared_ptr<AST> ast);
+        std::vector<std::vector<size_t>> dependencies(const std::vector<Partition> &partitions);
+        void createTaskLaunch(llvm::Module &mod, llvm::IRBuilder<> &ir, const std::vector<Partition> &partitions);
+        llvm::orc::ThreadSafeModule generate(const Partition &part, const std::string &entryName);
+        llvm::orc::ThreadSafeModule generateMain(const std::vector<Partition> &partitions);
+    public:
+        ParallelCodegen(std::shared_ptr<SymbolTable> symtab, const CodegenOptions &options, unsigned jobs);
+        bool run(std::shared_ptr<AST> ast, const std::string &outputFileName);
+    };
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "AST.h"
+#include "Symbol.h"
+
+namespace vcalc {
+    /** Runs a whole program at compile time. Programs read no input, so when
+     *  it finishes, everything the program prints is known and the emitted
+     *  module only has to write that text. It works on the typed AST with
+     *  the runtime's int semantics, within a budget of steps, time and live
+     *  memory. It gives up on whatever it cannot reproduce exactly
+     *  (matrices, runtime errors, a budget running out) and the program is
+     *  then compiled as usual. */
+    class PartialEvaluator {
+    private:
+        /** An int, or a vector of ints that counts toward the memory budget while it is alive */
+        struct Value {
+            bool isVector = false;
+            int32_t scalar = 0;
+            std::shared_ptr<std::vector<int32_t>> elements;
+        };
+
+        std::map<std::shared_ptr<Symbol>, Value> variables;
+        std::string output;
+        uint64_t steps;
+        uint64_t nextClockCheck;
+        uint64_t liveBytes;
+        bool failed;  // Set once it gives up; every evaluation then unwinds
+        std::chrono::steady_clock::time_point deadline;
+
+        bool step(uint64_t count = 1);
+        Value integer(int32_t value);
+        Value newVector(size_t size);
+        void execute(std::shared_ptr<AST> t);
+        void bind(std::shared_ptr<AST> t, std::shared_ptr<AST> expression);
+        Value evaluate(std::shared_ptr<AST> t);
+        Value evaluateBinaryOperation(std::shared_ptr<AST> t);
+        Value evaluateReduction(std::shared_ptr<AST> t);
+        Value evaluateRange(std::shared_ptr<AST> t);
+        Value evaluateIndex(std::shared_ptr<AST> t);
+        Value evaluateGenerator(std::shared_ptr<AST> t);
+        bool combine(size_t op, int32_t lhs, int32_t rhs, int32_t &result);
+        void print(const Value &value);
+    public:
+        PartialEvaluator();
+        /** Whether the whole program ran within budget, leaving what it printed in getOutput() */
+        bool run(std::shared_ptr<AST> ast);
+        const std::string &getOutput();
+    };
+}
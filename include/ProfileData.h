@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+
+namespace vcalc {
+    /** Counts a `--profile` run wrote to its profile data file, read back by
+     *  `--profile-use` so the next compile can use what the program really
+     *  did instead of static guesses. Sites are keyed by source line, as the
+     *  profiler reports them. */
+    class ProfileData {
+    public:
+        /** Totals over every time a region ran. Kinds match LLVMIRGenerator::ProfileRegion */
+        struct Region {
+            int64_t count = 0;       // Times it ran
+            int64_t totalNs = 0;
+            int64_t selfNs = 0;      // Excluding nested regions
+            int64_t iterations = 0;  // Domain elements visited
+            int64_t elements = 0;    // Elements produced
+        };
+
+        /** Outcomes of a conditional */
+        struct Branch {
+            int64_t taken = 0;
+            int64_t notTaken = 0;
+        };
+
+        /** Reads `path`, reporting a line it cannot parse. False if the file is unreadable or malformed */
+        bool load(const std::string &path);
+        const Region *region(size_t line, int kind) const;
+        const Branch *branch(size_t line) const;
+        /** Mean iterations per run of the region, or 0 when it never ran */
+        uint64_t averageIterations(size_t line, int kind) const;
+        /** Mean nanoseconds per run of the region, or -1 when it was not recorded */
+        int64_t averageNs(size_t line, int kind) const;
+    private:
+        std::map<std::pair<size_t, int>, Region> regions;
+        std::map<size_t, Branch> branches;
+    };
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <map>
+#include <set>
+
+#include "AST.h"
+#include "Symbol.h"
+#include "ValueRange.h"
+
+namespace vcalc {
+    /** Forward interval analysis over the typed AST. Computes the values an
+     *  int expression can take, the values of a vector's elements and the
+     *  lengths a vector can have, then uses them to prove index expressions
+     *  in bounds. */
+    class RangeAnalysis {
+    private:
+        std::map<std::shared_ptr<Symbol>, ValueRange> values;  // int value or vector elements
+        std::map<std::shared_ptr<Symbol>, ValueRange> lengths; // vector lengths
+
+        void collectAssigned(std::shared_ptr<AST> t, std::set<std::shared_ptr<Symbol>> &assigned);
+        void forget(const std::set<std::shared_ptr<Symbol>> &assigned);
+        void bind(std::shared_ptr<Symbol> sym, std::shared_ptr<AST> value);
+        ValueRange applyBinary(size_t op, ValueRange lhs, ValueRange rhs);
+    public:
+        RangeAnalysis();
+        void visit(std::shared_ptr<AST> t);
+        void visitChildren(std::shared_ptr<AST> t);
+        void visitVAR_DECLARATION_TOKEN(std::shared_ptr<AST> t);
+        void visitASSIGNMENT_TOKEN(std::shared_ptr<AST> t);
+        void visitCONDITIONAL_TOKEN(std::shared_ptr<AST> t);
+        void visitLOOP_TOKEN(std::shared_ptr<AST> t);
+        void visitEXPR_TOKEN(std::shared_ptr<AST> t);
+        void visitPARENTHESIS_TOKEN(std::shared_ptr<AST> t);
+        void visitINTEGER(std::shared_ptr<AST> t);
+        void visitID(std::shared_ptr<AST> t);
+        void visitBinaryOperationToken(std::shared_ptr<AST> t);
+        void visitReductionToken(std::shared_ptr<AST> t);
+        void visitRANGE(std::shared_ptr<AST> t);
+        void visitINDEX_TOKEN(std::shared_ptr<AST> t);
+        void visitMATRIX_INDEX_TOKEN(std::shared_ptr<AST> t);
+        void visitMATRIX_GENERATOR_TOKEN(std::shared_ptr<AST> t);
+        void visitGENERATOR_TOKEN(std::shared_ptr<AST> t);
+        void visitFILTER_TOKEN(std::shared_ptr<AST> t);
+    };
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+
+#include "AST.h"
+#include "AffineRecognition.h"
+#include "DefRef.h"
+#include "DivisorHoisting.h"
+#include "ExpressionTypeComputation.h"
+#include "IfConversion.h"
+#include "LLVMIRGenerator.h"
+#include "LoopInvariantHoisting.h"
+#include "RangeAnalysis.h"
+#include "SymbolTable.h"
+#include "ValueNumbering.h"
+
+namespace vcalc {
+    /** Interactive mode. Statements are analysed against one symbol table that
+     *  lives for the whole session, compiled into a module of their own and
+     *  run at once on an ORC JIT. Top-level variables live in globals, so a
+     *  statement only ever compiles itself. */
+    class Repl {
+    private:
+        std::shared_ptr<SymbolTable> symtab;
+        DefRef defref;
+        ExpressionTypeComputation expressionTypeComputation;
+        RangeAnalysis rangeAnalysis;  // Facts about earlier statements' variables carry over
+        std::unique_ptr<llvm::orc::LLJIT> jit;
+        std::map<std::shared_ptr<Symbol>, PersistentVariable> variables;
+        CodegenOptions options;
+        size_t numStatements;
+
+        bool hasUnresolvedReference(std::shared_ptr<AST> t);
+        void collectReferences(std::shared_ptr<AST> t, std::set<std::shared_ptr<Symbol>> &refs);
+        void collectBindings(std::shared_ptr<AST> t, std::vector<std::shared_ptr<Symbol>> &bound);
+        void run(const std::string &text);
+        void echo(std::shared_ptr<Symbol> sym);
+        uint64_t lookup(const std::string &name);
+    public:
+        /** Whether `text` ends on a whole statement, with every `if` and `loop` closed */
+        static bool isComplete(const std::string &text);
+        Repl(const CodegenOptions &options, const std::string &runtimePath);
+        int loop();
+    };
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "DefRef.h"
+#include "ExpressionTypeComputation.h"
+#include "LLVMIRGenerator.h"
+#include "RangeAnalysis.h"
+#include "SymbolTable.h"
+
+namespace vcalc {
+    /** Compiles a program one top-level statement at a time. Each statement is
+     *  parsed, analysed and generated into the one module, then its parse tree
+     *  and AST are dropped before the next is read, so the compiler's memory
+     *  follows the largest statement rather than the whole program. Like the
+     *  REPL it cannot run Liveness, which needs the statements that come
+     *  after, so vectors are never reused in place. */
+    class StreamingCompiler {
+    private:
+        std::shared_ptr<SymbolTable> symtab;
+        DefRef defref;
+        ExpressionTypeComputation expressionTypeComputation;
+        RangeAnalysis rangeAnalysis;
+        std::string outputFileName;
+        LLVMIRGenerator generator;
+
+        void compile(const std::string &text, size_t firstLine);
+    public:
+        StreamingCompiler(const CodegenOptions &options, const std::string &outputFileName);
+        int run(const std::string &inputFileName);
+    };
+}
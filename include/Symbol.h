@@ -18,7 +18,7 @@ namespace vcalc {
         std::string name;               // All symbols at least have a name
         std::shared_ptr<Type> type;
         std::shared_ptr<Scope> scope;   // All symbols know what scope contains them.
-        llvm::AllocaInst *llvmAllocaInst;   // Reference to LLVM-ALLOCA
+        llvm::Value *llvmAllocaInst = nullptr;   // Reference to LLVM-ALLOCA, or to the first element of a vector
 
         Symbol(std::string name);
         Symbol(std::string name, std::shared_ptr<Type> type);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+
+#include "AST.h"
+#include "Symbol.h"
+
+namespace vcalc {
+    /** Finds vector expressions that are structurally identical to one
+     *  computed earlier in the same block, over variables that have not been
+     *  assigned in between, so codegen can reuse the earlier buffer instead
+     *  of allocating and filling another. LLVM cannot do this itself since
+     *  every vector comes from a runtime allocation. Run once per module:
+     *  a reused buffer cannot cross into another one. */
+    class ValueNumbering {
+    private:
+        struct Available {
+            std::shared_ptr<AST> node;
+            std::set<std::shared_ptr<Symbol>> reads;
+        };
+        std::map<std::string, Available> available;  // Vectors computed earlier in this block, by structure
+        std::map<std::shared_ptr<Symbol>, size_t> symbolNumbers;
+        std::map<std::shared_ptr<AST>, std::shared_ptr<AST>> lastReuse;  // Of each reused node
+
+        std::shared_ptr<AST> strip(std::shared_ptr<AST> t);
+        bool isCandidate(std::shared_ptr<AST> t);
+        bool computeKey(std::shared_ptr<AST> t, std::map<std::shared_ptr<Symbol>, size_t> &bound, std::set<std::shared_ptr<Symbol>> &reads, std::string &key);
+        bool reuse(std::shared_ptr<AST> t);
+        void number(std::shared_ptr<AST> t, bool materialized);
+        void invalidate(const std::set<std::shared_ptr<Symbol>> &assigned);
+        void collectAssigned(std::shared_ptr<AST> t, std::set<std::shared_ptr<Symbol>> &assigned);
+        void keepOperandsIntact(std::shared_ptr<AST> t);
+    public:
+        ValueNumbering();
+        void visit(std::shared_ptr<AST> t);
+        void visitStatements(std::shared_ptr<AST> t);
+        void visitBLOCK_TOKEN(std::shared_ptr<AST> t);
+        void visitPRINT_TOKEN(std::shared_ptr<AST> t);
+    };
+}
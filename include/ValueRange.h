@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace vcalc {
+    /** Closed interval [low, high] of 32-bit integers, tracked in 64 bits so
+     *  that arithmetic can detect when it leaves the i32 range. */
+    class ValueRange {
+    public:
+        int64_t low;
+        int64_t high;
+
+        ValueRange(); // the full i32 range
+        ValueRange(int64_t low, int64_t high);
+        static ValueRange full();
+        static ValueRange exactly(int64_t value);
+        static ValueRange length(); // any valid vector length
+
+        bool isFull();
+        bool isExact();
+        bool contains(const ValueRange &other);
+        /** Smallest range covering both; used where control flow merges */
+        ValueRange join(const ValueRange &other);
+        /** Full range if this range does not fit in an i32 */
+        ValueRange clampToInt();
+        /** Smallest of 8, 16 or 32 bits that holds every value in the range */
+        unsigned minimumBitWidth();
+
+        std::string toString();
+    };
+}
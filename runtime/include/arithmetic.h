@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+// Reports a division by zero on line `line` of the vcalc program and exits.
+void vcalcDivisionByZero(int32_t line);
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+// Reports an index outside [0, size) on line `line` of the vcalc program and exits.
+void vcalcIndexOutOfBounds(int32_t line, int32_t index, int32_t size);
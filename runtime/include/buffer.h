@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+// Vector buffers are reference counted so that `vector b = a;` shares a's elements instead of
+// copying them. Codegen only ever sees a pointer to the first element; the count lives in a
+// header just before it.
+//
+// Small buffers are recycled through power-of-two size classes. Large ones get their own mapping
+// backed by huge pages (explicit hugetlb pages too when VCALC_HUGETLB is set), with each page
+// first touched by the thread that will later process it.
+
+// Allocates `size` elements that are `elementBits` (8, 16 or 32) wide, referenced once.
+void *vcalcBufferNew(int32_t size, int32_t elementBits);
+
+void vcalcBufferRetain(void *data);
+
+// Drops a reference, freeing the buffer with the last one.
+void vcalcBufferRelease(void *data);
+
+// Called before writing through one of the buffer's references. Returns `data` itself when that
+// is the only reference. Otherwise gives it up and returns a private buffer of the same shape,
+// holding a copy of the elements when `keepContents` is non-zero.
+void *vcalcBufferMakeUnique(void *data, int32_t keepContents);
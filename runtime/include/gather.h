@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+
+// result[i] = source[indices[i]] for i in [0, count). Each vector is `*Bits` (8, 16 or 32) wide.
+// When `checked` is non-zero every index is validated against `sourceSize` before anything is
+// read, and the first bad one is reported against `line`.
+void vcalcGather(int32_t line, void *result, int32_t resultBits, const void *source, int32_t sourceBits,
+                 int32_t sourceSize, const void *indices, int32_t indexBits, int32_t count, int32_t checked);
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+
+// data[k] = start + k * step for k in [0, count), wrapping like int arithmetic, into a vector
+// whose elements are `elementBits` (8, 16 or 32) wide.
+void vcalcIota(void *data, int32_t elementBits, int32_t start, int32_t step, int32_t count);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+// A mask is a comparison result packed one bit per element: element k is bit k % 64 of word k / 64.
+// Bits past the last element are always zero, so whole words can be counted and combined.
+
+// Comparisons, numbered like the operators codegen passes.
+#define VCALC_MASK_GREATER 0
+#define VCALC_MASK_LESS 1
+#define VCALC_MASK_EQUAL 2
+#define VCALC_MASK_NOT_EQUAL 3
+
+// mask[k] = lhs[k] op rhs[k] for k in [0, count). Operands are `*Bits` (8, 16 or 32) wide; an
+// operand with stride 0 repeats its first element, which is how an int is compared with a vector.
+void vcalcMaskCompare(int32_t op, uint64_t *mask, const void *lhs, int32_t lhsBits, int32_t lhsStride,
+                      const void *rhs, int32_t rhsBits, int32_t rhsStride, int32_t count);
+
+// mask[k] = lhs[k] == rhs[k] or lhs[k] != rhs[k] between two masks of `count` elements.
+void vcalcMaskCombine(int32_t op, uint64_t *mask, const uint64_t *lhs, const uint64_t *rhs, int32_t count);
+
+// Number of set elements.
+int32_t vcalcMaskCount(const uint64_t *mask, int32_t count);
+
+// data[k] = mask[k] as 0 or 1, into a vector whose elements are `elementBits` wide.
+void vcalcMaskWiden(void *data, int32_t elementBits, const uint64_t *mask, int32_t count);
+
+// Copies domain[k] for every set mask[k], in order, to the front of `result`.
+void vcalcMaskCompress(void *result, int32_t resultBits, const void *domain, int32_t domainBits,
+                       const uint64_t *mask, int32_t count);
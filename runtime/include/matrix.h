@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+// Matrices are vector buffers of 32-bit elements in row-major order; codegen keeps the shape.
+
+// Element-wise operators, numbered as codegen passes them.
+typedef enum {
+  VCALC_MATRIX_ADD,
+  VCALC_MATRIX_SUB,
+  VCALC_MATRIX_MUL,
+  VCALC_MATRIX_DIV,
+  VCALC_MATRIX_GREATERTHAN,
+  VCALC_MATRIX_LESSTHAN,
+  VCALC_MATRIX_ISEQUAL,
+  VCALC_MATRIX_ISNOTEQUAL
+} vcalcMatrixOp;
+
+// result[i] = lhs[i] op rhs[i] for `size` elements. An operand with stride 0 is a single int
+// applied to every element. Division by zero is reported against `line`.
+void vcalcMatrixElementwise(int32_t line, int32_t op, int32_t *result, const int32_t *lhs, int32_t lhsStride,
+                            const int32_t *rhs, int32_t rhsStride, int32_t size);
+
+// result (rows x columns) = lhs (rows x inner) ** rhs (rhsRows x columns), computed in cache-sized
+// tiles. Reports an error against `line` unless inner == rhsRows.
+void vcalcMatrixMultiply(int32_t line, int32_t *result, const int32_t *lhs, int32_t rows, int32_t inner,
+                         const int32_t *rhs, int32_t rhsRows, int32_t columns);
+
+// Reports element-wise operands of different shapes and exits.
+void vcalcMatrixShapeMismatch(int32_t line, int32_t rows, int32_t columns, int32_t otherRows, int32_t otherColumns);
+
+// Reports m[row, column] outside a rows x columns matrix and exits.
+void vcalcMatrixIndexOutOfBounds(int32_t line, int32_t row, int32_t column, int32_t rows, int32_t columns);
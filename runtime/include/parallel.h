@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+// Work on elements [begin, end) of a vector; `chunk` numbers the piece from 0.
+typedef void (*vcalcChunkFunction)(void *context, int32_t begin, int32_t end, int32_t chunk);
+
+// Most pieces a vector is ever split into.
+#define VCALC_MAX_CHUNKS 64
+
+// Number of pieces to split `size` elements into so each has at least `minChunkSize`.
+// Honours the VCALC_THREADS environment variable, otherwise uses every online core.
+int32_t vcalcChunkCount(int32_t size, int32_t minChunkSize);
+
+// Runs `function` over `chunks` equal pieces of [0, size), one thread per piece.
+void vcalcParallelFor(int32_t size, int32_t chunks, vcalcChunkFunction function, void *context);
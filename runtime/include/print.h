@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+// print(int) and print(vector). Vectors print as [1 2 3].
+void vcalcPrintInt(int32_t value);
+void vcalcPrintVector(const void *data, int32_t size, int32_t elementBits);
+
+// The whole output of a program the compiler ran ahead of time, written in one go.
+void vcalcPrintText(const char *text, int64_t size);
+
+// print(matrix), one bracketed row after another: [[1 2] [3 4]].
+void vcalcPrintMatrix(const int32_t *data, int32_t rows, int32_t columns);
+
+// Streaming print of a generator, filter or range too long to materialize. Codegen fills one chunk
+// of at most VCALC_STREAM_CHUNK elements at a time and submits it, and a formatter thread turns
+// submitted chunks into text while the next one is computed. Memory use is fixed whatever the length.
+#define VCALC_STREAM_CHUNK 16384
+
+void vcalcStreamBegin(void);
+
+// The chunk to fill next. Valid until the matching vcalcStreamSubmit.
+int32_t *vcalcStreamBuffer(void);
+
+void vcalcStreamSubmit(int32_t count);
+
+// Waits until every chunk is printed.
+void vcalcStreamEnd(void);
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+// Kinds of region a `--profile` build times. Keep in sync with LLVMIRGenerator::ProfileRegion.
+#define VCALC_PROFILE_STATEMENT 0
+#define VCALC_PROFILE_LOOP_BODY 1
+#define VCALC_PROFILE_GENERATOR 2
+#define VCALC_PROFILE_FILTER 3
+
+// Opens a region for source line `line`. Regions nest, and each Enter is closed by the next Exit.
+void vcalcProfileEnter(int32_t line, int32_t kind);
+
+// Closes the innermost region, recording how many iterations it ran and elements it produced.
+// At exit the regions are written as a Chrome trace to $VCALC_TRACE (default vcalc-trace.json)
+// and a per-line hotspot summary goes to stderr.
+void vcalcProfileExit(int32_t iterations, int32_t elements);
+
+// Counts one outcome of the conditional on source line `line`.
+void vcalcProfileBranch(int32_t line, int32_t taken);
+
+// At exit the per-line totals and branch counts are also written to $VCALC_PROFILE_DATA
+// (default vcalc-profile.txt), which `vcalc --profile-use=FILE` reads back. One record per line:
+//   region <line> <kind> <count> <total ns> <self ns> <iterations> <elements>
+//   branch <line> <taken> <not taken>
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+
+// Reductions over a vector of `size` elements that are `elementBits` (8, 16 or 32) wide.
+// Sums and products wrap like int arithmetic. The empty sum is 0 and the empty product 1.
+int32_t vcalcSum(const void *data, int32_t size, int32_t elementBits);
+int32_t vcalcProduct(const void *data, int32_t size, int32_t elementBits);
+
+// min and max of an empty vector are errors reported against `line`.
+int32_t vcalcMin(int32_t line, const void *data, int32_t size, int32_t elementBits);
+int32_t vcalcMax(int32_t line, const void *data, int32_t size, int32_t elementBits);
+
+// Reports a min or max of an empty vector on line `line` and exits.
+void vcalcEmptyReduction(int32_t line);
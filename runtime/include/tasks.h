@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+// With --tasks, each group of top-level statements is compiled to a function of its own, and
+// main hands them all to vcalcRunTasks along with which earlier ones each has to wait for.
+
+typedef void (*vcalcTaskFunction)(void);
+
+// Runs tasks[0 .. count) on up to VCALC_THREADS threads. Task i starts once every task listed in
+// dependencies[firstDependency[i] .. firstDependency[i + 1]) has finished; all of those are
+// below i. Returns when every task has finished.
+void vcalcRunTasks(int32_t count, vcalcTaskFunction const *tasks, const int32_t *firstDependency, const int32_t *dependencies);
+
+// Index of the task the calling thread is running, or -1 outside vcalcRunTasks.
+int32_t vcalcCurrentTask(void);
+
+// Called by every error report before it prints. Blocks until each task before the calling one
+// has finished, so the program stops with the same output as if the tasks had run in order.
+void vcalcWaitForEarlierTasks(void);
@@ -0,0 +1,11 @@
+#include "arithmetic.h"
+#include "tasks.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+void vcalcDivisionByZero(int32_t line) {
+  vcalcWaitForEarlierTasks();
+  fprintf(stderr, "MathError on line %d: division by zero\n", line);
+  exit(1);
+}
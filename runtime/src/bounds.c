@@ -0,0 +1,11 @@
+#include "bounds.h"
+#include "tasks.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+void vcalcIndexOutOfBounds(int32_t line, int32_t index, int32_t size) {
+  vcalcWaitForEarlierTasks();
+  fprintf(stderr, "IndexError on line %d: index %d is out of bounds for vector of size %d\n", line, index, size);
+  exit(1);
+}
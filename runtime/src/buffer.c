@@ -0,0 +1,189 @@
+#include "buffer.h"
+#include "parallel.h"
+#include "tasks.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Sized so the elements keep the header's alignment, which is enough for any vector load.
+#define BUFFER_ALIGNMENT 32
+
+// Buffers up to this many bytes come from the size-class pool.
+#define POOL_MAX_BYTES (64 * 1024)
+#define POOL_MIN_CLASS 6  // 64 bytes
+#define POOL_CLASSES 11   // 64 bytes .. 64 KiB
+// Freed blocks kept per class; beyond this they go back to malloc.
+#define POOL_MAX_FREE 64
+
+// Buffers from this many bytes on get their own huge-page-backed mapping.
+#define LARGE_BYTES (4 * 1024 * 1024)
+#define HUGE_PAGE_BYTES (2 * 1024 * 1024)
+
+// Matches the smallest piece reduce.c hands to a thread, so both split a vector the same way.
+#define TOUCH_MIN_CHUNK (1 << 18)
+
+typedef enum { FROM_POOL, FROM_HEAP, FROM_MMAP } BufferSource;
+
+typedef struct {
+  int32_t refs;
+  int32_t size;
+  int32_t elementBits;
+  int32_t source;  // BufferSource
+  size_t blockBytes;  // Pool class size, or mapping length
+} BufferHeader;
+
+// Free blocks of each class, linked through their first bytes. Concurrent tasks share the pool,
+// so it is locked.
+static void *freeBlocks[POOL_CLASSES];
+static int32_t freeCounts[POOL_CLASSES];
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+
+static BufferHeader *headerOf(void *data) {
+  return (BufferHeader *) ((char *) data - BUFFER_ALIGNMENT);
+}
+
+static void outOfMemory(int32_t size) {
+  vcalcWaitForEarlierTasks();
+  fprintf(stderr, "MemoryError: cannot allocate a vector of %d elements\n", size);
+  exit(1);
+}
+
+static int poolClass(size_t bytes) {
+  int c = 0;
+  while (((size_t) 1 << (c + POOL_MIN_CLASS)) < bytes)
+    c++;
+  return c;
+}
+
+static void *allocatePooled(size_t bytes, size_t *blockBytes) {
+  int c = poolClass(bytes);
+  *blockBytes = (size_t) 1 << (c + POOL_MIN_CLASS);
+  pthread_mutex_lock(&poolLock);
+  void *block = freeBlocks[c];
+  if (block != NULL) {
+    freeBlocks[c] = *(void **) block;
+    freeCounts[c]--;
+  }
+  pthread_mutex_unlock(&poolLock);
+  if (block != NULL)
+    return block;
+  return aligned_alloc(BUFFER_ALIGNMENT, *blockBytes);
+}
+
+static void releasePooled(void *block, size_t blockBytes) {
+  int c = poolClass(blockBytes);
+  pthread_mutex_lock(&poolLock);
+  int full = freeCounts[c] == POOL_MAX_FREE;
+  if (!full) {
+    *(void **) block = freeBlocks[c];
+    freeBlocks[c] = block;
+    freeCounts[c]++;
+  }
+  pthread_mutex_unlock(&poolLock);
+  if (full)
+    free(block);
+}
+
+static void touchChunk(void *context, int32_t begin, int32_t end, int32_t chunk) {
+  (void) chunk;
+  BufferHeader *header = context;
+  size_t elementBytes = (size_t) (header->elementBits / 8);
+  memset((char *) header + BUFFER_ALIGNMENT + (size_t) begin * elementBytes, 0, (size_t) (end - begin) * elementBytes);
+}
+
+// Maps `bytes` aligned to a huge page so transparent huge pages can back all of it. With
+// VCALC_HUGETLB set, explicit hugetlb pages are tried first.
+static void *allocateMapped(size_t bytes, size_t *mappedBytes) {
+  size_t length = (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+  if (getenv("VCALC_HUGETLB") != NULL) {
+    void *huge = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (huge != MAP_FAILED) {
+      *mappedBytes = length;
+      return huge;
+    }
+  }
+
+  // Over-map by one huge page, then trim both ends back to an aligned window
+  char *raw = mmap(NULL, length + HUGE_PAGE_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED)
+    return NULL;
+  char *aligned = (char *) (((uintptr_t) raw + HUGE_PAGE_BYTES - 1) & ~(uintptr_t) (HUGE_PAGE_BYTES - 1));
+  if (aligned > raw)
+    munmap(raw, (size_t) (aligned - raw));
+  size_t tail = (size_t) (raw + length + HUGE_PAGE_BYTES - (aligned + length));
+  if (tail > 0)
+    munmap(aligned + length, tail);
+  madvise(aligned, length, MADV_HUGEPAGE);
+  *mappedBytes = length;
+  return aligned;
+}
+
+void *vcalcBufferNew(int32_t size, int32_t elementBits) {
+  size_t bytes = BUFFER_ALIGNMENT + (size_t) size * (size_t) (elementBits / 8);
+  size_t blockBytes = 0;
+  BufferSource source;
+  BufferHeader *header;
+  if (bytes <= POOL_MAX_BYTES) {
+    source = FROM_POOL;
+    header = allocatePooled(bytes, &blockBytes);
+  } else if (bytes < LARGE_BYTES) {
+    source = FROM_HEAP;
+    // aligned_alloc wants a multiple of the alignment
+    header = aligned_alloc(BUFFER_ALIGNMENT, (bytes + BUFFER_ALIGNMENT - 1) / BUFFER_ALIGNMENT * BUFFER_ALIGNMENT);
+  } else {
+    source = FROM_MMAP;
+    header = allocateMapped(bytes, &blockBytes);
+  }
+  if (header == NULL)
+    outOfMemory(size);
+
+  header->refs = 1;
+  header->size = size;
+  header->elementBits = elementBits;
+  header->source = source;
+  header->blockBytes = blockBytes;
+
+  if (source == FROM_MMAP) {
+    // First touch places each page on the NUMA node of the thread that faults it in. Split the
+    // elements exactly as the parallel kernels will, so every piece lands near its worker.
+    vcalcParallelFor(size, vcalcChunkCount(size, TOUCH_MIN_CHUNK), touchChunk, header);
+  }
+  return (char *) header + BUFFER_ALIGNMENT;
+}
+
+// Tasks running at once may share a buffer, so the count changes atomically
+void vcalcBufferRetain(void *data) {
+  __atomic_fetch_add(&headerOf(data)->refs, 1, __ATOMIC_RELAXED);
+}
+
+void vcalcBufferRelease(void *data) {
+  BufferHeader *header = headerOf(data);
+  if (__atomic_sub_fetch(&header->refs, 1, __ATOMIC_ACQ_REL) != 0)
+    return;
+  switch (header->source) {
+  case FROM_POOL:
+    releasePooled(header, header->blockBytes);
+    break;
+  case FROM_MMAP:
+    munmap(header, header->blockBytes);
+    break;
+  default:
+    free(header);
+  }
+}
+
+void *vcalcBufferMakeUnique(void *data, int32_t keepContents) {
+  BufferHeader *header = headerOf(data);
+  if (__atomic_load_n(&header->refs, __ATOMIC_ACQUIRE) == 1)
+    return data;
+
+  // Shared, so the other names keep the original and this one gets its own copy
+  __atomic_fetch_sub(&header->refs, 1, __ATOMIC_ACQ_REL);
+  void *copy = vcalcBufferNew(header->size, header->elementBits);
+  if (keepContents)
+    memcpy(copy, data, (size_t) header->size * (size_t) (header->elementBits / 8));
+  return copy;
+}
@@ -0,0 +1,79 @@
+#include "gather.h"
+#include "bounds.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_GATHER 1
+#endif
+
+static int32_t loadElement(const void *data, int32_t bits, int32_t i) {
+  switch (bits) {
+  case 8:
+    return ((const int8_t *) data)[i];
+  case 16:
+    return ((const int16_t *) data)[i];
+  default:
+    return ((const int32_t *) data)[i];
+  }
+}
+
+static void storeElement(void *data, int32_t bits, int32_t i, int32_t value) {
+  switch (bits) {
+  case 8:
+    ((int8_t *) data)[i] = (int8_t) value;
+    break;
+  case 16:
+    ((int16_t *) data)[i] = (int16_t) value;
+    break;
+  default:
+    ((int32_t *) data)[i] = value;
+  }
+}
+
+// Branch-free scan so the common all-valid case vectorizes. The unsigned compare also catches
+// negative indices.
+static int checkIndices32(const int32_t *indices, int32_t count, int32_t size) {
+  uint32_t bad = 0;
+  for (int32_t i = 0; i < count; i++)
+    bad |= (uint32_t) indices[i] >= (uint32_t) size;
+  return bad != 0;
+}
+
+static void reportBadIndex(int32_t line, const void *indices, int32_t indexBits, int32_t count, int32_t size) {
+  for (int32_t i = 0; i < count; i++) {
+    int32_t index = loadElement(indices, indexBits, i);
+    if ((uint32_t) index >= (uint32_t) size)
+      vcalcIndexOutOfBounds(line, index, size);
+  }
+}
+
+#ifdef HAVE_X86_GATHER
+__attribute__((target("avx2"))) static void gather32Avx2(int32_t *result, const int32_t *source,
+                                                         const int32_t *indices, int32_t count) {
+  int32_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i index = _mm256_loadu_si256((const __m256i *) (indices + i));
+    _mm256_storeu_si256((__m256i *) (result + i), _mm256_i32gather_epi32((const int *) source, index, 4));
+  }
+  for (; i < count; i++)
+    result[i] = source[indices[i]];
+}
+#endif
+
+void vcalcGather(int32_t line, void *result, int32_t resultBits, const void *source, int32_t sourceBits,
+                 int32_t sourceSize, const void *indices, int32_t indexBits, int32_t count, int32_t checked) {
+  if (checked) {
+    if (indexBits != 32 || checkIndices32((const int32_t *) indices, count, sourceSize))
+      reportBadIndex(line, indices, indexBits, count, sourceSize);
+  }
+
+#ifdef HAVE_X86_GATHER
+  if (resultBits == 32 && sourceBits == 32 && indexBits == 32 && __builtin_cpu_supports("avx2")) {
+    gather32Avx2((int32_t *) result, (const int32_t *) source, (const int32_t *) indices, count);
+    return;
+  }
+#endif
+
+  for (int32_t i = 0; i < count; i++)
+    storeElement(result, resultBits, i, loadElement(source, sourceBits, loadElement(indices, indexBits, i)));
+}
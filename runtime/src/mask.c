@@ -0,0 +1,166 @@
+#include "mask.h"
+#include "parallel.h"
+
+// Below this many elements the thread start-up costs more than it saves.
+#define PARALLEL_THRESHOLD (1 << 20)
+
+#define WORD_BITS 64
+
+static int32_t wordCount(int32_t count) { return (count + WORD_BITS - 1) / WORD_BITS; }
+
+// Bits of the last word that belong to elements.
+static uint64_t tailBits(int32_t count) {
+  int32_t used = count % WORD_BITS;
+  return used == 0 ? ~(uint64_t) 0 : ((uint64_t) 1 << used) - 1;
+}
+
+static int32_t loadElement(const void *data, int32_t bits, int32_t i) {
+  switch (bits) {
+  case 8:
+    return ((const int8_t *) data)[i];
+  case 16:
+    return ((const int16_t *) data)[i];
+  default:
+    return ((const int32_t *) data)[i];
+  }
+}
+
+static void storeElement(void *data, int32_t bits, int32_t i, int32_t value) {
+  switch (bits) {
+  case 8:
+    ((int8_t *) data)[i] = (int8_t) value;
+    break;
+  case 16:
+    ((int16_t *) data)[i] = (int16_t) value;
+    break;
+  default:
+    ((int32_t *) data)[i] = value;
+  }
+}
+
+// Up to one word of elements starting at `begin`, widened to int so the compares below are one loop.
+static void loadWord(int32_t *out, const void *data, int32_t bits, int32_t stride, int32_t begin, int32_t n) {
+  if (stride == 0) {
+    int32_t value = loadElement(data, bits, 0);
+    for (int32_t l = 0; l < n; l++)
+      out[l] = value;
+    return;
+  }
+  switch (bits) {
+  case 8:
+    for (int32_t l = 0; l < n; l++)
+      out[l] = ((const int8_t *) data)[begin + l];
+    break;
+  case 16:
+    for (int32_t l = 0; l < n; l++)
+      out[l] = ((const int16_t *) data)[begin + l];
+    break;
+  default:
+    for (int32_t l = 0; l < n; l++)
+      out[l] = ((const int32_t *) data)[begin + l];
+  }
+}
+
+// Each lane's compare lands in its own bit, so the loop vectorizes into compares and a movemask.
+#define DEFINE_COMPARE(NAME, OP)                                          \
+  static uint64_t NAME(const int32_t *lhs, const int32_t *rhs, int32_t n) { \
+    uint64_t word = 0;                                                  \
+    for (int32_t l = 0; l < n; l++)                                     \
+      word |= (uint64_t) (lhs[l] OP rhs[l]) << l;                       \
+    return word;                                                        \
+  }
+
+DEFINE_COMPARE(compareGreater, >)
+DEFINE_COMPARE(compareLess, <)
+DEFINE_COMPARE(compareEqual, ==)
+DEFINE_COMPARE(compareNotEqual, !=)
+
+typedef struct {
+  int32_t op;
+  uint64_t *mask;
+  const void *lhs;
+  int32_t lhsBits;
+  int32_t lhsStride;
+  const void *rhs;
+  int32_t rhsBits;
+  int32_t rhsStride;
+  int32_t count;
+} CompareContext;
+
+// Fills words [begin, end) of the mask.
+static void compareRange(const CompareContext *compare, int32_t begin, int32_t end) {
+  int32_t lhs[WORD_BITS], rhs[WORD_BITS];
+  for (int32_t w = begin; w < end; w++) {
+    int32_t first = w * WORD_BITS;
+    int32_t n = compare->count - first < WORD_BITS ? compare->count - first : WORD_BITS;
+    loadWord(lhs, compare->lhs, compare->lhsBits, compare->lhsStride, first, n);
+    loadWord(rhs, compare->rhs, compare->rhsBits, compare->rhsStride, first, n);
+    switch (compare->op) {
+    case VCALC_MASK_GREATER:
+      compare->mask[w] = compareGreater(lhs, rhs, n);
+      break;
+    case VCALC_MASK_LESS:
+      compare->mask[w] = compareLess(lhs, rhs, n);
+      break;
+    case VCALC_MASK_EQUAL:
+      compare->mask[w] = compareEqual(lhs, rhs, n);
+      break;
+    default:
+      compare->mask[w] = compareNotEqual(lhs, rhs, n);
+    }
+  }
+}
+
+static void compareChunk(void *context, int32_t begin, int32_t end, int32_t chunk) {
+  (void) chunk;
+  compareRange((const CompareContext *) context, begin, end);
+}
+
+void vcalcMaskCompare(int32_t op, uint64_t *mask, const void *lhs, int32_t lhsBits, int32_t lhsStride,
+                      const void *rhs, int32_t rhsBits, int32_t rhsStride, int32_t count) {
+  // Threads split the words, so no two write the same one
+  CompareContext compare = { op, mask, lhs, lhsBits, lhsStride, rhs, rhsBits, rhsStride, count };
+  int32_t words = wordCount(count);
+  int32_t chunks = count >= PARALLEL_THRESHOLD ? vcalcChunkCount(words, PARALLEL_THRESHOLD / 4 / WORD_BITS) : 1;
+  if (chunks == 1) {
+    compareRange(&compare, 0, words);
+    return;
+  }
+  vcalcParallelFor(words, chunks, compareChunk, &compare);
+}
+
+void vcalcMaskCombine(int32_t op, uint64_t *mask, const uint64_t *lhs, const uint64_t *rhs, int32_t count) {
+  int32_t words = wordCount(count);
+  uint64_t flip = op == VCALC_MASK_EQUAL ? ~(uint64_t) 0 : 0;
+  for (int32_t w = 0; w < words; w++)
+    mask[w] = (lhs[w] ^ rhs[w]) ^ flip;
+  // Equal padding bits would otherwise read as set elements
+  if (words > 0)
+    mask[words - 1] &= tailBits(count);
+}
+
+int32_t vcalcMaskCount(const uint64_t *mask, int32_t count) {
+  int32_t words = wordCount(count);
+  int32_t set = 0;
+  for (int32_t w = 0; w < words; w++)
+    set += __builtin_popcountll(mask[w]);
+  return set;
+}
+
+void vcalcMaskWiden(void *data, int32_t elementBits, const uint64_t *mask, int32_t count) {
+  for (int32_t k = 0; k < count; k++)
+    storeElement(data, elementBits, k, (int32_t) ((mask[k / WORD_BITS] >> (k % WORD_BITS)) & 1));
+}
+
+void vcalcMaskCompress(void *result, int32_t resultBits, const void *domain, int32_t domainBits,
+                       const uint64_t *mask, int32_t count) {
+  // Only set bits are visited, so sparse masks skip most of the domain
+  int32_t words = wordCount(count);
+  int32_t kept = 0;
+  for (int32_t w = 0; w < words; w++) {
+    for (uint64_t word = mask[w]; word != 0; word &= word - 1) {
+      int32_t k = w * WORD_BITS + __builtin_ctzll(word);
+      storeElement(result, resultBits, kept++, loadElement(domain, domainBits, k));
+    }
+  }
+}
@@ -0,0 +1,145 @@
+#include "matrix.h"
+#include "arithmetic.h"
+#include "parallel.h"
+#include "tasks.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Below this many elements (or multiply-adds) the thread start-up costs more than it saves.
+#define PARALLEL_THRESHOLD (1 << 18)
+
+// Multiply tiles: a TILE_INNER x TILE_COLUMNS block of rhs (256 KiB) stays in L2 while every row
+// of a TILE_ROWS block of lhs streams past it, and each row of the result tile fits in L1.
+#define TILE_ROWS 64
+#define TILE_INNER 256
+#define TILE_COLUMNS 256
+
+// Arithmetic goes through uint32_t so overflow wraps like int arithmetic instead of being undefined.
+#define ADD(a, b) ((int32_t) ((uint32_t) (a) + (uint32_t) (b)))
+#define SUB(a, b) ((int32_t) ((uint32_t) (a) - (uint32_t) (b)))
+#define MUL(a, b) ((int32_t) ((uint32_t) (a) * (uint32_t) (b)))
+#define DIV(a, b) ((b) == -1 ? SUB(0, (a)) : (a) / (b))
+#define GREATERTHAN(a, b) ((int32_t) ((a) > (b)))
+#define LESSTHAN(a, b) ((int32_t) ((a) < (b)))
+#define ISEQUAL(a, b) ((int32_t) ((a) == (b)))
+#define ISNOTEQUAL(a, b) ((int32_t) ((a) != (b)))
+
+// One loop per operator and operand shape, so each is a plain stream the compiler vectorizes.
+#define ELEMENTWISE(COMBINE)                                          \
+  if (c->lhsStride && c->rhsStride) {                                 \
+    for (int32_t i = begin; i < end; i++)                             \
+      c->result[i] = COMBINE(c->lhs[i], c->rhs[i]);                   \
+  } else if (c->rhsStride) {                                          \
+    int32_t a = c->lhs[0];                                            \
+    for (int32_t i = begin; i < end; i++)                             \
+      c->result[i] = COMBINE(a, c->rhs[i]);                           \
+  } else {                                                            \
+    int32_t b = c->rhs[0];                                            \
+    for (int32_t i = begin; i < end; i++)                             \
+      c->result[i] = COMBINE(c->lhs[i], b);                           \
+  }
+
+typedef struct {
+  int32_t op;
+  int32_t *result;
+  const int32_t *lhs;
+  int32_t lhsStride;
+  const int32_t *rhs;
+  int32_t rhsStride;
+} ElementwiseContext;
+
+static void elementwiseChunk(void *context, int32_t begin, int32_t end, int32_t chunk) {
+  (void) chunk;
+  ElementwiseContext *c = context;
+  switch (c->op) {
+  case VCALC_MATRIX_ADD: ELEMENTWISE(ADD) break;
+  case VCALC_MATRIX_SUB: ELEMENTWISE(SUB) break;
+  case VCALC_MATRIX_MUL: ELEMENTWISE(MUL) break;
+  case VCALC_MATRIX_DIV: ELEMENTWISE(DIV) break;
+  case VCALC_MATRIX_GREATERTHAN: ELEMENTWISE(GREATERTHAN) break;
+  case VCALC_MATRIX_LESSTHAN: ELEMENTWISE(LESSTHAN) break;
+  case VCALC_MATRIX_ISEQUAL: ELEMENTWISE(ISEQUAL) break;
+  case VCALC_MATRIX_ISNOTEQUAL: ELEMENTWISE(ISNOTEQUAL) break;
+  }
+}
+
+void vcalcMatrixElementwise(int32_t line, int32_t op, int32_t *result, const int32_t *lhs, int32_t lhsStride,
+                            const int32_t *rhs, int32_t rhsStride, int32_t size) {
+  if (op == VCALC_MATRIX_DIV) {
+    // Check every divisor up front so the division loop itself has no exits
+    int32_t divisors = rhsStride ? size : (size > 0);
+    for (int32_t i = 0; i < divisors; i++) {
+      if (rhs[i] == 0)
+        vcalcDivisionByZero(line);
+    }
+  }
+
+  ElementwiseContext context = { op, result, lhs, lhsStride, rhs, rhsStride };
+  int32_t chunks = size >= PARALLEL_THRESHOLD ? vcalcChunkCount(size, PARALLEL_THRESHOLD / 4) : 1;
+  vcalcParallelFor(size, chunks, elementwiseChunk, &context);
+}
+
+typedef struct {
+  int32_t *result;
+  const int32_t *lhs;
+  const int32_t *rhs;
+  int32_t inner;
+  int32_t columns;
+} MultiplyContext;
+
+// Rows [begin, end) of the result.
+static void multiplyRows(void *context, int32_t begin, int32_t end, int32_t chunk) {
+  (void) chunk;
+  MultiplyContext *c = context;
+  for (int32_t i = begin; i < end; i++)
+    memset(c->result + (int64_t) i * c->columns, 0, (size_t) c->columns * sizeof(int32_t));
+
+  for (int32_t ii = begin; ii < end; ii += TILE_ROWS) {
+    int32_t iEnd = ii + TILE_ROWS < end ? ii + TILE_ROWS : end;
+    for (int32_t kk = 0; kk < c->inner; kk += TILE_INNER) {
+      int32_t kEnd = kk + TILE_INNER < c->inner ? kk + TILE_INNER : c->inner;
+      for (int32_t jj = 0; jj < c->columns; jj += TILE_COLUMNS) {
+        int32_t jEnd = jj + TILE_COLUMNS < c->columns ? jj + TILE_COLUMNS : c->columns;
+        for (int32_t i = ii; i < iEnd; i++) {
+          uint32_t *row = (uint32_t *) c->result + (int64_t) i * c->columns;
+          for (int32_t k = kk; k < kEnd; k++) {
+            // Broadcast one lhs element across a contiguous run of an rhs row
+            uint32_t a = (uint32_t) c->lhs[(int64_t) i * c->inner + k];
+            const int32_t *rhsRow = c->rhs + (int64_t) k * c->columns;
+            for (int32_t j = jj; j < jEnd; j++)
+              row[j] += a * (uint32_t) rhsRow[j];
+          }
+        }
+      }
+    }
+  }
+}
+
+void vcalcMatrixMultiply(int32_t line, int32_t *result, const int32_t *lhs, int32_t rows, int32_t inner,
+                         const int32_t *rhs, int32_t rhsRows, int32_t columns) {
+  if (inner != rhsRows) {
+    vcalcWaitForEarlierTasks();
+    fprintf(stderr, "ShapeError on line %d: cannot multiply a %dx%d matrix by a %dx%d matrix\n", line, rows, inner, rhsRows, columns);
+    exit(1);
+  }
+
+  // Whole row blocks per thread, so threads never share a tile of the result
+  MultiplyContext context = { result, lhs, rhs, inner, columns };
+  int64_t work = (int64_t) rows * inner * columns;
+  int32_t chunks = work >= PARALLEL_THRESHOLD ? vcalcChunkCount(rows, TILE_ROWS) : 1;
+  vcalcParallelFor(rows, chunks, multiplyRows, &context);
+}
+
+void vcalcMatrixShapeMismatch(int32_t line, int32_t rows, int32_t columns, int32_t otherRows, int32_t otherColumns) {
+  vcalcWaitForEarlierTasks();
+  fprintf(stderr, "ShapeError on line %d: cannot combine a %dx%d matrix with a %dx%d matrix\n", line, rows, columns, otherRows, otherColumns);
+  exit(1);
+}
+
+void vcalcMatrixIndexOutOfBounds(int32_t line, int32_t row, int32_t column, int32_t rows, int32_t columns) {
+  vcalcWaitForEarlierTasks();
+  fprintf(stderr, "IndexError on line %d: index [%d, %d] is out of bounds for matrix of size %dx%d\n", line, row, column, rows, columns);
+  exit(1);
+}
@@ -0,0 +1,83 @@
+#include "parallel.h"
+#include "tasks.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct {
+  vcalcChunkFunction function;
+  void *context;
+  int32_t begin;
+  int32_t end;
+  int32_t chunk;
+} ChunkTask;
+
+static int32_t coreCount(void) {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  return cores > 0 ? (int32_t) cores : 1;
+}
+
+static int32_t threadCount(void) {
+  const char *env = getenv("VCALC_THREADS");
+  if (env != NULL && atoi(env) > 0)
+    return atoi(env);
+  return coreCount();
+}
+
+int32_t vcalcChunkCount(int32_t size, int32_t minChunkSize) {
+  int32_t chunks = threadCount();
+  if (chunks > size / minChunkSize)
+    chunks = size / minChunkSize;
+  if (chunks > VCALC_MAX_CHUNKS)
+    chunks = VCALC_MAX_CHUNKS;
+  return chunks > 1 ? chunks : 1;
+}
+
+static void *runChunk(void *arg) {
+  ChunkTask *task = (ChunkTask *) arg;
+  task->function(task->context, task->begin, task->end, task->chunk);
+  return NULL;
+}
+
+void vcalcParallelFor(int32_t size, int32_t chunks, vcalcChunkFunction function, void *context) {
+  ChunkTask tasks[VCALC_MAX_CHUNKS];
+  pthread_t threads[VCALC_MAX_CHUNKS];
+  int started[VCALC_MAX_CHUNKS] = {0};
+
+  for (int32_t c = 0; c < chunks; c++) {
+    tasks[c].function = function;
+    tasks[c].context = context;
+    tasks[c].begin = (int32_t) ((int64_t) size * c / chunks);
+    tasks[c].end = (int32_t) ((int64_t) size * (c + 1) / chunks);
+    tasks[c].chunk = c;
+  }
+
+  // Pin piece c to core c so a given piece of every vector is always worked on from the same
+  // core, and so from the NUMA node its pages were first touched on. Not inside a task, where
+  // statements running at once would all pin to the same cores.
+  int32_t cores = coreCount();
+  int pin = chunks <= cores && vcalcCurrentTask() < 0;
+
+  // The calling thread takes the first piece; fall back to it if a thread can't start.
+  for (int32_t c = 1; c < chunks; c++) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (pin) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(c, &cpus);
+      pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+    started[c] = pthread_create(&threads[c], &attr, runChunk, &tasks[c]) == 0;
+    pthread_attr_destroy(&attr);
+  }
+  runChunk(&tasks[0]);
+  for (int32_t c = 1; c < chunks; c++) {
+    if (started[c])
+      pthread_join(threads[c], NULL);
+    else
+      runChunk(&tasks[c]);
+  }
+}
@@ -0,0 +1,148 @@
+#include "print.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Chunks in flight: one being filled, one being formatted and one spare so neither side waits on
+// the other in the steady state. 3 x 64 KiB of elements plus their text stays within L2.
+#define STREAM_BUFFERS 3
+
+// Longest formatted element: a sign, 10 digits and the separating space.
+#define MAX_ELEMENT_TEXT 12
+
+static int32_t buffers[STREAM_BUFFERS][VCALC_STREAM_CHUNK];
+static int32_t counts[STREAM_BUFFERS];
+static char text[VCALC_STREAM_CHUNK * MAX_ELEMENT_TEXT];
+
+static pthread_t formatter;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static int64_t submitted;  // Chunks handed to the formatter
+static int64_t printed;    // Chunks the formatter has finished with
+static int finished;
+static int anyPrinted;  // Whether a separator is needed before the next element
+
+static char *formatInt(char *out, int32_t value) {
+  char digits[10];
+  int n = 0;
+  uint32_t magnitude = value < 0 ? 0u - (uint32_t) value : (uint32_t) value;
+  if (value < 0)
+    *out++ = '-';
+  do {
+    digits[n++] = (char) ('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude != 0);
+  while (n > 0)
+    *out++ = digits[--n];
+  return out;
+}
+
+static void writeElements(const int32_t *elements, int32_t count) {
+  char *out = text;
+  for (int32_t i = 0; i < count; i++) {
+    if (anyPrinted)
+      *out++ = ' ';
+    out = formatInt(out, elements[i]);
+    anyPrinted = 1;
+  }
+  fwrite(text, 1, (size_t) (out - text), stdout);
+}
+
+void vcalcPrintInt(int32_t value) {
+  printf("%d\n", value);
+}
+
+void vcalcPrintVector(const void *data, int32_t size, int32_t elementBits) {
+  putchar('[');
+  for (int32_t i = 0; i < size; i++) {
+    int32_t value = elementBits == 8 ? ((const int8_t *) data)[i]
+                  : elementBits == 16 ? ((const int16_t *) data)[i]
+                  : ((const int32_t *) data)[i];
+    printf(i ? " %d" : "%d", value);
+  }
+  fputs("]\n", stdout);
+}
+
+void vcalcPrintText(const char *text, int64_t size) {
+  // Straight to the file descriptor: one write call unless the pipe takes it in pieces
+  fflush(stdout);
+  while (size > 0) {
+    ssize_t written = write(STDOUT_FILENO, text, (size_t) size);
+    if (written <= 0)
+      return;
+    text += written;
+    size -= written;
+  }
+}
+
+void vcalcPrintMatrix(const int32_t *data, int32_t rows, int32_t columns) {
+  putchar('[');
+  for (int32_t i = 0; i < rows; i++) {
+    fputs(i ? " [" : "[", stdout);
+    for (int32_t j = 0; j < columns; j++)
+      printf(j ? " %d" : "%d", data[(int64_t) i * columns + j]);
+    putchar(']');
+  }
+  fputs("]\n", stdout);
+}
+
+static void *formatChunks(void *unused) {
+  (void) unused;
+  pthread_mutex_lock(&lock);
+  for (;;) {
+    while (printed == submitted && !finished)
+      pthread_cond_wait(&changed, &lock);
+    if (printed == submitted)
+      break;
+    int slot = (int) (printed % STREAM_BUFFERS);
+    pthread_mutex_unlock(&lock);
+
+    writeElements(buffers[slot], counts[slot]);
+
+    pthread_mutex_lock(&lock);
+    printed++;
+    pthread_cond_broadcast(&changed);
+  }
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+void vcalcStreamBegin(void) {
+  submitted = printed = 0;
+  finished = 0;
+  anyPrinted = 0;
+  putchar('[');
+  if (pthread_create(&formatter, NULL, formatChunks, NULL) != 0) {
+    fprintf(stderr, "Cannot start the print formatter thread\n");
+    exit(1);
+  }
+}
+
+int32_t *vcalcStreamBuffer(void) {
+  // Wait for a free slot; the formatter never holds more than one
+  pthread_mutex_lock(&lock);
+  while (submitted - printed >= STREAM_BUFFERS - 1)
+    pthread_cond_wait(&changed, &lock);
+  int slot = (int) (submitted % STREAM_BUFFERS);
+  pthread_mutex_unlock(&lock);
+  return buffers[slot];
+}
+
+void vcalcStreamSubmit(int32_t count) {
+  pthread_mutex_lock(&lock);
+  counts[submitted % STREAM_BUFFERS] = count;
+  submitted++;
+  pthread_cond_broadcast(&changed);
+  pthread_mutex_unlock(&lock);
+}
+
+void vcalcStreamEnd(void) {
+  pthread_mutex_lock(&lock);
+  finished = 1;
+  pthread_cond_broadcast(&changed);
+  pthread_mutex_unlock(&lock);
+  pthread_join(formatter, NULL);
+  fputs("]\n", stdout);
+}
@@ -0,0 +1,227 @@
+#include "profile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MAX_DEPTH 256
+
+// Trace events beyond this are dropped, but still counted in the summary.
+#define MAX_EVENTS (1 << 20)
+
+typedef struct {
+  int32_t line;
+  int32_t kind;
+  int64_t start;
+  int64_t duration;
+  int32_t iterations;
+  int32_t elements;
+} Event;
+
+typedef struct {
+  int32_t line;
+  int32_t kind;
+  int64_t count;
+  int64_t total;
+  int64_t self;
+  int64_t iterations;
+  int64_t elements;
+} Hotspot;
+
+typedef struct {
+  int32_t line;
+  int32_t kind;
+  int64_t start;
+  int64_t children;  // Time spent in nested regions, subtracted for self time
+} OpenRegion;
+
+typedef struct {
+  int32_t line;
+  int64_t taken;
+  int64_t notTaken;
+} Branch;
+
+static const char *kindNames[] = { "statement", "loop body", "generator", "filter" };
+
+static OpenRegion stack[MAX_DEPTH];
+static int32_t depth = 0;
+static int64_t origin = -1;
+
+static Event *events = NULL;
+static int32_t eventCount = 0;
+static int32_t eventCapacity = 0;
+
+static Hotspot *hotspots = NULL;
+static int32_t hotspotCount = 0;
+
+static Branch *branches = NULL;
+static int32_t branchCount = 0;
+
+static int64_t now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void recordEvent(Event event) {
+  if (eventCount == eventCapacity) {
+    if (eventCapacity == MAX_EVENTS)
+      return;
+    eventCapacity = eventCapacity ? eventCapacity * 2 : 1024;
+    events = realloc(events, sizeof(Event) * eventCapacity);
+    if (events == NULL) {
+      eventCount = eventCapacity = 0;
+      return;
+    }
+  }
+  events[eventCount++] = event;
+}
+
+static void recordHotspot(Event event, int64_t self) {
+  Hotspot *hotspot = NULL;
+  for (int32_t i = 0; i < hotspotCount; i++) {
+    if (hotspots[i].line == event.line && hotspots[i].kind == event.kind) {
+      hotspot = &hotspots[i];
+      break;
+    }
+  }
+  if (hotspot == NULL) {
+    hotspots = realloc(hotspots, sizeof(Hotspot) * (hotspotCount + 1));
+    if (hotspots == NULL) {
+      hotspotCount = 0;
+      return;
+    }
+    hotspot = &hotspots[hotspotCount++];
+    *hotspot = (Hotspot) { event.line, event.kind, 0, 0, 0, 0, 0 };
+  }
+  hotspot->count++;
+  hotspot->total += event.duration;
+  hotspot->self += self;
+  hotspot->iterations += event.iterations;
+  hotspot->elements += event.elements;
+}
+
+static void writeTrace(void) {
+  const char *path = getenv("VCALC_TRACE");
+  if (path == NULL)
+    path = "vcalc-trace.json";
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "vcalc profile: cannot write %s\n", path);
+    return;
+  }
+
+  // Complete ("X") events in microseconds, which Chrome's tracing view and Perfetto both load
+  fprintf(file, "{\"traceEvents\":[\n");
+  for (int32_t i = 0; i < eventCount; i++) {
+    Event *e = &events[i];
+    fprintf(file,
+            "%s{\"name\":\"line %d %s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+            "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"line\":%d,\"iterations\":%d,\"elements\":%d}}\n",
+            i ? "," : "", e->line, kindNames[e->kind], kindNames[e->kind], e->start / 1000.0, e->duration / 1000.0,
+            e->line, e->iterations, e->elements);
+  }
+  fprintf(file, "],\"displayTimeUnit\":\"ns\"}\n");
+  fclose(file);
+}
+
+static int compareSelfTime(const void *a, const void *b) {
+  int64_t lhs = ((const Hotspot *) a)->self;
+  int64_t rhs = ((const Hotspot *) b)->self;
+  return lhs < rhs ? 1 : lhs > rhs ? -1 : 0;
+}
+
+static void writeSummary(void) {
+  int64_t total = 0;
+  for (int32_t i = 0; i < hotspotCount; i++)
+    total += hotspots[i].self;
+  qsort(hotspots, hotspotCount, sizeof(Hotspot), compareSelfTime);
+
+  fprintf(stderr, "%6s  %-10s %10s %12s %12s %7s %12s %12s\n", "line", "region", "count", "self (us)", "total (us)",
+          "self %", "iterations", "elements");
+  for (int32_t i = 0; i < hotspotCount; i++) {
+    Hotspot *h = &hotspots[i];
+    fprintf(stderr, "%6d  %-10s %10lld %12.1f %12.1f %6.1f%% %12lld %12lld\n", h->line, kindNames[h->kind],
+            (long long) h->count, h->self / 1000.0, h->total / 1000.0, total ? 100.0 * h->self / total : 0.0,
+            (long long) h->iterations, (long long) h->elements);
+  }
+}
+
+static void writeProfileData(void) {
+  const char *path = getenv("VCALC_PROFILE_DATA");
+  if (path == NULL)
+    path = "vcalc-profile.txt";
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "vcalc profile: cannot write %s\n", path);
+    return;
+  }
+  for (int32_t i = 0; i < hotspotCount; i++) {
+    Hotspot *h = &hotspots[i];
+    fprintf(file, "region %d %d %lld %lld %lld %lld %lld\n", h->line, h->kind, (long long) h->count,
+            (long long) h->total, (long long) h->self, (long long) h->iterations, (long long) h->elements);
+  }
+  for (int32_t i = 0; i < branchCount; i++) {
+    Branch *b = &branches[i];
+    fprintf(file, "branch %d %lld %lld\n", b->line, (long long) b->taken, (long long) b->notTaken);
+  }
+  fclose(file);
+}
+
+static void finish(void) {
+  writeTrace();
+  writeSummary();
+  writeProfileData();
+  free(events);
+  free(hotspots);
+  free(branches);
+}
+
+static void start(void) {
+  if (origin < 0) {
+    origin = now();
+    atexit(finish);
+  }
+}
+
+void vcalcProfileEnter(int32_t line, int32_t kind) {
+  start();
+  if (depth == MAX_DEPTH) {
+    fprintf(stderr, "vcalc profile: regions nested too deeply\n");
+    exit(1);
+  }
+  stack[depth++] = (OpenRegion) { line, kind, now() - origin, 0 };
+}
+
+void vcalcProfileExit(int32_t iterations, int32_t elements) {
+  int64_t end = now() - origin;
+  OpenRegion region = stack[--depth];
+  Event event = { region.line, region.kind, region.start, end - region.start, iterations, elements };
+  if (depth > 0)
+    stack[depth - 1].children += event.duration;
+  recordEvent(event);
+  recordHotspot(event, event.duration - region.children);
+}
+
+void vcalcProfileBranch(int32_t line, int32_t taken) {
+  start();
+  Branch *branch = NULL;
+  for (int32_t i = 0; i < branchCount; i++) {
+    if (branches[i].line == line) {
+      branch = &branches[i];
+      break;
+    }
+  }
+  if (branch == NULL) {
+    Branch *grown = realloc(branches, sizeof(Branch) * (branchCount + 1));
+    if (grown == NULL)
+      return;
+    branches = grown;
+    branch = &branches[branchCount++];
+    *branch = (Branch) { line, 0, 0 };
+  }
+  if (taken)
+    branch->taken++;
+  else
+    branch->notTaken++;
+}
@@ -0,0 +1,129 @@
+#include "reduce.h"
+#include "parallel.h"
+#include "tasks.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Below this many elements the thread start-up costs more than it saves.
+#define PARALLEL_THRESHOLD (1 << 20)
+
+// Independent accumulators per kernel. They map onto SIMD lanes and are combined pairwise at the end.
+#define LANES 16
+
+#define ADD(a, b) ((a) + (b))
+#define MUL(a, b) ((a) * (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+// Sums and products accumulate in uint32_t so overflow wraps instead of being undefined.
+#define DEFINE_KERNEL(NAME, BITS, TYPE, IDENTITY, COMBINE)                                        \
+  static TYPE NAME##BITS(const int##BITS##_t *data, int32_t begin, int32_t end) {              \
+    TYPE lanes[LANES];                                                                         \
+    for (int l = 0; l < LANES; l++)                                                            \
+      lanes[l] = IDENTITY;                                                                     \
+    int32_t i = begin;                                                                         \
+    for (; i + LANES <= end; i += LANES)                                                       \
+      for (int l = 0; l < LANES; l++)                                                          \
+        lanes[l] = COMBINE(lanes[l], (TYPE) data[i + l]);                                      \
+    for (; i < end; i++)                                                                       \
+      lanes[0] = COMBINE(lanes[0], (TYPE) data[i]);                                            \
+    for (int width = LANES / 2; width > 0; width /= 2)                                         \
+      for (int l = 0; l < width; l++)                                                          \
+        lanes[l] = COMBINE(lanes[l], lanes[l + width]);                                        \
+    return lanes[0];                                                                           \
+  }
+
+#define DEFINE_KERNELS(NAME, TYPE, IDENTITY, COMBINE) \
+  DEFINE_KERNEL(NAME, 8, TYPE, IDENTITY, COMBINE)     \
+  DEFINE_KERNEL(NAME, 16, TYPE, IDENTITY, COMBINE)    \
+  DEFINE_KERNEL(NAME, 32, TYPE, IDENTITY, COMBINE)
+
+DEFINE_KERNELS(sum, uint32_t, 0u, ADD)
+DEFINE_KERNELS(product, uint32_t, 1u, MUL)
+DEFINE_KERNELS(min, int32_t, INT32_MAX, MIN)
+DEFINE_KERNELS(max, int32_t, INT32_MIN, MAX)
+
+typedef enum { REDUCE_SUM, REDUCE_PRODUCT, REDUCE_MIN, REDUCE_MAX } ReduceOp;
+
+typedef struct {
+  ReduceOp op;
+  const void *data;
+  int32_t elementBits;
+  uint32_t partials[VCALC_MAX_CHUNKS];
+} ReduceContext;
+
+#define DISPATCH(NAME, BITS, DATA, BEGIN, END) \
+  ((BITS) == 8 ? NAME##8((DATA), (BEGIN), (END)) : (BITS) == 16 ? NAME##16((DATA), (BEGIN), (END)) : NAME##32((DATA), (BEGIN), (END)))
+
+static uint32_t reduceRange(ReduceOp op, const void *data, int32_t elementBits, int32_t begin, int32_t end) {
+  switch (op) {
+  case REDUCE_SUM:
+    return DISPATCH(sum, elementBits, data, begin, end);
+  case REDUCE_PRODUCT:
+    return DISPATCH(product, elementBits, data, begin, end);
+  case REDUCE_MIN:
+    return (uint32_t) DISPATCH(min, elementBits, data, begin, end);
+  case REDUCE_MAX:
+    return (uint32_t) DISPATCH(max, elementBits, data, begin, end);
+  }
+  return 0;
+}
+
+static uint32_t combine(ReduceOp op, uint32_t a, uint32_t b) {
+  switch (op) {
+  case REDUCE_SUM:
+    return a + b;
+  case REDUCE_PRODUCT:
+    return a * b;
+  case REDUCE_MIN:
+    return (uint32_t) MIN((int32_t) a, (int32_t) b);
+  case REDUCE_MAX:
+    return (uint32_t) MAX((int32_t) a, (int32_t) b);
+  }
+  return 0;
+}
+
+static void reduceChunk(void *context, int32_t begin, int32_t end, int32_t chunk) {
+  ReduceContext *reduction = (ReduceContext *) context;
+  reduction->partials[chunk] = reduceRange(reduction->op, reduction->data, reduction->elementBits, begin, end);
+}
+
+static int32_t reduce(ReduceOp op, const void *data, int32_t size, int32_t elementBits) {
+  int32_t chunks = size >= PARALLEL_THRESHOLD ? vcalcChunkCount(size, PARALLEL_THRESHOLD / 4) : 1;
+  if (chunks == 1)
+    return (int32_t) reduceRange(op, data, elementBits, 0, size);
+
+  ReduceContext reduction = { op, data, elementBits, {0} };
+  vcalcParallelFor(size, chunks, reduceChunk, &reduction);
+  uint32_t result = reduction.partials[0];
+  for (int32_t c = 1; c < chunks; c++)
+    result = combine(op, result, reduction.partials[c]);
+  return (int32_t) result;
+}
+
+int32_t vcalcSum(const void *data, int32_t size, int32_t elementBits) {
+  return reduce(REDUCE_SUM, data, size, elementBits);
+}
+
+int32_t vcalcProduct(const void *data, int32_t size, int32_t elementBits) {
+  return reduce(REDUCE_PRODUCT, data, size, elementBits);
+}
+
+int32_t vcalcMin(int32_t line, const void *data, int32_t size, int32_t elementBits) {
+  if (size == 0)
+    vcalcEmptyReduction(line);
+  return reduce(REDUCE_MIN, data, size, elementBits);
+}
+
+int32_t vcalcMax(int32_t line, const void *data, int32_t size, int32_t elementBits) {
+  if (size == 0)
+    vcalcEmptyReduction(line);
+  return reduce(REDUCE_MAX, data, size, elementBits);
+}
+
+void vcalcEmptyReduction(int32_t line) {
+  vcalcWaitForEarlierTasks();
+  fprintf(stderr, "ReductionError on line %d: min or max of an empty vector\n", line);
+  exit(1);
+}
@@ -0,0 +1,130 @@
+#include "tasks.h"
+#include "parallel.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+typedef struct {
+  int32_t count;
+  vcalcTaskFunction const *tasks;
+  int32_t *waiting;         // Unfinished dependencies of each task, or -1 once it has started
+  int32_t *firstDependent;  // Tasks waiting on task i are dependents[firstDependent[i] .. firstDependent[i + 1])
+  int32_t *dependents;
+  char *done;
+  int32_t finished;
+  int32_t finishedPrefix;   // Every task below this one has finished
+} TaskGraph;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static TaskGraph graph;
+static __thread int32_t currentTask = -1;
+
+int32_t vcalcCurrentTask(void) {
+  return currentTask;
+}
+
+// Claims the lowest-numbered ready task below `limit`, so work follows program order where it
+// can. Returns -1 if there is none. Called with the lock held.
+static int32_t claimReady(int32_t limit) {
+  for (int32_t i = graph.finishedPrefix; i < limit; i++) {
+    if (graph.waiting[i] == 0) {
+      graph.waiting[i] = -1;
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Runs task i without the lock, then releases its dependents. Called and returns with the lock held.
+static void runTask(int32_t i) {
+  pthread_mutex_unlock(&lock);
+  int32_t enclosing = currentTask;
+  currentTask = i;
+  graph.tasks[i]();
+  currentTask = enclosing;
+  pthread_mutex_lock(&lock);
+
+  graph.done[i] = 1;
+  graph.finished++;
+  while (graph.finishedPrefix < graph.count && graph.done[graph.finishedPrefix])
+    graph.finishedPrefix++;
+  for (int32_t d = graph.firstDependent[i]; d < graph.firstDependent[i + 1]; d++)
+    graph.waiting[graph.dependents[d]]--;
+  pthread_cond_broadcast(&changed);
+}
+
+static void *runWorker(void *unused) {
+  (void) unused;
+  pthread_mutex_lock(&lock);
+  while (graph.finished < graph.count) {
+    int32_t i = claimReady(graph.count);
+    if (i < 0)
+      pthread_cond_wait(&changed, &lock);
+    else
+      runTask(i);
+  }
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+void vcalcRunTasks(int32_t count, vcalcTaskFunction const *tasks, const int32_t *firstDependency, const int32_t *dependencies) {
+  int32_t edges = firstDependency[count];
+  graph.count = count;
+  graph.tasks = tasks;
+  graph.waiting = calloc((size_t) count, sizeof(int32_t));
+  graph.firstDependent = calloc((size_t) count + 1, sizeof(int32_t));
+  graph.dependents = malloc((size_t) (edges > 0 ? edges : 1) * sizeof(int32_t));
+  graph.done = calloc((size_t) count, 1);
+  graph.finished = 0;
+  graph.finishedPrefix = 0;
+
+  // Turn each task's list of dependencies around into a list of dependents
+  for (int32_t i = 0; i < count; i++) {
+    graph.waiting[i] = firstDependency[i + 1] - firstDependency[i];
+    for (int32_t d = firstDependency[i]; d < firstDependency[i + 1]; d++)
+      graph.firstDependent[dependencies[d] + 1]++;
+  }
+  for (int32_t i = 0; i < count; i++)
+    graph.firstDependent[i + 1] += graph.firstDependent[i];
+  int32_t *next = malloc(((size_t) count + 1) * sizeof(int32_t));
+  for (int32_t i = 0; i <= count; i++)
+    next[i] = graph.firstDependent[i];
+  for (int32_t i = 0; i < count; i++) {
+    for (int32_t d = firstDependency[i]; d < firstDependency[i + 1]; d++)
+      graph.dependents[next[dependencies[d]]++] = i;
+  }
+  free(next);
+
+  // The calling thread works too; if a thread can't start the others pick up its share
+  pthread_t threads[VCALC_MAX_CHUNKS];
+  int started[VCALC_MAX_CHUNKS] = {0};
+  int32_t workers = vcalcChunkCount(count, 1);
+  for (int32_t w = 1; w < workers; w++)
+    started[w] = pthread_create(&threads[w], NULL, runWorker, NULL) == 0;
+  runWorker(NULL);
+  for (int32_t w = 1; w < workers; w++) {
+    if (started[w])
+      pthread_join(threads[w], NULL);
+  }
+
+  free(graph.waiting);
+  free(graph.firstDependent);
+  free(graph.dependents);
+  free(graph.done);
+}
+
+void vcalcWaitForEarlierTasks(void) {
+  if (currentTask < 0)
+    return;
+  pthread_mutex_lock(&lock);
+  while (graph.finishedPrefix < currentTask) {
+    // Run earlier tasks here rather than wait for a worker, since every worker may be stuck in here
+    int32_t i = claimReady(currentTask);
+    if (i < 0)
+      pthread_cond_wait(&changed, &lock);
+    else
+      runTask(i);
+  }
+  pthread_mutex_unlock(&lock);
+}
@@ -17,6 +17,23 @@ namespace vcalc {
     }
     bool AST::isNil() { return token == nullptr; }
 
+    size_t AST::getLine() {
+        if ( token != nullptr && token->getLine() > 0 ) return token->getLine();
+        for ( auto child : children ) {
+            size_t line = child->getLine();
+            if ( line > 0 ) return line;
+        }
+        return 0;
+    }
+
+    size_t AST::getColumn() {
+        if ( token != nullptr && token->getLine() > 0 ) return token->getCharPositionInLine() + 1;
+        for ( auto child : children ) {
+            if ( child->getLine() > 0 ) return child->getColumn();
+        }
+        return 0;
+    }
+
     std::string AST::toString() { return token != nullptr ? token->toString() : "nil"; }
 
     std::string AST::toStringTree() {
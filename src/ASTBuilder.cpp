@@ -81,6 +81,15 @@ namespace vcalc {
         return t;
     }
 
+    /* ^(MATRIX_INDEX_TOKEN expr expr expr) */
+    std::any ASTBuilder::visitMatrixIndex(VCalcParser::MatrixIndexContext *ctx) {
+        std::shared_ptr<AST> t = std::make_shared<AST>(VCalcParser::MATRIX_INDEX_TOKEN);
+        t->addChild(visit(ctx->expr(0)));
+        t->addChild(visit(ctx->expr(1)));
+        t->addChild(visit(ctx->expr(2)));
+        return t;
+    }
+
     std::any ASTBuilder::visitRange(VCalcParser::RangeContext *ctx) {
         std::shared_ptr<AST> t = std::make_shared<AST>(VCalcParser::RANGE);
         t->addChild(visit(ctx->expr(0)));
@@ -92,6 +101,8 @@ namespace vcalc {
         std::shared_ptr<AST> t = nullptr;
         if (ctx->op->getType() == VCalcParser::MUL) {
             t = std::make_shared<AST>(VCalcParser::MUL);
+        } else if (ctx->op->getType() == VCalcParser::MATMUL) {
+            t = std::make_shared<AST>(VCalcParser::MATMUL);
         } else {
             t = std::make_shared<AST>(VCalcParser::DIV);
         }
@@ -144,6 +155,17 @@ namespace vcalc {
         return t;
     }
 
+    /* ^(MATRIX_GENERATOR_TOKEN ID expression ID expression expression): rows, then columns, then the element */
+    std::any ASTBuilder::visitMatrixGenerator(VCalcParser::MatrixGeneratorContext *ctx) {
+        std::shared_ptr<AST> t = std::make_shared<AST>(VCalcParser::MATRIX_GENERATOR_TOKEN);
+        t->addChild(std::make_shared<AST>(ctx->ID(0)->getSymbol()));
+        t->addChild(visit(ctx->expression(0)));
+        t->addChild(std::make_shared<AST>(ctx->ID(1)->getSymbol()));
+        t->addChild(visit(ctx->expression(1)));
+        t->addChild(visit(ctx->expression(2)));
+        return t;
+    }
+
     std::any ASTBuilder::visitFilter(VCalcParser::FilterContext *ctx) {
         std::shared_ptr<AST> t = std::make_shared<AST>(VCalcParser::FILTER_TOKEN);
         t->addChild(std::make_shared<AST>(ctx->ID()->getSymbol()));
@@ -152,6 +174,13 @@ namespace vcalc {
         return t;
     }
 
+    /* ^(op expression) where op is one of sum, min, max, count, product */
+    std::any ASTBuilder::visitReduction(VCalcParser::ReductionContext *ctx) {
+        std::shared_ptr<AST> t = std::make_shared<AST>(ctx->op);
+        t->addChild(visit(ctx->expression()));
+        return t;
+    }
+
     /* ID */
     std::any ASTBuilder::visitIDAtom(VCalcParser::IDAtomContext *ctx) {
         return std::make_shared<AST>(ctx->ID()->getSymbol());
@@ -0,0 +1,252 @@
+#include "AffineRecognition.h"
+#include "VCalcParser.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace vcalc {
+    // Past 2^32 the only multiple in the i32 range is 0, so larger moduli all behave the same
+    static const int64_t MAX_MODULUS = int64_t(1) << 33;
+
+    AffineRecognition::AffineRecognition() { }
+
+    void AffineRecognition::visit(std::shared_ptr<AST> t) {
+        if ( t->isNil() ) {
+            visitChildren(t);
+        } else {
+            switch ( t->getNodeType() ) {
+                case VCalcParser::RANGE:
+                    visitRANGE(t);
+                    break;
+                case VCalcParser::GENERATOR_TOKEN:
+                    visitGENERATOR_TOKEN(t);
+                    break;
+                case VCalcParser::FILTER_TOKEN:
+                    visitFILTER_TOKEN(t);
+                    break;
+                default: // The other nodes we don't care about just have their children visited
+                    visitChildren(t);
+            }
+        }
+    }
+
+    void AffineRecognition::visitChildren(std::shared_ptr<AST> t) {
+        for ( auto child : t->children ) visit(child);
+    }
+
+    /* ^(RANGE expr expr) */
+    void AffineRecognition::visitRANGE(std::shared_ptr<AST> t) {
+        visitChildren(t);
+        int64_t lower, upper;
+        if (!isConstant(t->children[0], lower) || !isConstant(t->children[1], upper)) return;
+        int64_t count = std::max<int64_t>(0, upper - lower + 1);
+        if (count > INT32_MAX) return;
+        markProgression(t, lower, 1, count);
+    }
+
+    /* ^(GENERATOR_TOKEN ID expression expression) */
+    void AffineRecognition::visitGENERATOR_TOKEN(std::shared_ptr<AST> t) {
+        visitChildren(t);
+        std::shared_ptr<AST> domain = strip(t->children[1]);
+        uint32_t scale, offset;
+        if (!domain->isProgression || !matchAffine(t->children[2], t->children[0]->symbol, scale, offset)) return;
+
+        // scale * (start + k * step) + offset, wrapping like the body would
+        uint32_t start = scale * (uint32_t) domain->progressionStart + offset;
+        uint32_t step = scale * (uint32_t) domain->progressionStep;
+        markProgression(t, (int32_t) start, (int32_t) step, domain->progressionCount);
+    }
+
+    /* ^(FILTER_TOKEN ID expression expression) */
+    void AffineRecognition::visitFILTER_TOKEN(std::shared_ptr<AST> t) {
+        visitChildren(t);
+        std::shared_ptr<AST> domain = strip(t->children[1]);
+        if (!domain->isProgression) return;
+        if (domain->progressionCount > 1 && domain->progressionStep != 1) return;
+        int64_t domainLow = domain->progressionStart;
+        int64_t domainHigh = domainLow + domain->progressionCount - 1;
+        if (domainHigh > INT32_MAX) return;  // The domain wrapped around
+
+        Progression kept { 1, INT32_MIN, INT32_MAX };
+        if (!matchPredicate(t->children[2], t->children[0]->symbol, kept)) return;
+
+        // The first and last multiples of the modulus inside both the domain and the predicate's bounds
+        auto floorMultiple = [](int64_t value, int64_t modulus) {
+            int64_t quotient = value / modulus;
+            if (value % modulus != 0 && value < 0) quotient--;
+            return quotient * modulus;
+        };
+        int64_t low = std::max(domainLow, kept.low);
+        int64_t high = std::min(domainHigh, kept.high);
+        int64_t first = -floorMultiple(-low, kept.modulus);
+        int64_t last = floorMultiple(high, kept.modulus);
+        int64_t count = first <= last ? (last - first) / kept.modulus + 1 : 0;
+        markProgression(t, count > 0 ? first : 0, count > 1 ? kept.modulus : 1, count);
+    }
+
+    std::shared_ptr<AST> AffineRecognition::strip(std::shared_ptr<AST> t) {
+        while (t->getNodeType() == VCalcParser::EXPR_TOKEN || t->getNodeType() == VCalcParser::PARENTHESIS_TOKEN) t = t->children[0];
+        return t;
+    }
+
+    bool AffineRecognition::isDomainVariable(std::shared_ptr<AST> t, std::shared_ptr<Symbol> var) {
+        t = strip(t);
+        return t->getNodeType() == VCalcParser::ID && t->symbol && t->symbol == var;
+    }
+
+    bool AffineRecognition::isConstant(std::shared_ptr<AST> t, int64_t &value) {
+        // RangeAnalysis pinned it to one value, and leaving it unevaluated cannot hide an error
+        if (!t->evalType || t->evalType->getName() != "int" || !t->range.isExact() || !isPure(t)) return false;
+        value = t->range.low;
+        return true;
+    }
+
+    bool AffineRecognition::isPure(std::shared_ptr<AST> t) {
+        switch ( t->getNodeType() ) {
+            case VCalcParser::INTEGER:
+                return true;
+            case VCalcParser::ID:
+                return t->evalType->getName() == "int";
+            case VCalcParser::EXPR_TOKEN:
+            case VCalcParser::PARENTHESIS_TOKEN:
+                return isPure(t->children[0]);
+            case VCalcParser::ADD:
+            case VCalcParser::SUB:
+            case VCalcParser::MUL:
+            case VCalcParser::GREATERTHAN:
+            case VCalcParser::LESSTHAN:
+            case VCalcParser::ISEQUAL:
+            case VCalcParser::ISNOTEQUAL:
+                return t->evalType->getName() == "int" && isPure(t->children[0]) && isPure(t->children[1]);
+            case VCalcParser::DIV: {
+                // Neither a zero divisor nor INT_MIN / -1
+                if (t->evalType->getName() != "int") return false;
+                ValueRange divisor = t->children[1]->range;
+                if (divisor.contains(ValueRange::exactly(0))) return false;
+                if (divisor.contains(ValueRange::exactly(-1)) && t->children[0]->range.contains(ValueRange::exactly(INT32_MIN))) return false;
+                return isPure(t->children[0]) && isPure(t->children[1]);
+            }
+            default:
+                return false;
+        }
+    }
+
+    bool AffineRecognition::matchAffine(std::shared_ptr<AST> t, std::shared_ptr<Symbol> var, uint32_t &scale, uint32_t &offset) {
+        // Arithmetic is modulo 2^32, exactly as the i32 instructions the body would have run
+        int64_t value;
+        if (isConstant(t, value)) {
+            scale = 0;
+            offset = (uint32_t) value;
+            return true;
+        }
+        if (!t->evalType || t->evalType->getName() != "int") return false;
+        uint32_t lhsScale, lhsOffset, rhsScale, rhsOffset;
+        switch ( t->getNodeType() ) {
+            case VCalcParser::EXPR_TOKEN:
+            case VCalcParser::PARENTHESIS_TOKEN:
+                return matchAffine(t->children[0], var, scale, offset);
+            case VCalcParser::ID:
+                if (!isDomainVariable(t, var)) return false;
+                scale = 1;
+                offset = 0;
+                return true;
+            case VCalcParser::ADD:
+            case VCalcParser::SUB:
+            case VCalcParser::MUL:
+                if (!matchAffine(t->children[0], var, lhsScale, lhsOffset) || !matchAffine(t->children[1], var, rhsScale, rhsOffset)) return false;
+                break;
+            default:
+                return false;
+        }
+        if (t->getNodeType() == VCalcParser::ADD) {
+            scale = lhsScale + rhsScale;
+            offset = lhsOffset + rhsOffset;
+        } else if (t->getNodeType() == VCalcParser::SUB) {
+            scale = lhsScale - rhsScale;
+            offset = lhsOffset - rhsOffset;
+        } else if (lhsScale == 0) {
+            scale = lhsOffset * rhsScale;
+            offset = lhsOffset * rhsOffset;
+        } else if (rhsScale == 0) {
+            scale = lhsScale * rhsOffset;
+            offset = lhsOffset * rhsOffset;
+        } else {
+            return false;  // Quadratic in the domain variable
+        }
+        return true;
+    }
+
+    bool AffineRecognition::matchMultipleTest(std::shared_ptr<AST> t, std::shared_ptr<Symbol> var, int64_t &modulus) {
+        // i / m * m, which truncates i towards zero and so only gives i back when m divides it
+        t = strip(t);
+        if (t->getNodeType() != VCalcParser::MUL) return false;
+        for (size_t side = 0; side < 2; side++) {
+            std::shared_ptr<AST> quotient = strip(t->children[side]);
+            int64_t divisor, multiplier;
+            if (quotient->getNodeType() != VCalcParser::DIV || !isDomainVariable(quotient->children[0], var)) continue;
+            if (!isConstant(quotient->children[1], divisor) || !isConstant(t->children[1 - side], multiplier)) continue;
+            if (divisor != multiplier || divisor == 0 || divisor == -1) continue;
+            modulus = divisor < 0 ? -divisor : divisor;
+            return true;
+        }
+        return false;
+    }
+
+    bool AffineRecognition::matchPredicate(std::shared_ptr<AST> t, std::shared_ptr<Symbol> var, Progression &kept) {
+        // Narrows `kept` to the elements the predicate holds for
+        t = strip(t);
+        if (!t->evalType || t->evalType->getName() != "int") return false;
+        int64_t value;
+        switch ( t->getNodeType() ) {
+            case VCalcParser::MUL:
+                // Comparisons are 0 or 1, so their product holds when both do
+                return matchPredicate(t->children[0], var, kept) && matchPredicate(t->children[1], var, kept);
+            case VCalcParser::ISEQUAL:
+                for (size_t side = 0; side < 2; side++) {
+                    if (!isDomainVariable(t->children[side], var)) continue;
+                    std::shared_ptr<AST> other = t->children[1 - side];
+                    int64_t modulus;
+                    if (matchMultipleTest(other, var, modulus)) {
+                        int64_t reduced = kept.modulus / std::gcd(kept.modulus, modulus);
+                        kept.modulus = reduced > MAX_MODULUS / modulus ? MAX_MODULUS : reduced * modulus;
+                        return true;
+                    }
+                    if (isConstant(other, value)) {
+                        kept.low = std::max(kept.low, value);
+                        kept.high = std::min(kept.high, value);
+                        return true;
+                    }
+                }
+                return false;
+            case VCalcParser::GREATERTHAN:
+                if (isDomainVariable(t->children[0], var) && isConstant(t->children[1], value)) {
+                    kept.low = std::max(kept.low, value + 1);
+                    return true;
+                }
+                if (isConstant(t->children[0], value) && isDomainVariable(t->children[1], var)) {
+                    kept.high = std::min(kept.high, value - 1);
+                    return true;
+                }
+                return false;
+            case VCalcParser::LESSTHAN:
+                if (isDomainVariable(t->children[0], var) && isConstant(t->children[1], value)) {
+                    kept.high = std::min(kept.high, value - 1);
+                    return true;
+                }
+                if (isConstant(t->children[0], value) && isDomainVariable(t->children[1], var)) {
+                    kept.low = std::max(kept.low, value + 1);
+                    return true;
+                }
+                return false;
+            default:
+                return false;
+        }
+    }
+
+    void AffineRecognition::markProgression(std::shared_ptr<AST> t, int64_t start, int64_t step, int64_t count) {
+        t->isProgression = true;
+        t->progressionStart = (int32_t) start;
+        t->progressionStep = (int32_t) (uint32_t) step;
+        t->progressionCount = (int32_t) count;
+    }
+}
@@ -24,6 +24,15 @@ namespace vcalc {
                 case VCalcParser::ASSIGNMENT_TOKEN:
                     visitASSIGNMENT_TOKEN(t);
                     break;
+                case VCalcParser::GENERATOR_TOKEN:
+                    visitGENERATOR_TOKEN(t);
+                    break;
+                case VCalcParser::FILTER_TOKEN:
+                    visitFILTER_TOKEN(t);
+                    break;
+                case VCalcParser::MATRIX_GENERATOR_TOKEN:
+                    visitMATRIX_GENERATOR_TOKEN(t);
+                    break;
                 case VCalcParser::ID:
                     visitID(t);
                     break;
@@ -104,6 +113,26 @@ namespace vcalc {
         currentScope = currentScope->getEnclosingScope(); // pop scope
     }
 
+    /* ^(MATRIX_GENERATOR_TOKEN ID expression ID expression expression) */
+    void DefRef::visitMATRIX_GENERATOR_TOKEN(std::shared_ptr<AST> t) {
+        t->scope = currentScope;
+        // Both domains are evaluated before either domain variable exists
+        visit(t->children[1]);
+        visit(t->children[3]);
+        currentScope = std::make_shared<LocalScope>(currentScope); // push scope
+
+        std::shared_ptr<Type> intTypeSymbol = std::dynamic_pointer_cast<Type>(symtab->globals->resolve("int"));
+        for (size_t i : { 0, 2 }) {
+            std::shared_ptr<AST> domainVariableAST = t->children[i];
+            std::shared_ptr<VariableSymbol> vs = std::make_shared<VariableSymbol>(domainVariableAST->token->getText(), intTypeSymbol);
+            currentScope->define(vs);
+            domainVariableAST->scope = currentScope;
+            domainVariableAST->symbol = vs;
+        }
+        visit(t->children[4]);
+        currentScope = currentScope->getEnclosingScope(); // pop scope
+    }
+
     /* {$start.hasAncestor(EXPR)}? ID */
     void DefRef::visitID(std::shared_ptr<AST> t) {
         if ( numExprAncestors > 0 ) { // If an ID occurs within an expression, we have an ID reference
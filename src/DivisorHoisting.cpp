@@ -0,0 +1,70 @@
+#include "DivisorHoisting.h"
+#include "VCalcParser.h"
+
+namespace vcalc {
+    DivisorHoisting::DivisorHoisting() { }
+
+    void DivisorHoisting::visit(std::shared_ptr<AST> t) {
+        if ( t->isNil() ) {
+            visitChildren(t);
+        } else {
+            switch ( t->getNodeType() ) {
+                case VCalcParser::GENERATOR_TOKEN:
+                case VCalcParser::FILTER_TOKEN:
+                    visitGENERATOR_TOKEN(t);
+                    break;
+                case VCalcParser::MATRIX_GENERATOR_TOKEN:
+                    visitMATRIX_GENERATOR_TOKEN(t);
+                    break;
+                case VCalcParser::DIV:
+                    visitDIV(t);
+                    break;
+                default: // The other nodes we don't care about just have their children visited
+                    visitChildren(t);
+            }
+        }
+    }
+
+    void DivisorHoisting::visitChildren(std::shared_ptr<AST> t) {
+        for ( auto child : t->children ) visit(child);
+    }
+
+    /* ^(GENERATOR_TOKEN ID expression expression) or ^(FILTER_TOKEN ID expression expression) */
+    void DivisorHoisting::visitGENERATOR_TOKEN(std::shared_ptr<AST> t) {
+        visit(t->children[1]); // The domain is evaluated outside the generator
+        domainVariables.push_back(t->children[0]->symbol);
+        visit(t->children[2]);
+        domainVariables.pop_back();
+    }
+
+    /* ^(MATRIX_GENERATOR_TOKEN ID expression ID expression expression) */
+    void DivisorHoisting::visitMATRIX_GENERATOR_TOKEN(std::shared_ptr<AST> t) {
+        // Codegen emits the body once inside nested loops, so nothing in it is hoisted
+        visit(t->children[1]);
+        visit(t->children[3]);
+        std::vector<std::shared_ptr<Symbol>> enclosing;
+        enclosing.swap(domainVariables);
+        visit(t->children[4]);
+        domainVariables.swap(enclosing);
+    }
+
+    void DivisorHoisting::visitDIV(std::shared_ptr<AST> t) {
+        visitChildren(t);
+        if (domainVariables.empty() || t->evalType->getName() != "int") return;
+
+        // Literal divisors are already strength reduced by LLVM
+        std::shared_ptr<AST> divisor = t->children[1];
+        while (divisor->getNodeType() == VCalcParser::PARENTHESIS_TOKEN) divisor = divisor->children[0];
+        if (divisor->getNodeType() == VCalcParser::INTEGER) return;
+
+        t->hoistDivisor = !references(t->children[1], domainVariables.back());
+    }
+
+    bool DivisorHoisting::references(std::shared_ptr<AST> t, std::shared_ptr<Symbol> sym) {
+        if (t->getNodeType() == VCalcParser::ID && t->symbol == sym) return true;
+        for ( auto child : t->children ) {
+            if (references(child, sym)) return true;
+        }
+        return false;
+    }
+}
@@ -5,7 +5,9 @@
 #include <iostream>
 
 namespace vcalc {
-    ExpressionTypeComputation::ExpressionTypeComputation(std::shared_ptr<SymbolTable> symtab) : symtab(symtab), numExprAncestors(0) { }
+    ExpressionTypeComputation::ExpressionTypeComputation(std::shared_ptr<SymbolTable> symtab) : symtab(symtab), numExprAncestors(0), numErrors(0) { }
+
+    size_t ExpressionTypeComputation::getNumErrors() { return numErrors; }
 
     void ExpressionTypeComputation::visit(std::shared_ptr<AST> t) {
         if ( t->isNil() ) {
@@ -25,14 +27,28 @@ namespace vcalc {
                 case VCalcParser::LESSTHAN:
                 case VCalcParser::ISEQUAL:
                 case VCalcParser::ISNOTEQUAL:
+                case VCalcParser::MATMUL:
                     visitBinaryOperationToken(t);
                     break;
+                case VCalcParser::SUM:
+                case VCalcParser::MIN:
+                case VCalcParser::MAX:
+                case VCalcParser::COUNT:
+                case VCalcParser::PRODUCT:
+                    visitReductionToken(t);
+                    break;
                 case VCalcParser::RANGE:
                     visitRANGE(t);
                     break;
                 case VCalcParser::INDEX_TOKEN:
                     visitINDEX_TOKEN(t);
                     break;
+                case VCalcParser::MATRIX_INDEX_TOKEN:
+                    visitMATRIX_INDEX_TOKEN(t);
+                    break;
+                case VCalcParser::MATRIX_GENERATOR_TOKEN:
+                    visitMATRIX_GENERATOR_TOKEN(t);
+                    break;
                 case VCalcParser::PARENTHESIS_TOKEN:
                     visitPARENTHESIS_TOKEN(t);
                     break;
@@ -64,11 +80,25 @@ namespace vcalc {
     }
 
     void ExpressionTypeComputation::visitBinaryOperationToken(std::shared_ptr<AST> t) {
-        // This method run only when this AST node is: "+", "-", "*", "/", "<", ">", "==", "!="
+        // This method run only when this AST node is: "+", "-", "*", "/", "<", ">", "==", "!=", "**"
         visitChildren(t);  // Compute the type of subexpression
 
         // Type promotion
-        if (t->children[0]->evalType->getName() == "vector" && t->children[1]->evalType->getName() == "vector") {
+        std::string lhsType = t->children[0]->evalType->getName();
+        std::string rhsType = t->children[1]->evalType->getName();
+        if (lhsType == "matrix" || rhsType == "matrix" || t->getNodeType() == VCalcParser::MATMUL) {
+            // Element by element between matrices of one shape, or with an int applied to every
+            // element; ** multiplies two matrices. A vector has no shape to match a matrix with.
+            bool matmul = t->getNodeType() == VCalcParser::MATMUL;
+            if (lhsType == "vector" || rhsType == "vector" || (matmul && (lhsType != "matrix" || rhsType != "matrix"))) {
+                std::cout << "line " << t->getLine() << ": cannot apply " << (matmul ? "**" : "an operator") << " to " << lhsType << " and " << rhsType << "\n";
+                numErrors++;
+            }
+            t->evalType = std::dynamic_pointer_cast<Type>(symtab->globals->resolve("matrix"));
+            t->promoteToType = nullptr;
+            t->children[0]->promoteToType = lhsType == "int" ? t->evalType : nullptr;
+            t->children[1]->promoteToType = rhsType == "int" ? t->evalType : nullptr;
+        } else if (t->children[0]->evalType->getName() == "vector" && t->children[1]->evalType->getName() == "vector") {
             t->evalType = std::dynamic_pointer_cast<Type>(symtab->globals->resolve("vector"));
             t->promoteToType = nullptr;
             t->children[0]->promoteToType = nullptr;
@@ -90,6 +120,42 @@ namespace vcalc {
             t->children[0]->promoteToType = nullptr;
             t->children[1]->promoteToType = nullptr;
         }
+        if (t->evalType->getName() == "vector") {
+            // Element-wise operators read their operands one element at a time
+            markMask(t->children[0]);
+            markMask(t->children[1]);
+        }
+    }
+
+    void ExpressionTypeComputation::markMask(std::shared_ptr<AST> t) {
+        // Comparisons whose consumer reads single elements or counts them never need a 0/1 per element.
+        // Anything that keeps, prints or indexes the vector gets the usual representation.
+        while (t->getNodeType() == VCalcParser::PARENTHESIS_TOKEN) t = t->children[0];
+        switch ( t->getNodeType() ) {
+            case VCalcParser::GREATERTHAN:
+            case VCalcParser::LESSTHAN:
+            case VCalcParser::ISEQUAL:
+            case VCalcParser::ISNOTEQUAL:
+                t->isMask = t->evalType->getName() == "vector";
+                break;
+            default:
+                break;
+        }
+    }
+
+    void ExpressionTypeComputation::visitReductionToken(std::shared_ptr<AST> t) {
+        // This method run only when this AST node is: "sum", "min", "max", "count", "product"
+        visitChildren(t);  // Compute the type of subexpression
+
+        // An int operand is treated as a vector of one element
+        t->evalType = std::dynamic_pointer_cast<Type>(symtab->globals->resolve("int"));
+        t->promoteToType = nullptr;
+        if (t->children[0]->evalType->getName() == "int") {
+            t->children[0]->promoteToType = std::dynamic_pointer_cast<Type>(symtab->globals->resolve("vector"));
+        } else {
+            t->children[0]->promoteToType = nullptr;
+            markMask(t->children[0]->children[0]);  // ^(op ^(EXPR_TOKEN expr))
+        }
     }
 
     void ExpressionTypeComputation::visitPARENTHESIS_TOKEN(std::shared_ptr<AST> t) {
@@ -106,10 +172,40 @@ namespace vcalc {
 
     void ExpressionTypeComputation::visitINDEX_TOKEN(std::shared_ptr<AST> t) {
         visitChildren(t);
+        if (t->children[1]->evalType->getName() == "vector") {
+            // v[w] gathers one element of v per element of w; v[a..b] is a contiguous slice of v
+            t->evalType = std::dynamic_pointer_cast<Type>(symtab->globals->resolve("vector"));
+            std::shared_ptr<AST> index = t->children[1];
+            while (index->getNodeType() == VCalcParser::PARENTHESIS_TOKEN) index = index->children[0];
+            t->isSlice = index->getNodeType() == VCalcParser::RANGE;
+        } else {
+            t->evalType = std::dynamic_pointer_cast<Type>(symtab->globals->resolve("int"));
+        }
+        t->promoteToType = nullptr;
+    }
+
+    /* ^(MATRIX_INDEX_TOKEN expr expr expr) */
+    void ExpressionTypeComputation::visitMATRIX_INDEX_TOKEN(std::shared_ptr<AST> t) {
+        visitChildren(t);
+        // Only a matrix has the shape to index in two dimensions, and only with an int for each
+        std::string matrixType = t->children[0]->evalType->getName();
+        std::string rowType = t->children[1]->evalType->getName();
+        std::string columnType = t->children[2]->evalType->getName();
+        if (matrixType != "matrix" || rowType != "int" || columnType != "int") {
+            std::cout << "line " << t->getLine() << ": cannot apply [,] to " << matrixType << " with " << rowType << " and " << columnType << "\n";
+            numErrors++;
+        }
         t->evalType = std::dynamic_pointer_cast<Type>(symtab->globals->resolve("int"));
         t->promoteToType = nullptr;
     }
 
+    /* ^(MATRIX_GENERATOR_TOKEN ID expression ID expression expression) */
+    void ExpressionTypeComputation::visitMATRIX_GENERATOR_TOKEN(std::shared_ptr<AST> t) {
+        visitChildren(t);
+        t->evalType = std::dynamic_pointer_cast<Type>(symtab->globals->resolve("matrix"));
+        t->promoteToType = nullptr;
+    }
+
     void ExpressionTypeComputation::visitID(std::shared_ptr<AST> t) {
         if ( numExprAncestors > 0 ) { // If an ID occurs within an expression, we have an ID reference
             t->evalType = t->symbol->type;
@@ -0,0 +1,117 @@
+#include "IfConversion.h"
+#include "VCalcParser.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace vcalc {
+    // Both outcomes cost the whole block, so only blocks about as cheap as a mispredicted branch qualify
+    static const size_t MAX_PREDICATED_NODES = 32;
+
+    // A profiled branch is predictable when it went its rarer way at most once in this many runs
+    static const int64_t PREDICTABLE_RATIO = 32;
+
+    // Fewer profiled runs than this say too little about the branch
+    static const int64_t MIN_PROFILED_BRANCHES = 64;
+
+    IfConversion::IfConversion(const ProfileData *profile) : profile(profile) { }
+
+    void IfConversion::visit(std::shared_ptr<AST> t) {
+        if ( t->isNil() ) {
+            visitChildren(t);
+        } else {
+            switch ( t->getNodeType() ) {
+                case VCalcParser::CONDITIONAL_TOKEN:
+                    visitCONDITIONAL_TOKEN(t);
+                    break;
+                case VCalcParser::LOOP_TOKEN:
+                case VCalcParser::BLOCK_TOKEN:
+                    visitChildren(t);
+                    break;
+                default: // Conditionals are statements, so expressions need no visit
+                    break;
+            }
+        }
+    }
+
+    void IfConversion::visitChildren(std::shared_ptr<AST> t) {
+        for ( auto child : t->children ) visit(child);
+    }
+
+    /* ^(CONDITIONAL_TOKEN expression block) */
+    void IfConversion::visitCONDITIONAL_TOKEN(std::shared_ptr<AST> t) {
+        visit(t->children[1]);  // Inner conditionals are converted on their own when this one is not
+        if (t->children[0]->evalType->getName() != "int") return;
+        if (countNodes(t->children[1]) > MAX_PREDICATED_NODES) return;
+        for ( auto statement : t->children[1]->children ) {
+            if (!isSafeStatement(statement)) return;
+        }
+        if (isPredictable(t)) return;
+        t->isPredicable = true;
+    }
+
+    bool IfConversion::isPredictable(std::shared_ptr<AST> t) {
+        if (!profile) return false;
+        const ProfileData::Branch *branch = profile->branch(t->getLine());
+        if (!branch) return false;
+        int64_t total = branch->taken + branch->notTaken;
+        return total >= MIN_PROFILED_BRANCHES && std::min(branch->taken, branch->notTaken) * PREDICTABLE_RATIO < total;
+    }
+
+    bool IfConversion::isSafeStatement(std::shared_ptr<AST> t) {
+        // Only int variables: their stores can be made conditional with a select
+        switch ( t->getNodeType() ) {
+            case VCalcParser::VAR_DECLARATION_TOKEN:
+                return t->symbol && t->symbol->type->getName() == "int" && isSafeExpression(t->children[2]);
+            case VCalcParser::ASSIGNMENT_TOKEN:
+                return t->symbol && t->symbol->type->getName() == "int" && isSafeExpression(t->children[1]);
+            case VCalcParser::CONDITIONAL_TOKEN:
+                return t->isPredicable && isSafeExpression(t->children[0]);
+            default: // Printing and loops have effects a select cannot undo
+                return false;
+        }
+    }
+
+    bool IfConversion::isSafeExpression(std::shared_ptr<AST> t) {
+        // Running it when the condition is false must neither fail, allocate nor be undefined
+        switch ( t->getNodeType() ) {
+            case VCalcParser::INTEGER:
+                return true;
+            case VCalcParser::ID:
+                return t->evalType->getName() == "int";
+            case VCalcParser::EXPR_TOKEN:
+            case VCalcParser::PARENTHESIS_TOKEN:
+                return isSafeExpression(t->children[0]);
+            case VCalcParser::ADD:
+            case VCalcParser::SUB:
+            case VCalcParser::MUL:
+            case VCalcParser::GREATERTHAN:
+            case VCalcParser::LESSTHAN:
+            case VCalcParser::ISEQUAL:
+            case VCalcParser::ISNOTEQUAL:
+                return t->evalType->getName() == "int" && isSafeExpression(t->children[0]) && isSafeExpression(t->children[1]);
+            case VCalcParser::DIV: {
+                // Neither a zero divisor nor INT_MIN / -1, which traps in hardware
+                if (t->evalType->getName() != "int" || t->hoistDivisor) return false;
+                ValueRange divisor = t->children[1]->range;
+                if (divisor.contains(ValueRange::exactly(0))) return false;
+                if (divisor.contains(ValueRange::exactly(-1)) && t->children[0]->range.contains(ValueRange::exactly(INT32_MIN))) return false;
+                return isSafeExpression(t->children[0]) && isSafeExpression(t->children[1]);
+            }
+            case VCalcParser::INDEX_TOKEN: {
+                // A load RangeAnalysis proved in bounds, from a vector already in a variable
+                std::shared_ptr<AST> base = t->children[0];
+                return t->evalType->getName() == "int" && !t->isSlice && t->indexInBounds
+                    && base->getNodeType() == VCalcParser::ID && isSafeExpression(t->children[1]);
+            }
+            default:
+                return false;
+        }
+    }
+
+    size_t IfConversion::countNodes(std::shared_ptr<AST> t) {
+        size_t count = 1;
+        for ( auto child : t->children ) count += countNodes(child);
+        return count;
+    }
+}
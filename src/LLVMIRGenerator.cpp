@@ -1,27 +1,149 @@
 #include "LLVMIRGenerator.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/raw_ostream.h"
 #include "VCalcParser.h"
 #include "LocalScope.h"
 #include "Symbol.h"
 #include "VariableSymbol.h"
 
+#include <algorithm>
+#include <iostream>
+
 namespace vcalc {
-    LLVMIRGenerator::LLVMIRGenerator(std::string &outputFileName) : globalCtx(), ir(globalCtx), mod("vcalc", globalCtx), numBasicBlocks(0), numVariables(0), numExprAncestors(0), outputFileName(outputFileName) {
-        llvm::FunctionType *mainFunctionType = llvm::FunctionType::get(ir.getVoidTy(), false);
-        mainFunction = llvm::Function::Create(mainFunctionType, llvm::GlobalValue::ExternalLinkage, "main", mod);
-        llvm::BasicBlock *basicBlock = llvm::BasicBlock::Create(globalCtx, "BasicBlock" + std::to_string(++numBasicBlocks), mainFunction);
+    // Constant-length loops up to this many elements are unrolled; longer ones stay loops, so the
+    // generated code does not grow with the length of the vector
+    static const int MAX_UNROLLED_ELEMENTS = 16;
+
+    LLVMIRGenerator::LLVMIRGenerator(std::string &outputFileName, const CodegenOptions &options) : ownedCtx(std::make_unique<llvm::LLVMContext>()), ownedMod(std::make_unique<llvm::Module>("vcalc", *ownedCtx)), globalCtx(*ownedCtx), ir(globalCtx), mod(*ownedMod), numBasicBlocks(0), numVariables(0), numExprAncestors(0), options(options), debugScope(nullptr), outputFileName(outputFileName) {
+        // Value names cost a string per instruction and only help someone reading the IR
+        globalCtx.setDiscardValueNames(!options.debugInfo);
+        // A program's own main hands the OS an exit status; REPL statements and partitions return nothing
+        llvm::Type *returnTy = options.entryName == "main" ? ir.getInt32Ty() : ir.getVoidTy();
+        llvm::FunctionType *mainFunctionType = llvm::FunctionType::get(returnTy, false);
+        mainFunction = llvm::Function::Create(mainFunctionType, llvm::GlobalValue::ExternalLinkage, options.entryName, mod);
+        llvm::BasicBlock *basicBlock = llvm::BasicBlock::Create(globalCtx, nextBasicBlockName(), mainFunction);
         ir.SetInsertPoint(basicBlock);
+
+        if (options.debugInfo) {
+            // The whole program is main, so it is the only scope
+            debugBuilder = std::make_unique<llvm::DIBuilder>(mod);
+            llvm::DIFile *file = debugBuilder->createFile(options.sourceFileName, ".");
+            debugBuilder->createCompileUnit(llvm::dwarf::DW_LANG_C, file, "vcalc", false, "", 0);
+            llvm::DISubroutineType *mainType = debugBuilder->createSubroutineType(debugBuilder->getOrCreateTypeArray({}));
+            debugScope = debugBuilder->createFunction(file, options.entryName, "", file, 1, mainType, 1, llvm::DINode::FlagZero, llvm::DISubprogram::SPFlagDefinition);
+            mainFunction->setSubprogram(debugScope);
+            mod.addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+            mod.addModuleFlag(llvm::Module::Warning, "Dwarf Version", 4);
+            ir.SetCurrentDebugLocation(llvm::DILocation::get(globalCtx, 0, 0, debugScope));
+        }
+    }
+
+    void LLVMIRGenerator::finalize() {
+        createReturn();
+        if (debugBuilder) debugBuilder->finalize();
+    }
+
+    llvm::orc::ThreadSafeModule LLVMIRGenerator::takeModule() {
+        // The builder's debug location points into the context, so let go of it first
+        ir.SetCurrentDebugLocation(llvm::DebugLoc());
+        debugBuilder.reset();
+        return llvm::orc::ThreadSafeModule(std::move(ownedMod), std::move(ownedCtx));
+    }
+
+    void LLVMIRGenerator::importVariable(std::shared_ptr<Symbol> sym, const PersistentVariable &var) {
+        // Ints are read and written through their global like through an alloca. A vector's
+        // buffer is loaded once, and its length is usually known exactly since the statement
+        // that bound it has already run; a task may only find it in the length's global.
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        if (sym->type->getName() == "int") {
+            sym->llvmAllocaInst = mod.getOrInsertGlobal(var.globalName, intTy);
+            return;
+        }
+        llvm::Value *data = ir.CreateLoad(ir.getInt8PtrTy(), mod.getOrInsertGlobal(var.globalName, ir.getInt8PtrTy()));
+        llvm::Value *vector = ir.CreateBitCast(data, llvm::IntegerType::get(globalCtx, var.elementBits)->getPointerTo(), nextVariableName());
+        if (var.size < 0) {
+            llvm::Value *size = ir.CreateLoad(intTy, mod.getOrInsertGlobal(var.globalName + ".size", intTy));
+            vectorSizes[vector] = size;
+            if (sym->type->getName() == "matrix") {
+                llvm::Value *columns = ir.CreateLoad(intTy, mod.getOrInsertGlobal(var.globalName + ".columns", intTy));
+                llvm::Value *noColumns = ir.CreateICmpEQ(columns, llvm::ConstantInt::get(intTy, 0, true));
+                llvm::Value *rows = ir.CreateSDiv(size, ir.CreateSelect(noColumns, llvm::ConstantInt::get(intTy, 1, true), columns));
+                matrixShapes[vector] = MatrixShape { ir.CreateSelect(noColumns, llvm::ConstantInt::get(intTy, 0, true), rows), columns };
+            }
+        } else {
+            vectorSizes[vector] = llvm::ConstantInt::get(intTy, var.size, true);
+            if (sym->type->getName() == "matrix") {
+                int32_t rows = var.columns ? var.size / var.columns : 0;
+                matrixShapes[vector] = MatrixShape { llvm::ConstantInt::get(intTy, rows, true), llvm::ConstantInt::get(intTy, var.columns, true) };
+            }
+        }
+        sym->llvmAllocaInst = vector;
+    }
+
+    void LLVMIRGenerator::exportVariable(std::shared_ptr<Symbol> sym, PersistentVariable &var, bool define) {
+        // Called once the statement is done, to leave sym's value where the next statement's module looks for it
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        if (sym->type->getName() == "int") {
+            llvm::GlobalVariable *global = llvm::cast<llvm::GlobalVariable>(mod.getOrInsertGlobal(var.globalName, intTy));
+            if (define) global->setInitializer(llvm::ConstantInt::get(intTy, 0, true));
+            if (sym->llvmAllocaInst != global) ir.CreateStore(ir.CreateLoad(intTy, sym->llvmAllocaInst), global);
+            return;
+        }
+
+        llvm::Value *vector = sym->llvmAllocaInst;
+        llvm::Value *size = getVectorSize(vector);
+        if (sliceBases.count(vector)) {
+            // The base buffer is out of reach of later modules, so a slice is saved as a copy of its own
+            llvm::Type *elementTy = getVectorElementType(vector);
+            llvm::Value *copy = allocateVector(elementTy, size);
+            statementBuffers.pop_back();  // The variable owns it
+            llvm::Value *bytes = ir.CreateMul(ir.CreateZExt(size, ir.getInt64Ty()), ir.getInt64(elementTy->getIntegerBitWidth() / 8));
+            ir.CreateMemCpy(copy, llvm::MaybeAlign(), vector, llvm::MaybeAlign(), bytes);
+            releaseVector(vector);
+            vector = copy;
+        }
+
+        llvm::GlobalVariable *data = llvm::cast<llvm::GlobalVariable>(mod.getOrInsertGlobal(var.globalName, ir.getInt8PtrTy()));
+        llvm::GlobalVariable *length = llvm::cast<llvm::GlobalVariable>(mod.getOrInsertGlobal(var.globalName + ".size", intTy));
+        if (define) {
+            data->setInitializer(llvm::ConstantPointerNull::get(ir.getInt8PtrTy()));
+            length->setInitializer(llvm::ConstantInt::get(intTy, 0, true));
+        }
+        ir.CreateStore(ir.CreateBitCast(vector, ir.getInt8PtrTy()), data);
+        ir.CreateStore(size, length);
+        var.elementBits = getVectorElementType(vector)->getIntegerBitWidth();
+        if (sym->type->getName() == "matrix") {
+            llvm::GlobalVariable *columns = llvm::cast<llvm::GlobalVariable>(mod.getOrInsertGlobal(var.globalName + ".columns", intTy));
+            if (define) columns->setInitializer(llvm::ConstantInt::get(intTy, 0, true));
+            auto shape = matrixShapes.find(vector);
+            ir.CreateStore(shape != matrixShapes.end() ? shape->second.columns : llvm::ConstantInt::get(intTy, 0, true), columns);
+        }
     }
 
     void LLVMIRGenerator::visit(std::shared_ptr<AST> t) {
+        // Instructions emitted for this node carry its location; the enclosing node's comes back afterwards
+        llvm::DebugLoc enclosingLocation = ir.getCurrentDebugLocation();
+        setDebugLocation(t);
         if ( t->isNil() ) {
-            visitChildren(t);
+            // Top-level statements
+            llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+            for ( auto child : t->children ) {
+                profileEnter(child, PROFILE_STATEMENT);
+                visit(child);
+                profileExit(llvm::ConstantInt::get(intTy, 1, true), llvm::ConstantInt::get(intTy, 0, true));
+            }
+        } else if (hoistedValues.count(t)) {
+            reuseHoistedValue(t);
+        } else if (hasNumberedValue(t)) {
+            reuseNumberedValue(t);
         } else {
             switch ( t->getNodeType() ) {
                 case VCalcParser::BLOCK_TOKEN:
                     visitBLOCK_TOKEN(t);
                     break;
-                case VCalcParser::PRINT:
-                    visitPRINT(t);
+                case VCalcParser::PRINT_TOKEN:
+                    visitPRINT_TOKEN(t);
                     break;
                 case VCalcParser::VAR_DECLARATION_TOKEN:
                     visitVAR_DECLARATION_TOKEN(t);
@@ -49,8 +171,16 @@ namespace vcalc {
                 case VCalcParser::LESSTHAN:
                 case VCalcParser::ISEQUAL:
                 case VCalcParser::ISNOTEQUAL:
+                case VCalcParser::MATMUL:
                     visitBinaryOperationToken(t);
                     break;
+                case VCalcParser::SUM:
+                case VCalcParser::MIN:
+                case VCalcParser::MAX:
+                case VCalcParser::COUNT:
+                case VCalcParser::PRODUCT:
+                    visitReductionToken(t);
+                    break;
                 case VCalcParser::RANGE:
                     visitRANGE(t);
                     break;
@@ -72,57 +202,499 @@ namespace vcalc {
                 case VCalcParser::INDEX_TOKEN:
                     visitINDEX_TOKEN(t);
                     break;
+                case VCalcParser::MATRIX_INDEX_TOKEN:
+                    visitMATRIX_INDEX_TOKEN(t);
+                    break;
+                case VCalcParser::MATRIX_GENERATOR_TOKEN:
+                    visitMATRIX_GENERATOR_TOKEN(t);
+                    break;
                 default: // The other nodes we don't care about just have their children visited
                     visitChildren(t);
             }
+            if (t->keepValue && t->llvmValue) {
+                // Later identical vectors reuse this buffer, which keeps a reference until the last of them
+                retainVector(t->llvmValue);
+                numberedValues[t] = t->llvmValue;
+            }
+        }
+        ir.SetCurrentDebugLocation(enclosingLocation);
+    }
+
+    bool LLVMIRGenerator::hasNumberedValue(std::shared_ptr<AST> t) {
+        return t->valueNumberOf && numberedValues.count(t->valueNumberOf);
+    }
+
+    void LLVMIRGenerator::reuseNumberedValue(std::shared_ptr<AST> t) {
+        // ValueNumbering found the same vector earlier in the block. The statement takes a reference
+        // of its own, except that the last reuse takes over the one kept for it.
+        llvm::Value *vector = numberedValues[t->valueNumberOf];
+        if (t->isLastValueUse) {
+            numberedValues.erase(t->valueNumberOf);
+        } else {
+            retainVector(vector);
         }
+        statementBuffers.push_back(vector);
+        t->llvmValue = vector;
+    }
+
+    void LLVMIRGenerator::reuseHoistedValue(std::shared_ptr<AST> t) {
+        // Built before the enclosing loop, which holds it; the statement takes a reference of its own
+        llvm::Value *vector = hoistedValues[t];
+        retainVector(vector);
+        statementBuffers.push_back(vector);
+        t->llvmValue = vector;
     }
 
     void LLVMIRGenerator::visitChildren(std::shared_ptr<AST> t) {
         for ( auto child : t->children ) visit(child);
     }
 
-    void LLVMIRGenerator::visitPRINT(std::shared_ptr<AST> t) {
-        // TODO
+    /* ^(PRINT_TOKEN ^(EXPR_TOKEN expr)) */
+    void LLVMIRGenerator::visitPRINT_TOKEN(std::shared_ptr<AST> t) {
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        std::shared_ptr<AST> value = t->children[0]->children[0];
+        while (value->getNodeType() == VCalcParser::PARENTHESIS_TOKEN) value = value->children[0];
+        bool streamed = value->getNodeType() == VCalcParser::GENERATOR_TOKEN || value->getNodeType() == VCalcParser::FILTER_TOKEN || value->getNodeType() == VCalcParser::RANGE;
+        if (streamed && !hasNumberedValue(value) && !hoistedValues.count(value)) {
+            // Never build the vector: compute it a chunk at a time straight into the printer
+            numExprAncestors++;
+            createStreamingPrint(value);
+            numExprAncestors--;
+            releaseStatementBuffers();
+            return;
+        }
+
         visitChildren(t);
+        llvm::Value *printed = t->children[0]->llvmValue;
         if (t->children[0]->evalType->getName() == "int") {
-
+            llvm::FunctionCallee printInt = mod.getOrInsertFunction(
+                "vcalcPrintInt",
+                llvm::FunctionType::get(ir.getVoidTy(), { intTy }, false)
+            );
+            ir.CreateCall(printInt, { printed });
+        } else if (t->children[0]->evalType->getName() == "matrix") {
+            llvm::FunctionCallee printMatrix = mod.getOrInsertFunction(
+                "vcalcPrintMatrix",
+                llvm::FunctionType::get(ir.getVoidTy(), { llvm::Type::getInt32PtrTy(globalCtx), intTy, intTy }, false)
+            );
+            MatrixShape shape = matrixShapes[printed];
+            ir.CreateCall(printMatrix, { printed, shape.rows, shape.columns });
         } else {
+            llvm::FunctionCallee printVector = mod.getOrInsertFunction(
+                "vcalcPrintVector",
+                llvm::FunctionType::get(ir.getVoidTy(), { ir.getInt8PtrTy(), intTy, intTy }, false)
+            );
+            ir.CreateCall(printVector, {
+                ir.CreateBitCast(printed, ir.getInt8PtrTy()),
+                getVectorSize(printed),
+                llvm::ConstantInt::get(intTy, getVectorElementType(printed)->getIntegerBitWidth(), true)
+            });
+        }
+        releaseStatementBuffers();
+    }
 
+    void LLVMIRGenerator::createStreamingPrint(std::shared_ptr<AST> value) {
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        llvm::Value *chunkSize = llvm::ConstantInt::get(intTy, STREAM_CHUNK, true);
+        bool isRange = value->getNodeType() == VCalcParser::RANGE;
+        bool isFilter = value->getNodeType() == VCalcParser::FILTER_TOKEN;
+        bool isProgression = value->isProgression;  // Elements straight from AffineRecognition, nothing evaluated
+        std::shared_ptr<AST> domain = isRange ? value : value->children[1];
+        while (domain->getNodeType() == VCalcParser::PARENTHESIS_TOKEN) domain = domain->children[0];
+
+        // Element k of the domain. A range domain is never materialized either.
+        llvm::Value *total;
+        std::function<llvm::Value *(llvm::Value *)> domainElement;
+        if (isProgression) {
+            llvm::Value *start = llvm::ConstantInt::get(intTy, value->progressionStart, true);
+            llvm::Value *step = llvm::ConstantInt::get(intTy, value->progressionStep, true);
+            total = llvm::ConstantInt::get(intTy, value->progressionCount, true);
+            domainElement = [this, start, step](llvm::Value *k) { return ir.CreateAdd(start, ir.CreateMul(k, step)); };
+        } else if (domain->getNodeType() == VCalcParser::RANGE) {
+            visit(domain->children[0]);
+            visit(domain->children[1]);
+            llvm::Value *lower = domain->children[0]->llvmValue;
+            llvm::Value *upper = domain->children[1]->llvmValue;
+            total = ir.CreateSelect(ir.CreateICmpSGE(upper, lower), ir.CreateAdd(ir.CreateSub(upper, lower), llvm::ConstantInt::get(intTy, 1, true)), llvm::ConstantInt::get(intTy, 0, true));
+            domainElement = [this, lower](llvm::Value *k) { return ir.CreateAdd(lower, k); };
+        } else {
+            visit(domain);
+            llvm::Value *domainRef = domain->llvmValue;
+            total = getVectorSize(domainRef);
+            domainElement = [this, domainRef](llvm::Value *k) { return loadElement(domainRef, k); };
         }
+
+        llvm::FunctionType *voidTy = llvm::FunctionType::get(ir.getVoidTy(), false);
+        ir.CreateCall(mod.getOrInsertFunction("vcalcStreamBegin", voidTy));
+        llvm::FunctionCallee streamBuffer = mod.getOrInsertFunction("vcalcStreamBuffer", llvm::FunctionType::get(llvm::Type::getInt32PtrTy(globalCtx), false));
+        llvm::FunctionCallee streamSubmit = mod.getOrInsertFunction("vcalcStreamSubmit", llvm::FunctionType::get(ir.getVoidTy(), { intTy }, false));
+        llvm::Value *fillSlot = createEntryAlloca(intTy);  // Filters: elements kept in this chunk
+        auto enclosingDivisors = hoistedDivisors;
+        if (!isRange) profileEnter(value, isFilter ? PROFILE_FILTER : PROFILE_GENERATOR);
+
+        uint64_t expectedElements = isRange ? 0 : profiledTripCount(value, isFilter ? PROFILE_FILTER : PROFILE_GENERATOR);
+        if (!isRange && !isProgression) prepareHoistedDivisors(value->children[2], total);
+        llvm::Value *chunks = ir.CreateSDiv(ir.CreateAdd(total, llvm::ConstantInt::get(intTy, STREAM_CHUNK - 1, true)), chunkSize);
+        createElementLoop(chunks, [&](llvm::Value *chunk) {
+            llvm::Value *buffer = ir.CreateCall(streamBuffer);
+            llvm::Value *start = ir.CreateMul(chunk, chunkSize);
+            llvm::Value *remaining = ir.CreateSub(total, start);
+            llvm::Value *count = ir.CreateSelect(ir.CreateICmpSLT(remaining, chunkSize), remaining, chunkSize);
+            ir.CreateStore(llvm::ConstantInt::get(intTy, 0, true), fillSlot);
+
+            createElementLoop(count, [&](llvm::Value *j) {
+                size_t enclosingBuffers = statementBuffers.size();
+                llvm::Value *element = domainElement(ir.CreateAdd(start, j));
+                if (isRange || isProgression) {
+                    storeElement(buffer, j, element);
+                    return;
+                }
+                bindDomainVariable(value->children[0], element);
+                visit(value->children[2]);
+                if (isFilter) {
+                    // Always write, only advance when the predicate holds: no branch per element
+                    llvm::Value *fill = ir.CreateLoad(intTy, fillSlot);
+                    storeElement(buffer, fill, element);
+                    llvm::Value *keep = ir.CreateICmpNE(value->children[2]->llvmValue, llvm::ConstantInt::get(intTy, 0, true));
+                    ir.CreateStore(ir.CreateAdd(fill, ir.CreateZExt(keep, intTy)), fillSlot);
+                } else {
+                    storeElement(buffer, j, value->children[2]->llvmValue);
+                }
+                // Vectors the body built for this element die with it
+                for (size_t b = enclosingBuffers; b < statementBuffers.size(); b++) releaseVector(statementBuffers[b]);
+                statementBuffers.resize(enclosingBuffers);
+                hoistedDivisors = enclosingDivisors;
+            }, std::min<uint64_t>(expectedElements, STREAM_CHUNK));
+            ir.CreateCall(streamSubmit, { isFilter && !isProgression ? ir.CreateLoad(intTy, fillSlot) : count });
+        }, (expectedElements + STREAM_CHUNK - 1) / STREAM_CHUNK);
+
+        if (!isRange) profileExit(total, total);
+        ir.CreateCall(mod.getOrInsertFunction("vcalcStreamEnd", voidTy));
+    }
+
+    void LLVMIRGenerator::createPrecomputedOutput(const std::string &text) {
+        // PartialEvaluator ran the whole program, so all that is left is writing what it printed
+        if (text.empty()) return;
+        llvm::Constant *data = llvm::ConstantDataArray::getString(globalCtx, text, false);
+        llvm::GlobalVariable *global = new llvm::GlobalVariable(mod, data->getType(), true, llvm::GlobalValue::PrivateLinkage, data, "vcalc.output");
+        llvm::FunctionCallee printText = mod.getOrInsertFunction(
+            "vcalcPrintText",
+            llvm::FunctionType::get(ir.getVoidTy(), { ir.getInt8PtrTy(), ir.getInt64Ty() }, false)
+        );
+        ir.CreateCall(printText, { ir.CreateBitCast(global, ir.getInt8PtrTy()), ir.getInt64(text.size()) });
     }
 
     void LLVMIRGenerator::visitBLOCK_TOKEN(std::shared_ptr<AST> t) {
         auto *currentInsertBlock = ir.GetInsertBlock();
-        llvm::BasicBlock *basicBlock = llvm::BasicBlock::Create(globalCtx, "BasicBlock" + std::to_string(++numBasicBlocks), mainFunction);
+        llvm::BasicBlock *basicBlock = llvm::BasicBlock::Create(globalCtx, nextBasicBlockName(), mainFunction);
         ir.SetInsertPoint(basicBlock);
         visitChildren(t);
-        ir.CreateRetVoid();
+        createReturn();
         ir.SetInsertPoint(currentInsertBlock);
     }
 
     void LLVMIRGenerator::visitVAR_DECLARATION_TOKEN(std::shared_ptr<AST> t) {
         visitChildren(t);
         if (t->children[0]->token->getText() == "int") {
-            t->symbol->llvmAllocaInst = ir.CreateAlloca(llvm::Type::getInt32Ty(globalCtx), nullptr, "Variable" + std::to_string(++numVariables));
+            t->symbol->llvmAllocaInst = createEntryAlloca(llvm::Type::getInt32Ty(globalCtx));
             ir.CreateStore(t->children[2]->llvmValue, t->symbol->llvmAllocaInst);
         } else {
-            t->symbol->llvmAllocaInst = llvm::dyn_cast<llvm::AllocaInst>(t->children[2]->llvmValue);
+            // Share the value's buffer; whichever name writes to it first gets its own copy
+            retainVector(t->children[2]->llvmValue);
+            t->symbol->llvmAllocaInst = t->children[2]->llvmValue;
         }
+        releaseStatementBuffers();
     }
     void LLVMIRGenerator::visitASSIGNMENT_TOKEN(std::shared_ptr<AST> t) {
         visitChildren(t);
-        ir.CreateStore(t->children[1]->llvmValue, t->symbol->llvmAllocaInst);
+        if (t->symbol->type->getName() == "int") {
+            llvm::Value *value = t->children[1]->llvmValue;
+            if (predicate) {
+                // If-converted: when the condition is false the variable keeps what it held
+                llvm::Value *old = ir.CreateLoad(llvm::Type::getInt32Ty(globalCtx), t->symbol->llvmAllocaInst);
+                value = ir.CreateSelect(predicate, value, old);
+            }
+            ir.CreateStore(value, t->symbol->llvmAllocaInst);
+        } else {
+            // Vectors rebind to the result buffer, which is the old buffer when it was updated in place.
+            // Retain before releasing so that case never frees it.
+            retainVector(t->children[1]->llvmValue);
+            releaseVector(t->symbol->llvmAllocaInst);
+            t->symbol->llvmAllocaInst = t->children[1]->llvmValue;
+        }
+        releaseStatementBuffers();
+    }
+
+    llvm::Value *LLVMIRGenerator::allocateVector(llvm::Type *elementTy, llvm::Value *size) {
+        // The new buffer belongs to the statement until a declaration or assignment retains it
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        llvm::FunctionCallee bufferNew = mod.getOrInsertFunction(
+            "vcalcBufferNew",
+            llvm::FunctionType::get(ir.getInt8PtrTy(), { intTy, intTy }, false)
+        );
+        llvm::Value *data = ir.CreateCall(bufferNew, { size, llvm::ConstantInt::get(intTy, elementTy->getIntegerBitWidth(), true) });
+        llvm::Value *vector = ir.CreateBitCast(data, elementTy->getPointerTo(), nextVariableName());
+        vectorSizes[vector] = size;
+        statementBuffers.push_back(vector);
+        return vector;
     }
 
+    llvm::Value *LLVMIRGenerator::allocateResultBuffer(std::shared_ptr<AST> t, llvm::Value *size) {
+        // Write into an operand the Liveness pass proved dead instead of allocating
+        llvm::Type *elementTy = getElementType(t);
+        if (t->reuseOperand) {
+            // Only reuse it if its elements are wide enough for every result value
+            llvm::Value *operandArray = t->reuseOperand->llvmValue;
+            if (!sliceBases.count(operandArray) && !masks.count(operandArray) && getVectorElementType(operandArray)->getIntegerBitWidth() >= elementTy->getIntegerBitWidth()) {
+                if (t->reuseOperand->getNodeType() != VCalcParser::ID) {
+                    return operandArray;  // A temporary of this statement, nobody else can hold it
+                }
+                // A named vector may share its buffer through an earlier `vector b = a;`. Every
+                // element is about to be overwritten, so a private buffer needs no copy.
+                llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+                llvm::FunctionCallee makeUnique = mod.getOrInsertFunction(
+                    "vcalcBufferMakeUnique",
+                    llvm::FunctionType::get(ir.getInt8PtrTy(), { ir.getInt8PtrTy(), intTy }, false)
+                );
+                llvm::Value *data = ir.CreateCall(makeUnique, { ir.CreateBitCast(operandArray, ir.getInt8PtrTy()), llvm::ConstantInt::get(intTy, 0, true) });
+                llvm::Value *unique = ir.CreateBitCast(data, operandArray->getType(), nextVariableName());
+                vectorSizes[unique] = vectorSizes[operandArray];
+                // The name's reference moved to the private buffer
+                t->reuseOperand->symbol->llvmAllocaInst = unique;
+                return unique;
+            }
+        }
+        return allocateVector(elementTy, size);
+    }
+
+    llvm::Value *LLVMIRGenerator::getBuffer(llvm::Value *vector) {
+        // Slices share the reference count of the buffer they point into
+        auto find_s = sliceBases.find(vector);
+        if ( find_s != sliceBases.end() ) return find_s->second;
+        return vector;
+    }
+
+    void LLVMIRGenerator::retainVector(llvm::Value *vector) {
+        llvm::FunctionCallee retain = mod.getOrInsertFunction(
+            "vcalcBufferRetain",
+            llvm::FunctionType::get(ir.getVoidTy(), { ir.getInt8PtrTy() }, false)
+        );
+        ir.CreateCall(retain, { ir.CreateBitCast(getBuffer(vector), ir.getInt8PtrTy()) });
+    }
+
+    void LLVMIRGenerator::releaseVector(llvm::Value *vector) {
+        llvm::FunctionCallee release = mod.getOrInsertFunction(
+            "vcalcBufferRelease",
+            llvm::FunctionType::get(ir.getVoidTy(), { ir.getInt8PtrTy() }, false)
+        );
+        ir.CreateCall(release, { ir.CreateBitCast(getBuffer(vector), ir.getInt8PtrTy()) });
+    }
+
+    void LLVMIRGenerator::releaseStatementBuffers() {
+        // Temporaries die with their statement, and anything bound to a name was retained by now
+        for (llvm::Value *vector : statementBuffers) releaseVector(vector);
+        statementBuffers.clear();
+    }
+
+    /* ^(LOOP_TOKEN expression block) */
     void LLVMIRGenerator::visitLOOP_TOKEN(std::shared_ptr<AST> t) {
-        // TODO
-        visitChildren(t);
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        std::shared_ptr<AST> block = t->children[1];
+
+        // Vectors LoopInvariantHoisting found the loop never changes are built once and held until it ends
+        std::vector<std::shared_ptr<AST>> hoisted;
+        numExprAncestors++;
+        for (auto invariant : t->loopInvariants) {
+            visit(invariant);
+            retainVector(invariant->llvmValue);
+            hoistedValues[invariant] = invariant->llvmValue;
+            hoisted.push_back(invariant);
+        }
+        numExprAncestors--;
+        releaseStatementBuffers();
+
+        // Vectors the body rebinds meet their value from the last iteration in a phi. Every iteration
+        // must bring the same element width and a buffer of its own, so they are kept as 32-bit
+        // buffers for the whole loop, copying a narrower one or a slice.
+        std::set<std::shared_ptr<Symbol>> rebound, declared;
+        collectRebound(block, rebound, declared);
+        auto carry = [&]() {
+            for (auto sym : rebound) {
+                llvm::Value *vector = sym->llvmAllocaInst;
+                if (getVectorElementType(vector) != intTy || sliceBases.count(vector)) sym->llvmAllocaInst = widenVector(vector, intTy);
+            }
+        };
+        carry();
+
+        llvm::BasicBlock *preheader = ir.GetInsertBlock();
+        llvm::BasicBlock *header = llvm::BasicBlock::Create(globalCtx, nextBasicBlockName(), mainFunction);
+        llvm::BasicBlock *bodyBlock = llvm::BasicBlock::Create(globalCtx, nextBasicBlockName(), mainFunction);
+        llvm::BasicBlock *exitBlock = llvm::BasicBlock::Create(globalCtx, nextBasicBlockName(), mainFunction);
+        ir.CreateBr(header);
+
+        ir.SetInsertPoint(header);
+        std::map<std::shared_ptr<Symbol>, std::vector<llvm::PHINode *>> phis;  // Data and length, then rows and columns
+        for (auto sym : rebound) {
+            llvm::Value *before = sym->llvmAllocaInst;
+            std::vector<llvm::Value *> incoming = { before, getVectorSize(before) };
+            auto shape = matrixShapes.find(before);
+            if (shape != matrixShapes.end()) {
+                incoming.push_back(shape->second.rows);
+                incoming.push_back(shape->second.columns);
+            }
+            for (llvm::Value *value : incoming) {
+                llvm::PHINode *phi = ir.CreatePHI(value->getType(), 2, nextVariableName());
+                phi->addIncoming(value, preheader);
+                phis[sym].push_back(phi);
+            }
+            std::vector<llvm::PHINode *> &merged = phis[sym];
+            vectorSizes[merged[0]] = merged[1];
+            if (merged.size() > 2) matrixShapes[merged[0]] = MatrixShape { merged[2], merged[3] };
+            sym->llvmAllocaInst = merged[0];
+        }
+        visit(t->children[0]);
+        llvm::Value *condition = ir.CreateICmpNE(t->children[0]->llvmValue, llvm::ConstantInt::get(intTy, 0, true));
+        releaseStatementBuffers();  // The condition's temporaries
+        profileBranch(t, condition);
+        ir.CreateCondBr(condition, bodyBlock, exitBlock, profiledBranchWeights(t));
+
+        ir.SetInsertPoint(bodyBlock);
+        profileEnter(t, PROFILE_LOOP_BODY);
+        for ( auto statement : block->children ) visit(statement);
+        // The body's own vectors die at the end of each iteration
+        for ( auto statement : block->children ) {
+            if (statement->getNodeType() == VCalcParser::VAR_DECLARATION_TOKEN && statement->symbol->type->getName() != "int") {
+                releaseVector(statement->symbol->llvmAllocaInst);
+            }
+        }
+        profileExit(llvm::ConstantInt::get(intTy, 1, true), llvm::ConstantInt::get(intTy, 0, true));
+        carry();
+        llvm::BasicBlock *latch = ir.GetInsertBlock();
+        for (auto sym : rebound) {
+            llvm::Value *after = sym->llvmAllocaInst;
+            std::vector<llvm::Value *> incoming = { after, getVectorSize(after) };
+            if (phis[sym].size() > 2) {
+                incoming.push_back(matrixShapes[after].rows);
+                incoming.push_back(matrixShapes[after].columns);
+            }
+            for (size_t i = 0; i < phis[sym].size(); i++) phis[sym][i]->addIncoming(incoming[i], latch);
+            sym->llvmAllocaInst = phis[sym][0];
+        }
+        ir.CreateBr(header);
+
+        ir.SetInsertPoint(exitBlock);
+        for (auto invariant : hoisted) {
+            releaseVector(hoistedValues[invariant]);
+            hoistedValues.erase(invariant);
+        }
     }
 
+    /* ^(CONDITIONAL_TOKEN expression block) */
     void LLVMIRGenerator::visitCONDITIONAL_TOKEN(std::shared_ptr<AST> t) {
-        // TODO
-        visitChildren(t);
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        visit(t->children[0]);
+        llvm::Value *condition = ir.CreateICmpNE(t->children[0]->llvmValue, llvm::ConstantInt::get(intTy, 0, true));
+        releaseStatementBuffers();  // The condition's temporaries
+        profileBranch(t, condition);
+        std::shared_ptr<AST> block = t->children[1];
+
+        if (t->isPredicable) {
+            // IfConversion proved the block safe to run either way, and its assignments select the old value back
+            llvm::Value *enclosingPredicate = predicate;
+            predicate = enclosingPredicate ? ir.CreateAnd(enclosingPredicate, condition) : condition;
+            for ( auto statement : block->children ) visit(statement);
+            predicate = enclosingPredicate;
+            return;
+        }
+
+        // Vectors are SSA values rather than memory, so each one the block rebinds meets its old value in a phi
+        std::set<std::shared_ptr<Symbol>> rebound, declared;
+        collectRebound(block, rebound, declared);
+        std::map<std::shared_ptr<Symbol>, llvm::Value *> before;
+        for (auto sym : rebound) before[sym] = sym->llvmAllocaInst;
+
+        llvm::BasicBlock *thenBlock = llvm::BasicBlock::Create(globalCtx, nextBasicBlockName(), mainFunction);
+        llvm::BasicBlock *elseBlock = llvm::BasicBlock::Create(globalCtx, nextBasicBlockName(), mainFunction);
+        llvm::BasicBlock *mergeBlock = llvm::BasicBlock::Create(globalCtx, nextBasicBlockName(), mainFunction);
+        ir.CreateCondBr(condition, thenBlock, elseBlock, profiledBranchWeights(t));
+        ir.SetInsertPoint(thenBlock);
+        for ( auto statement : block->children ) visit(statement);
+        // The block's own vectors die with it
+        for ( auto statement : block->children ) {
+            if (statement->getNodeType() == VCalcParser::VAR_DECLARATION_TOKEN && statement->symbol->type->getName() != "int") {
+                releaseVector(statement->symbol->llvmAllocaInst);
+            }
+        }
+
+        // Both paths must hand the phi the same element width, so the narrower buffer is widened on its own path
+        std::map<std::shared_ptr<Symbol>, llvm::Type *> mergedTypes;
+        for (auto sym : rebound) {
+            llvm::Value *after = sym->llvmAllocaInst;
+            if (after == before[sym]) continue;
+            llvm::Type *beforeTy = getVectorElementType(before[sym]);
+            llvm::Type *afterTy = getVectorElementType(after);
+            mergedTypes[sym] = beforeTy->getIntegerBitWidth() > afterTy->getIntegerBitWidth() ? beforeTy : afterTy;
+            if (afterTy != mergedTypes[sym]) sym->llvmAllocaInst = widenVector(after, mergedTypes[sym]);
+        }
+        llvm::BasicBlock *thenEnd = ir.GetInsertBlock();
+        ir.CreateBr(mergeBlock);
+
+        ir.SetInsertPoint(elseBlock);
+        std::map<std::shared_ptr<Symbol>, llvm::Value *> skipped = before;
+        for (auto &merged : mergedTypes) {
+            if (getVectorElementType(before[merged.first]) != merged.second) skipped[merged.first] = widenVector(before[merged.first], merged.second);
+        }
+        llvm::BasicBlock *elseEnd = ir.GetInsertBlock();
+        ir.CreateBr(mergeBlock);
+
+        ir.SetInsertPoint(mergeBlock);
+        for (auto &merged : mergedTypes) {
+            merged.first->llvmAllocaInst = mergeVector(merged.first->llvmAllocaInst, thenEnd, skipped[merged.first], elseEnd);
+        }
+    }
+
+    void LLVMIRGenerator::collectRebound(std::shared_ptr<AST> t, std::set<std::shared_ptr<Symbol>> &rebound, std::set<std::shared_ptr<Symbol>> &declared) {
+        // Vector and matrix variables from outside the block that it assigns; its own declarations die with it
+        if (t->getNodeType() == VCalcParser::VAR_DECLARATION_TOKEN && t->symbol) declared.insert(t->symbol);
+        if (t->getNodeType() == VCalcParser::ASSIGNMENT_TOKEN && t->symbol && t->symbol->type->getName() != "int" && !declared.count(t->symbol)) {
+            rebound.insert(t->symbol);
+        }
+        for ( auto child : t->children ) collectRebound(child, rebound, declared);
+    }
+
+    llvm::Value *LLVMIRGenerator::widenVector(llvm::Value *vector, llvm::Type *elementTy) {
+        // A copy with wider elements that takes over the variable's reference from `vector`
+        llvm::Value *size = getVectorSize(vector);
+        llvm::Value *wide = allocateVector(elementTy, size);
+        statementBuffers.pop_back();  // The variable owns it
+        createElementLoop(size, [&](llvm::Value *index) {
+            storeElement(wide, index, loadElement(vector, index));
+        });
+        auto shape = matrixShapes.find(vector);
+        if (shape != matrixShapes.end()) matrixShapes[wide] = shape->second;
+        releaseVector(vector);
+        return wide;
+    }
+
+    llvm::Value *LLVMIRGenerator::mergeVector(llvm::Value *first, llvm::BasicBlock *firstBlock, llvm::Value *second, llvm::BasicBlock *secondBlock) {
+        // The length, buffer and shape the vector carries on each path merge along with it
+        auto merge = [&](llvm::Value *a, llvm::Value *b) -> llvm::Value * {
+            if (a == b) return a;
+            llvm::PHINode *phi = ir.CreatePHI(a->getType(), 2, nextVariableName());
+            phi->addIncoming(a, firstBlock);
+            phi->addIncoming(b, secondBlock);
+            return phi;
+        };
+        llvm::Value *merged = merge(first, second);
+        vectorSizes[merged] = merge(getVectorSize(first), getVectorSize(second));
+        if (sliceBases.count(first) || sliceBases.count(second)) sliceBases[merged] = merge(getBuffer(first), getBuffer(second));
+        if (matrixShapes.count(first) && matrixShapes.count(second)) {
+            matrixShapes[merged] = MatrixShape {
+                merge(matrixShapes[first].rows, matrixShapes[second].rows),
+                merge(matrixShapes[first].columns, matrixShapes[second].columns)
+            };
+        }
+        return merged;
     }
 
 
@@ -131,236 +703,348 @@ namespace vcalc {
         t->llvmValue = t->children[0]->llvmValue;
     }
 
+    llvm::Value *LLVMIRGenerator::createBinaryOperation(size_t op, llvm::Value *lhs, llvm::Value *rhs) {
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        switch (op) {
+            case VCalcParser::ADD:
+                return ir.CreateAdd(lhs, rhs);
+            case VCalcParser::SUB:
+                return ir.CreateSub(lhs, rhs);
+            case VCalcParser::MUL:
+                return ir.CreateMul(lhs, rhs);
+            case VCalcParser::DIV:
+                return ir.CreateSDiv(lhs, rhs);
+            // Casting to the operands' type keeps whole-vector compares whole-vector
+            case VCalcParser::GREATERTHAN:
+                return ir.CreateIntCast(ir.CreateICmpSGT(lhs, rhs), lhs->getType(), false);
+            case VCalcParser::LESSTHAN:
+                return ir.CreateIntCast(ir.CreateICmpSLT(lhs, rhs), lhs->getType(), false);
+            case VCalcParser::ISEQUAL:
+                return ir.CreateIntCast(ir.CreateICmpEQ(lhs, rhs), lhs->getType(), false);
+            case VCalcParser::ISNOTEQUAL:
+                return ir.CreateIntCast(ir.CreateICmpNE(lhs, rhs), lhs->getType(), false);
+        }
+        return llvm::ConstantInt::get(intTy, 0, true);  // Dummy Value
+    }
+
     void LLVMIRGenerator::visitBinaryOperationToken(std::shared_ptr<AST> t) {
+        if (t->hoistDivisor) {
+            // The divisor is the same for every element of the enclosing generator
+            visit(t->children[0]);
+            auto found = hoistedDivisors.find(t);
+            if (found == hoistedDivisors.end()) {
+                visit(t->children[1]);
+                found = hoistedDivisors.emplace(t, prepareDivisor(t, t->children[1]->llvmValue)).first;
+            }
+            t->llvmValue = createMagicDivision(t->children[0]->llvmValue, found->second);
+            return;
+        }
+
         visitChildren(t);
         llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
-        if (t->evalType->getName() == "int") {
-            if (t->getNodeType() == VCalcParser::ADD) {
-                t->llvmValue = ir.CreateAdd(t->children[0]->llvmValue, t->children[1]->llvmValue);
-            } else if (t->getNodeType() == VCalcParser::SUB) {
-                t->llvmValue = ir.CreateSub(t->children[0]->llvmValue, t->children[1]->llvmValue);
-            } else if (t->getNodeType() == VCalcParser::MUL) {
-                t->llvmValue = ir.CreateMul(t->children[0]->llvmValue, t->children[1]->llvmValue);
-            } else if (t->getNodeType() == VCalcParser::DIV) {
-                t->llvmValue = ir.CreateSDiv(t->children[0]->llvmValue, t->children[1]->llvmValue);
-            } else if (t->getNodeType() == VCalcParser::GREATERTHAN) {
-                t->llvmValue = ir.CreateIntCast(ir.CreateICmpSGT(t->children[0]->llvmValue, t->children[1]->llvmValue), llvm::Type::getInt32Ty(globalCtx), true);
-            } else if (t->getNodeType() == VCalcParser::LESSTHAN) {
-                t->llvmValue = ir.CreateIntCast(ir.CreateICmpSLT(t->children[0]->llvmValue, t->children[1]->llvmValue), llvm::Type::getInt32Ty(globalCtx), true);
-            } else if (t->getNodeType() == VCalcParser::ISEQUAL) {
-                t->llvmValue = ir.CreateIntCast(ir.CreateICmpEQ(t->children[0]->llvmValue, t->children[1]->llvmValue), llvm::Type::getInt32Ty(globalCtx), true);
-            } else if (t->getNodeType() == VCalcParser::ISNOTEQUAL) {
-                t->llvmValue = ir.CreateIntCast(ir.CreateICmpNE(t->children[0]->llvmValue, t->children[1]->llvmValue), llvm::Type::getInt32Ty(globalCtx), true);
-            }
+        if (t->evalType->getName() == "matrix") {
+            createMatrixOperation(t);
+        } else if (t->evalType->getName() == "int") {
+            if (t->getNodeType() == VCalcParser::DIV) createDivisionCheck(t, t->children[1]->llvmValue);
+            t->llvmValue = createBinaryOperation(t->getNodeType(), t->children[0]->llvmValue, t->children[1]->llvmValue);
+        } else if (t->isMask) {
+            t->llvmValue = createMask(t);
         } else {
-            // Handle the case where the operations are with Arrays
-            if (t->children[0]->evalType->getName() == "vector" && t->children[1]->evalType->getName() == "vector") {
-                llvm::AllocaInst *op1Array = llvm::dyn_cast<llvm::AllocaInst>(t->children[1]->llvmValue);
-                llvm::AllocaInst *op2Array = llvm::dyn_cast<llvm::AllocaInst>(t->children[1]->llvmValue);
-                llvm::Value *op1ArraySize = op1Array->getArraySize();
-
-                // Cast from *Value to integer
-                int array1Size;
-                if (llvm::ConstantInt* CI = llvm::dyn_cast<llvm::ConstantInt>(op1ArraySize)) {
-                    if (CI->getBitWidth() <= 32) {
-                        array1Size = CI->getSExtValue();
-                    }
-                }
-                // Store the allocaInst of this FILTER AST node
-                t->symbol->llvmAllocaInst = ir.CreateAlloca(
-                    llvm::Type::getInt32Ty(globalCtx), 
-                    op1ArraySize, 
-                    "Variable" + std::to_string(++numVariables)
-                );
+            // Handle the case where the operations are with Arrays. The int operand,
+            // if any, is promoted by reusing it for every element.
+            bool op1IsVector = t->children[0]->evalType->getName() == "vector";
+            bool op2IsVector = t->children[1]->evalType->getName() == "vector";
+            llvm::Value *op1Array = op1IsVector ? t->children[0]->llvmValue : nullptr;
+            llvm::Value *op2Array = op2IsVector ? t->children[1]->llvmValue : nullptr;
 
-                for (int i = 0; i < array1Size; i++) {
-                    llvm::Value *array1ElementRef = ir.CreateGEP(
-                        intTy, 
-                        op1Array, 
-                        llvm::ArrayRef<llvm::Value *> { 
-                            llvm::ConstantInt::get(intTy, 0, true), 
-                            llvm::ConstantInt::get(intTy, i, true) 
-                        }
-                    );
-                    auto *array1Element = ir.CreateLoad(intTy, array1ElementRef);
-
-                    llvm::Value *array2ElementRef = ir.CreateGEP(
-                        intTy, 
-                        op2Array, 
-                        llvm::ArrayRef<llvm::Value *> { 
-                            llvm::ConstantInt::get(intTy, 0, true), 
-                            llvm::ConstantInt::get(intTy, i, true) 
-                        }
-                    );
-                    auto *array2Element = ir.CreateLoad(intTy, array2ElementRef);
-
-                    llvm::Value *result = llvm::ConstantInt::get(intTy, 0, true);  // Dummy Value
-                    if (t->getNodeType() == VCalcParser::ADD) {
-                        result = ir.CreateAdd(array1Element, array2Element);
-                    } else if (t->getNodeType() == VCalcParser::SUB) {
-                        result = ir.CreateSub(array1Element, array2Element);
-                    } else if (t->getNodeType() == VCalcParser::MUL) {
-                        result = ir.CreateMul(array1Element, array2Element);
-                    } else if (t->getNodeType() == VCalcParser::DIV) {
-                        result = ir.CreateSDiv(array1Element, array2Element);
-                    } else if (t->getNodeType() == VCalcParser::GREATERTHAN) {
-                        result = ir.CreateIntCast(ir.CreateICmpSGT(array1Element, array2Element), llvm::Type::getInt32Ty(globalCtx), true);
-                    } else if (t->getNodeType() == VCalcParser::LESSTHAN) {
-                        result = ir.CreateIntCast(ir.CreateICmpSLT(array1Element, array2Element), llvm::Type::getInt32Ty(globalCtx), true);
-                    } else if (t->getNodeType() == VCalcParser::ISEQUAL) {
-                        result = ir.CreateIntCast(ir.CreateICmpEQ(array1Element, array2Element), llvm::Type::getInt32Ty(globalCtx), true);
-                    } else if (t->getNodeType() == VCalcParser::ISNOTEQUAL) {
-                        result = ir.CreateIntCast(ir.CreateICmpNE(array1Element, array2Element), llvm::Type::getInt32Ty(globalCtx), true);
-                    }
-
-                    llvm::Value *resultElementRef = ir.CreateGEP(
-                        intTy, 
-                        t->symbol->llvmAllocaInst, 
-                        llvm::ArrayRef<llvm::Value *> { 
-                            llvm::ConstantInt::get(intTy, 0, true), 
-                            llvm::ConstantInt::get(intTy, i, true) 
-                        }
-                    );
-                    ir.CreateStore(result, resultElementRef);
-                }
-            } else if (t->children[0]->evalType->getName() == "vector" && t->children[1]->evalType->getName() == "int") {
-                llvm::AllocaInst *op1Array = llvm::dyn_cast<llvm::AllocaInst>(t->children[1]->llvmValue);
-                llvm::Value *op1ArraySize = op1Array->getArraySize();
-
-                // Cast from *Value to integer
-                int array1Size;
-                if (llvm::ConstantInt* CI = llvm::dyn_cast<llvm::ConstantInt>(op1ArraySize)) {
-                    if (CI->getBitWidth() <= 32) {
-                        array1Size = CI->getSExtValue();
-                    }
-                }
-                // Store the allocaInst of this FILTER AST node
-                t->symbol->llvmAllocaInst = ir.CreateAlloca(
-                    llvm::Type::getInt32Ty(globalCtx), 
-                    op1ArraySize, 
-                    "Variable" + std::to_string(++numVariables)
-                );
+            // The result takes the length of its first vector operand
+            llvm::Value *lengthArray = op1IsVector ? op1Array : op2Array;
+            llvm::Value *arraySizeValue = getVectorSize(lengthArray);
+            int arraySize = getArraySizeInteger(lengthArray);
+            bool knownSize = llvm::isa<llvm::ConstantInt>(arraySizeValue);
+            llvm::Value *resultArray = allocateResultBuffer(t, arraySizeValue);
 
-                for (int i = 0; i < array1Size; i++) {
-                    llvm::Value *array1ElementRef = ir.CreateGEP(
-                        intTy, 
-                        op1Array, 
-                        llvm::ArrayRef<llvm::Value *> { 
-                            llvm::ConstantInt::get(intTy, 0, true), 
-                            llvm::ConstantInt::get(intTy, i, true) 
-                        }
-                    );
-                    auto *array1Element = ir.CreateLoad(intTy, array1ElementRef);
-
-                    llvm::Value *result = llvm::ConstantInt::get(intTy, 0, true);  // Dummy Value
-                    if (t->getNodeType() == VCalcParser::ADD) {
-                        result = ir.CreateAdd(array1Element, t->children[1]->llvmValue);
-                    } else if (t->getNodeType() == VCalcParser::SUB) {
-                        result = ir.CreateSub(array1Element, t->children[1]->llvmValue);
-                    } else if (t->getNodeType() == VCalcParser::MUL) {
-                        result = ir.CreateMul(array1Element, t->children[1]->llvmValue);
-                    } else if (t->getNodeType() == VCalcParser::DIV) {
-                        result = ir.CreateSDiv(array1Element, t->children[1]->llvmValue);
-                    } else if (t->getNodeType() == VCalcParser::GREATERTHAN) {
-                        result = ir.CreateIntCast(ir.CreateICmpSGT(array1Element, t->children[1]->llvmValue), llvm::Type::getInt32Ty(globalCtx), true);
-                    } else if (t->getNodeType() == VCalcParser::LESSTHAN) {
-                        result = ir.CreateIntCast(ir.CreateICmpSLT(array1Element, t->children[1]->llvmValue), llvm::Type::getInt32Ty(globalCtx), true);
-                    } else if (t->getNodeType() == VCalcParser::ISEQUAL) {
-                        result = ir.CreateIntCast(ir.CreateICmpEQ(array1Element, t->children[1]->llvmValue), llvm::Type::getInt32Ty(globalCtx), true);
-                    } else if (t->getNodeType() == VCalcParser::ISNOTEQUAL) {
-                        result = ir.CreateIntCast(ir.CreateICmpNE(array1Element, t->children[1]->llvmValue), llvm::Type::getInt32Ty(globalCtx), true);
-                    }
-
-                    llvm::Value *resultElementRef = ir.CreateGEP(
-                        intTy, 
-                        t->symbol->llvmAllocaInst, 
-                        llvm::ArrayRef<llvm::Value *> { 
-                            llvm::ConstantInt::get(intTy, 0, true), 
-                            llvm::ConstantInt::get(intTy, i, true) 
-                        }
-                    );
-                    ir.CreateStore(result, resultElementRef);
-                }
-            } else if (t->children[0]->evalType->getName() == "int" && t->children[1]->evalType->getName() == "vector") {
-                llvm::AllocaInst *op2Array = llvm::dyn_cast<llvm::AllocaInst>(t->children[1]->llvmValue);
-                llvm::Value *op2ArraySize = op2Array->getArraySize();
-
-                // Cast from *Value to integer
-                int array2Size;
-                if (llvm::ConstantInt* CI = llvm::dyn_cast<llvm::ConstantInt>(op2ArraySize)) {
-                    if (CI->getBitWidth() <= 32) {
-                        array2Size = CI->getSExtValue();
-                    }
+            // A scalar divisor is loop invariant: compute its reciprocal once, checking it only if an element uses it
+            bool magicDivision = t->getNodeType() == VCalcParser::DIV && !op2IsVector && (!knownSize || arraySize > 0);
+            DivisorMagic magic = {};
+            if (magicDivision) {
+                llvm::Value *evaluated = knownSize ? nullptr : ir.CreateICmpSGT(arraySizeValue, llvm::ConstantInt::get(intTy, 0, true));
+                magic = prepareDivisor(t, t->children[1]->llvmValue, evaluated);
+            }
+            auto combine = [&](llvm::Value *op1, llvm::Value *op2) {
+                if (magicDivision) return createMagicDivision(op1, magic);
+                if (t->getNodeType() == VCalcParser::DIV) createDivisionCheck(t, op2);
+                return createBinaryOperation(t->getNodeType(), op1, op2);
+            };
+
+            // Mask operands are read a bit at a time, which the loop vectorizer handles better than unrolled chunks
+            if (!knownSize || masks.count(op1Array) || masks.count(op2Array)) {
+                createElementLoop(arraySizeValue, [&](llvm::Value *index) {
+                    llvm::Value *op1 = op1IsVector ? loadElement(op1Array, index) : t->children[0]->llvmValue;
+                    llvm::Value *op2 = op2IsVector ? loadElement(op2Array, index) : t->children[1]->llvmValue;
+                    storeElement(resultArray, index, combine(op1, op2));
+                });
+                t->llvmValue = resultArray;
+                return;
+            }
+
+            // The length is a constant: emit register-wide vector instructions, then scalars for the tail.
+            // A few chunks are unrolled; more are a loop over whole chunks, so the code stays the same size.
+            unsigned lanes = options.vectorBits / 32;
+            int i = 0;
+            if (lanes > 1 && arraySize >= (int) lanes) {
+                llvm::Value *splat1 = op1IsVector ? nullptr : ir.CreateVectorSplat(lanes, t->children[0]->llvmValue);
+                llvm::Value *splat2 = op2IsVector ? nullptr : ir.CreateVectorSplat(lanes, t->children[1]->llvmValue);
+                auto combineChunk = [&](llvm::Value *index) {
+                    llvm::Value *op1 = op1IsVector ? loadChunk(op1Array, index, lanes) : splat1;
+                    llvm::Value *op2 = op2IsVector ? loadChunk(op2Array, index, lanes) : splat2;
+                    storeChunk(resultArray, index, combine(op1, op2));
+                };
+                int chunks = arraySize / lanes;
+                if (chunks * (int) lanes > MAX_UNROLLED_ELEMENTS) {
+                    createElementLoop(llvm::ConstantInt::get(intTy, chunks, true), [&](llvm::Value *chunk) {
+                        combineChunk(ir.CreateMul(chunk, llvm::ConstantInt::get(intTy, lanes, true)));
+                    });
+                    i = chunks * lanes;
                 }
-                // Store the allocaInst of this FILTER AST node
-                t->symbol->llvmAllocaInst = ir.CreateAlloca(
-                    llvm::Type::getInt32Ty(globalCtx), 
-                    op2ArraySize, 
-                    "Variable" + std::to_string(++numVariables)
-                );
+                for (; i + (int) lanes <= arraySize; i += lanes) combineChunk(llvm::ConstantInt::get(intTy, i, true));
+            }
+            // Fewer than `lanes` elements are left
+            for (; i < arraySize; i++) {
+                llvm::Value *index = llvm::ConstantInt::get(intTy, i, true);
+                llvm::Value *op1 = op1IsVector ? loadElement(op1Array, index) : t->children[0]->llvmValue;
+                llvm::Value *op2 = op2IsVector ? loadElement(op2Array, index) : t->children[1]->llvmValue;
+                storeElement(resultArray, index, combine(op1, op2));
+            }
+            t->llvmValue = resultArray;
+        }
+    }
 
-                for (int i = 0; i < array2Size; i++) {
-                    llvm::Value *array2ElementRef = ir.CreateGEP(
-                        intTy, 
-                        op2Array, 
-                        llvm::ArrayRef<llvm::Value *> { 
-                            llvm::ConstantInt::get(intTy, 0, true), 
-                            llvm::ConstantInt::get(intTy, i, true) 
-                        }
-                    );
-                    auto *array2Element = ir.CreateLoad(intTy, array2ElementRef);
-
-                    llvm::Value *result = llvm::ConstantInt::get(intTy, 0, true);  // Dummy Value
-                    if (t->getNodeType() == VCalcParser::ADD) {
-                        result = ir.CreateAdd(t->children[0]->llvmValue, array2Element);
-                    } else if (t->getNodeType() == VCalcParser::SUB) {
-                        result = ir.CreateSub(t->children[0]->llvmValue, array2Element);
-                    } else if (t->getNodeType() == VCalcParser::MUL) {
-                        result = ir.CreateMul(t->children[0]->llvmValue, array2Element);
-                    } else if (t->getNodeType() == VCalcParser::DIV) {
-                        result = ir.CreateSDiv(t->children[0]->llvmValue, array2Element);
-                    } else if (t->getNodeType() == VCalcParser::GREATERTHAN) {
-                        result = ir.CreateIntCast(ir.CreateICmpSGT(t->children[0]->llvmValue, array2Element), llvm::Type::getInt32Ty(globalCtx), true);
-                    } else if (t->getNodeType() == VCalcParser::LESSTHAN) {
-                        result = ir.CreateIntCast(ir.CreateICmpSLT(t->children[0]->llvmValue, array2Element), llvm::Type::getInt32Ty(globalCtx), true);
-                    } else if (t->getNodeType() == VCalcParser::ISEQUAL) {
-                        result = ir.CreateIntCast(ir.CreateICmpEQ(t->children[0]->llvmValue, array2Element), llvm::Type::getInt32Ty(globalCtx), true);
-                    } else if (t->getNodeType() == VCalcParser::ISNOTEQUAL) {
-                        result = ir.CreateIntCast(ir.CreateICmpNE(t->children[0]->llvmValue, array2Element), llvm::Type::getInt32Ty(globalCtx), true);
-                    }
-
-                    llvm::Value *resultElementRef = ir.CreateGEP(
-                        intTy, 
-                        t->symbol->llvmAllocaInst, 
-                        llvm::ArrayRef<llvm::Value *> { 
-                            llvm::ConstantInt::get(intTy, 0, true), 
-                            llvm::ConstantInt::get(intTy, i, true) 
-                        }
+    void LLVMIRGenerator::visitReductionToken(std::shared_ptr<AST> t) {
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        std::shared_ptr<AST> operand = t->children[0]->children[0];  // ^(op ^(EXPR_TOKEN expr))
+        while (operand->getNodeType() == VCalcParser::PARENTHESIS_TOKEN) operand = operand->children[0];
+
+        bool precomputed = hasNumberedValue(operand) || hoistedValues.count(operand);
+        if (operand->isProgression && !precomputed) {
+            if (llvm::Value *closedForm = createProgressionReduction(t, operand)) {
+                t->llvmValue = closedForm;
+                return;
+            }
+        }
+        if ((operand->getNodeType() == VCalcParser::GENERATOR_TOKEN || operand->getNodeType() == VCalcParser::FILTER_TOKEN) && !precomputed) {
+            // Fuse with the producer: accumulate each element as it is computed instead of building the vector
+            t->llvmValue = createFusedReduction(t, operand);
+            return;
+        }
+
+        visitChildren(t);
+        llvm::Value *value = t->children[0]->llvmValue;
+        if (t->children[0]->evalType->getName() == "int") {
+            // An int is a vector of one element
+            t->llvmValue = t->getNodeType() == VCalcParser::COUNT ? llvm::ConstantInt::get(intTy, 1, true) : value;
+            return;
+        }
+
+        llvm::Value *arraySize = getVectorSize(value);
+        if (t->getNodeType() == VCalcParser::COUNT) {
+            t->llvmValue = arraySize;
+            return;
+        }
+        if (masks.count(value)) {
+            t->llvmValue = createMaskReduction(t, value);
+            return;
+        }
+
+        llvm::Value *data = ir.CreateBitCast(value, ir.getInt8PtrTy());
+        llvm::Value *elementBits = llvm::ConstantInt::get(intTy, getVectorElementType(value)->getIntegerBitWidth(), true);
+        llvm::Value *line = llvm::ConstantInt::get(intTy, t->getLine(), true);
+        llvm::FunctionType *reduceTy = llvm::FunctionType::get(intTy, { ir.getInt8PtrTy(), intTy, intTy }, false);
+        llvm::FunctionType *reduceNonEmptyTy = llvm::FunctionType::get(intTy, { intTy, ir.getInt8PtrTy(), intTy, intTy }, false);
+        if (t->getNodeType() == VCalcParser::SUM) {
+            t->llvmValue = ir.CreateCall(mod.getOrInsertFunction("vcalcSum", reduceTy), { data, arraySize, elementBits });
+        } else if (t->getNodeType() == VCalcParser::PRODUCT) {
+            t->llvmValue = ir.CreateCall(mod.getOrInsertFunction("vcalcProduct", reduceTy), { data, arraySize, elementBits });
+        } else if (t->getNodeType() == VCalcParser::MIN) {
+            t->llvmValue = ir.CreateCall(mod.getOrInsertFunction("vcalcMin", reduceNonEmptyTy), { line, data, arraySize, elementBits });
+        } else {
+            t->llvmValue = ir.CreateCall(mod.getOrInsertFunction("vcalcMax", reduceNonEmptyTy), { line, data, arraySize, elementBits });
+        }
+    }
+
+    llvm::Value *LLVMIRGenerator::createFusedReduction(std::shared_ptr<AST> t, std::shared_ptr<AST> producer) {
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        size_t op = t->getNodeType();
+        bool isFilter = producer->getNodeType() == VCalcParser::FILTER_TOKEN;
+
+        visit(producer->children[1]);  // Visit the Domain
+        llvm::Value *domainRef = producer->children[1]->llvmValue;
+        llvm::Value *domainSize = getVectorSize(domainRef);
+        auto enclosingDivisors = hoistedDivisors;
+
+        llvm::Value *accumulator;
+        if (op == VCalcParser::PRODUCT) {
+            accumulator = llvm::ConstantInt::get(intTy, 1, true);
+        } else if (op == VCalcParser::MIN) {
+            accumulator = llvm::ConstantInt::get(intTy, INT32_MAX, true);
+        } else if (op == VCalcParser::MAX) {
+            accumulator = llvm::ConstantInt::get(intTy, INT32_MIN, true);
+        } else {
+            accumulator = llvm::ConstantInt::get(intTy, 0, true);
+        }
+        llvm::Value *nonEmpty = isFilter ? ir.getFalse() : ir.CreateICmpSGT(domainSize, llvm::ConstantInt::get(intTy, 0, true));
+
+        // Folds the element of the domain at `index` into the accumulator
+        auto accumulate = [&](llvm::Value *index) {
+            bindDomainVariable(producer->children[0], loadElement(domainRef, index));
+            visit(producer->children[2]);  // Computation based on the value from an element of domain
+
+            // A generator contributes its body, a filter contributes the domain element when the predicate holds
+            llvm::Value *element = isFilter ? producer->children[0]->llvmValue : producer->children[2]->llvmValue;
+            llvm::Value *combined;
+            if (op == VCalcParser::SUM) {
+                combined = ir.CreateAdd(accumulator, element);
+            } else if (op == VCalcParser::PRODUCT) {
+                combined = ir.CreateMul(accumulator, element);
+            } else if (op == VCalcParser::MIN) {
+                combined = ir.CreateSelect(ir.CreateICmpSLT(element, accumulator), element, accumulator);
+            } else if (op == VCalcParser::MAX) {
+                combined = ir.CreateSelect(ir.CreateICmpSGT(element, accumulator), element, accumulator);
+            } else {
+                combined = ir.CreateAdd(accumulator, llvm::ConstantInt::get(intTy, 1, true));
+            }
+
+            if (isFilter) {
+                llvm::Value *predicate = ir.CreateICmpNE(producer->children[2]->llvmValue, llvm::ConstantInt::get(intTy, 0, true));
+                accumulator = ir.CreateSelect(predicate, combined, accumulator);
+                nonEmpty = ir.CreateOr(nonEmpty, predicate);
+            } else {
+                accumulator = combined;
+            }
+        };
+
+        if (!llvm::isa<llvm::ConstantInt>(domainSize) || getArraySizeInteger(domainRef) > MAX_UNROLLED_ELEMENTS) {
+            // Unknown or long length: emit the body once inside a loop, carrying the accumulator through slots
+            llvm::Value *accumulatorSlot = createEntryAlloca(intTy);
+            llvm::Value *nonEmptySlot = createEntryAlloca(ir.getInt1Ty());
+            ir.CreateStore(accumulator, accumulatorSlot);
+            ir.CreateStore(nonEmpty, nonEmptySlot);
+            prepareHoistedDivisors(producer->children[2], domainSize);
+            createElementLoop(domainSize, [&](llvm::Value *index) {
+                // Temporaries of the body die with the element, not with the statement
+                size_t enclosingBuffers = statementBuffers.size();
+                accumulator = ir.CreateLoad(intTy, accumulatorSlot);
+                nonEmpty = ir.CreateLoad(ir.getInt1Ty(), nonEmptySlot);
+                accumulate(index);
+                ir.CreateStore(accumulator, accumulatorSlot);
+                ir.CreateStore(nonEmpty, nonEmptySlot);
+                for (size_t i = enclosingBuffers; i < statementBuffers.size(); i++) releaseVector(statementBuffers[i]);
+                statementBuffers.resize(enclosingBuffers);
+            }, profiledTripCount(producer, isFilter ? PROFILE_FILTER : PROFILE_GENERATOR));
+            accumulator = ir.CreateLoad(intTy, accumulatorSlot);
+            nonEmpty = ir.CreateLoad(ir.getInt1Ty(), nonEmptySlot);
+        } else {
+            // A few elements: unrolled, with the accumulator in registers
+            int domainSizeInteger = getArraySizeInteger(domainRef);
+            for (int i = 0; i < domainSizeInteger; i++) accumulate(llvm::ConstantInt::get(intTy, i, true));
+        }
+        hoistedDivisors = enclosingDivisors;
+
+        if (op == VCalcParser::MIN || op == VCalcParser::MAX) {
+            llvm::FunctionCallee emptyReduction = mod.getOrInsertFunction(
+                "vcalcEmptyReduction",
+                llvm::FunctionType::get(ir.getVoidTy(), { intTy }, false)
+            );
+            createRuntimeCheck(ir.CreateNot(nonEmpty), emptyReduction, { llvm::ConstantInt::get(intTy, t->getLine(), true) });
+        }
+        return accumulator;
+    }
+
+    llvm::Value *LLVMIRGenerator::createProgressionReduction(std::shared_ptr<AST> t, std::shared_ptr<AST> producer) {
+        // Reductions AffineRecognition's progressions have a closed form for. Null for the others.
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        int64_t start = producer->progressionStart;
+        int64_t step = producer->progressionStep;
+        uint64_t count = producer->progressionCount;
+        switch ( t->getNodeType() ) {
+            case VCalcParser::COUNT:
+                return llvm::ConstantInt::get(intTy, count, true);
+            case VCalcParser::SUM: {
+                // count * start + step * count * (count - 1) / 2, wrapping like the additions it replaces
+                uint64_t pairs = count % 2 == 0 ? (count / 2) * (count - 1) : count * ((count - 1) / 2);
+                uint32_t sum = (uint32_t) count * (uint32_t) start + (uint32_t) step * (uint32_t) pairs;
+                return llvm::ConstantInt::get(intTy, sum);
+            }
+            case VCalcParser::MIN:
+            case VCalcParser::MAX: {
+                if (count == 0) {
+                    llvm::FunctionCallee emptyReduction = mod.getOrInsertFunction(
+                        "vcalcEmptyReduction",
+                        llvm::FunctionType::get(ir.getVoidTy(), { intTy }, false)
                     );
-                    ir.CreateStore(result, resultElementRef);
+                    createRuntimeCheck(ir.getTrue(), emptyReduction, { llvm::ConstantInt::get(intTy, t->getLine(), true) });
+                    return llvm::ConstantInt::get(intTy, 0, true);
                 }
+                // Monotonic unless it wrapped around, and then the ends are not the extremes
+                int64_t last = start + step * (int64_t) (count - 1);
+                if (last < INT32_MIN || last > INT32_MAX) return nullptr;
+                bool isMin = t->getNodeType() == VCalcParser::MIN;
+                return llvm::ConstantInt::get(intTy, isMin ? std::min(start, last) : std::max(start, last), true);
             }
+            default:
+                return nullptr;
         }
     }
 
     void LLVMIRGenerator::visitRANGE(std::shared_ptr<AST> t) {
-        visitChildren(t);
-        int lower_bound = std::stoi(t->children[0]->token->getText());
-        int upper_bound = std::stoi(t->children[1]->token->getText());
-        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
-        llvm::AllocaInst *allocaInst = ir.CreateAlloca(intTy, llvm::ConstantInt::get(intTy, upper_bound - lower_bound + 1, true), "Variable" + std::to_string(++numVariables));
-        for (int i = lower_bound; i <= upper_bound; i++) {
-            llvm::Value *pointerToElement = ir.CreateGEP(
-                intTy, 
-                allocaInst, 
-                llvm::ArrayRef<llvm::Value *> { 
-                        llvm::ConstantInt::get(intTy, 0, true), 
-                        llvm::ConstantInt::get(intTy, lower_bound - i, true) 
-                }
-            );
-            ir.CreateStore(llvm::ConstantInt::get(intTy, i, true), pointerToElement);
+        if (t->isProgression) {
+            t->llvmValue = createProgression(t);
+            return;
         }
-        t->llvmValue = allocaInst;
+        // AffineRecognition took every range with constant bounds, so these are only known at runtime
+        visitChildren(t);
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        llvm::Type *elementTy = getElementType(t);
+        llvm::Value *lower = t->children[0]->llvmValue;
+        llvm::Value *upper = t->children[1]->llvmValue;
+        llvm::Value *count = ir.CreateSelect(
+            ir.CreateICmpSGE(upper, lower),
+            ir.CreateAdd(ir.CreateSub(upper, lower), llvm::ConstantInt::get(intTy, 1, true)),
+            llvm::ConstantInt::get(intTy, 0, true)
+        );
+        llvm::Value *resultArray = allocateVector(elementTy, count);
+        llvm::FunctionCallee iota = mod.getOrInsertFunction(
+            "vcalcIota",
+            llvm::FunctionType::get(ir.getVoidTy(), { ir.getInt8PtrTy(), intTy, intTy, intTy, intTy }, false)
+        );
+        ir.CreateCall(iota, {
+            ir.CreateBitCast(resultArray, ir.getInt8PtrTy()),
+            llvm::ConstantInt::get(intTy, elementTy->getIntegerBitWidth(), true),
+            lower,
+            llvm::ConstantInt::get(intTy, 1, true),
+            count
+        });
+        t->llvmValue = resultArray;
+    }
+
+    llvm::Value *LLVMIRGenerator::createProgression(std::shared_ptr<AST> t) {
+        // AffineRecognition worked out every element, so nothing of the node is evaluated: one strided fill
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        llvm::Type *elementTy = getElementType(t);
+        llvm::Value *count = llvm::ConstantInt::get(intTy, t->progressionCount, true);
+        llvm::Value *resultArray = allocateVector(elementTy, count);
+        llvm::FunctionCallee iota = mod.getOrInsertFunction(
+            "vcalcIota",
+            llvm::FunctionType::get(ir.getVoidTy(), { ir.getInt8PtrTy(), intTy, intTy, intTy, intTy }, false)
+        );
+        ir.CreateCall(iota, {
+            ir.CreateBitCast(resultArray, ir.getInt8PtrTy()),
+            llvm::ConstantInt::get(intTy, elementTy->getIntegerBitWidth(), true),
+            llvm::ConstantInt::get(intTy, t->progressionStart, true),
+            llvm::ConstantInt::get(intTy, t->progressionStep, true),
+            count
+        });
+        return resultArray;
     }
 
     void LLVMIRGenerator::visitID(std::shared_ptr<AST> t) {
@@ -383,126 +1067,756 @@ namespace vcalc {
     }
 
     void LLVMIRGenerator::visitGENERATOR_TOKEN(std::shared_ptr<AST> t) {
-        visit(t->children[1]);  // Visit the Domain
         llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
-        llvm::AllocaInst *domainRef = llvm::dyn_cast<llvm::AllocaInst>(t->children[1]->llvmValue);
-        llvm::Value *domainSize = domainRef->getArraySize();
-
-        // Store the allocaInst of this FILTER AST node
-        t->symbol->llvmAllocaInst = ir.CreateAlloca(llvm::Type::getInt32Ty(globalCtx), domainSize, "Variable" + std::to_string(++numVariables));
-        
-        // Cast from *Value to integer
-        int domainSizeInteger;
-        if (llvm::ConstantInt* CI = llvm::dyn_cast<llvm::ConstantInt>(domainSize)) {
-            if (CI->getBitWidth() <= 32) {
-                domainSizeInteger = CI->getSExtValue();
-            }
+        if (t->isProgression) {
+            // Neither the domain nor the body is needed
+            llvm::Value *count = llvm::ConstantInt::get(intTy, t->progressionCount, true);
+            profileEnter(t, PROFILE_GENERATOR);
+            t->llvmValue = createProgression(t);
+            profileExit(count, count);
+            return;
         }
+        visit(t->children[1]);  // Visit the Domain
+        llvm::Value *domainRef = t->children[1]->llvmValue;
+        int domainSizeInteger = getArraySizeInteger(domainRef);
+        profileEnter(t, PROFILE_GENERATOR);
+        llvm::Value *domainSize = getVectorSize(domainRef);
+        llvm::Value *resultArray = allocateResultBuffer(t, domainSize);
+        auto enclosingDivisors = hoistedDivisors;  // Divisors hoisted out of the body live only as long as this generator
 
-        std::vector<llvm::Value *> llvmValues;
+        if (!llvm::isa<llvm::ConstantInt>(domainSize) || domainSizeInteger > MAX_UNROLLED_ELEMENTS) {
+            // Unknown or long length: emit the body once inside a loop instead of once per element
+            prepareHoistedDivisors(t->children[2], domainSize);
+            createElementLoop(domainSize, [&](llvm::Value *index) {
+                bindDomainVariable(t->children[0], loadElement(domainRef, index));
+                visit(t->children[2]);
+                storeElement(resultArray, index, t->children[2]->llvmValue);
+            }, profiledTripCount(t, PROFILE_GENERATOR));
+            hoistedDivisors = enclosingDivisors;
+            profileExit(domainSize, domainSize);
+            t->llvmValue = resultArray;
+            return;
+        }
 
-        for (int i = 0; i <= domainSizeInteger; i++) {
+        for (int i = 0; i < domainSizeInteger; i++) {
             // Get the element of the domain
-            llvm::Value *pointerToDomainElement = ir.CreateGEP(
-                intTy, 
-                domainRef, 
-                llvm::ArrayRef<llvm::Value *> { 
-                    llvm::ConstantInt::get(intTy, 0, true), 
-                    llvm::ConstantInt::get(intTy, i, true) 
-                }
-            );
-            t->children[0]->llvmValue = ir.CreateLoad(intTy, pointerToDomainElement);
+            llvm::Value *index = llvm::ConstantInt::get(intTy, i, true);
+            bindDomainVariable(t->children[0], loadElement(domainRef, index));
             visit(t->children[2]);  // Computation based on the value from an element of domain
 
             // Storing result
-            llvm::Value *pointerToResultArrayElement = ir.CreateGEP(
-                intTy, 
-                t->symbol->llvmAllocaInst, 
-                llvm::ArrayRef<llvm::Value *> { 
-                    llvm::ConstantInt::get(intTy, 0, true), 
-                    llvm::ConstantInt::get(intTy, i, true) 
-                }
-            );
-            ir.CreateStore(t->children[2]->llvmValue, pointerToResultArrayElement);
+            storeElement(resultArray, index, t->children[2]->llvmValue);
         }
+        hoistedDivisors = enclosingDivisors;
+        profileExit(llvm::ConstantInt::get(intTy, domainSizeInteger, true), llvm::ConstantInt::get(intTy, domainSizeInteger, true));
+        t->llvmValue = resultArray;
     }
 
     void LLVMIRGenerator::visitFILTER_TOKEN(std::shared_ptr<AST> t) {
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        if (t->isProgression) {
+            // The kept elements are counted in closed form, so the predicate is never evaluated
+            std::shared_ptr<AST> domain = t->children[1];
+            while (domain->getNodeType() == VCalcParser::PARENTHESIS_TOKEN) domain = domain->children[0];
+            profileEnter(t, PROFILE_FILTER);
+            t->llvmValue = createProgression(t);
+            profileExit(llvm::ConstantInt::get(intTy, domain->progressionCount, true), llvm::ConstantInt::get(intTy, t->progressionCount, true));
+            return;
+        }
         visit(t->children[1]);  // Visit the Domain
+        llvm::Value *domainRef = t->children[1]->llvmValue;
+        llvm::Value *domainSize = getVectorSize(domainRef);
+        auto enclosingDivisors = hoistedDivisors;
+        profileEnter(t, PROFILE_FILTER);
+
+        // The predicate is packed into a mask first, so the kept elements are counted before the
+        // result is allocated and then copied over in one pass
+        llvm::Value *mask = allocateMask(domainSize);
+        if (!createMaskPredicate(t, mask)) {
+            llvm::Type *wordTy = ir.getInt64Ty();
+            llvm::Value *words = ir.CreateLShr(ir.CreateAdd(domainSize, llvm::ConstantInt::get(intTy, 63, true)), 6);
+            ir.CreateMemSet(mask, ir.getInt8(0), ir.CreateMul(ir.CreateZExt(words, wordTy), ir.getInt64(8)), llvm::MaybeAlign(8));
+            prepareHoistedDivisors(t->children[2], domainSize);
+            createElementLoop(domainSize, [&](llvm::Value *index) {
+                size_t enclosingBuffers = statementBuffers.size();
+                bindDomainVariable(t->children[0], loadElement(domainRef, index));
+                visit(t->children[2]);  // Computation based on the value from an element of domain
+                llvm::Value *keep = ir.CreateICmpNE(t->children[2]->llvmValue, llvm::ConstantInt::get(intTy, 0, true));
+                llvm::Value *address = ir.CreateGEP(wordTy, mask, ir.CreateLShr(index, 6));
+                llvm::Value *bit = ir.CreateShl(ir.CreateZExt(keep, wordTy), ir.CreateZExt(ir.CreateAnd(index, 63), wordTy));
+                ir.CreateStore(ir.CreateOr(ir.CreateLoad(wordTy, address), bit), address);
+                // Vectors the predicate built for this element die with it
+                for (size_t b = enclosingBuffers; b < statementBuffers.size(); b++) releaseVector(statementBuffers[b]);
+                statementBuffers.resize(enclosingBuffers);
+                hoistedDivisors = enclosingDivisors;
+            }, profiledTripCount(t, PROFILE_FILTER));
+        }
+        hoistedDivisors = enclosingDivisors;
+
+        llvm::Value *kept = ir.CreateCall(
+            mod.getOrInsertFunction("vcalcMaskCount", llvm::FunctionType::get(intTy, { ir.getInt64Ty()->getPointerTo(), intTy }, false)),
+            { mask, domainSize }
+        );
+        llvm::Value *resultArray = allocateVector(getElementType(t), kept);
+        llvm::FunctionCallee compress = mod.getOrInsertFunction(
+            "vcalcMaskCompress",
+            llvm::FunctionType::get(ir.getVoidTy(), { ir.getInt8PtrTy(), intTy, ir.getInt8PtrTy(), intTy, ir.getInt64Ty()->getPointerTo(), intTy }, false)
+        );
+        ir.CreateCall(compress, {
+            ir.CreateBitCast(resultArray, ir.getInt8PtrTy()),
+            llvm::ConstantInt::get(intTy, getVectorElementType(resultArray)->getIntegerBitWidth(), true),
+            ir.CreateBitCast(domainRef, ir.getInt8PtrTy()),
+            llvm::ConstantInt::get(intTy, getVectorElementType(domainRef)->getIntegerBitWidth(), true),
+            mask,
+            domainSize
+        });
+        profileExit(domainSize, kept);
+        t->llvmValue = resultArray;
+    }
+
+    bool LLVMIRGenerator::createMaskPredicate(std::shared_ptr<AST> t, llvm::Value *mask) {
+        // A predicate comparing the domain variable with a constant is one compare kernel over the
+        // whole domain, with no body evaluated per element. False for any other predicate.
+        std::shared_ptr<AST> predicate = t->children[2];
+        while (predicate->getNodeType() == VCalcParser::PARENTHESIS_TOKEN) predicate = predicate->children[0];
+        int opcode;
+        switch ( predicate->getNodeType() ) {
+            case VCalcParser::GREATERTHAN: opcode = 0; break;
+            case VCalcParser::LESSTHAN: opcode = 1; break;
+            case VCalcParser::ISEQUAL: opcode = 2; break;
+            case VCalcParser::ISNOTEQUAL: opcode = 3; break;
+            default: return false;
+        }
+        std::shared_ptr<AST> lhs = predicate->children[0], rhs = predicate->children[1];
+        auto isDomainVariable = [&](std::shared_ptr<AST> operand) {
+            return operand->getNodeType() == VCalcParser::ID && operand->symbol && operand->symbol == t->children[0]->symbol;
+        };
+        if (isDomainVariable(rhs) && lhs->getNodeType() == VCalcParser::INTEGER) {
+            std::swap(lhs, rhs);
+            if (opcode < 2) opcode = 1 - opcode;  // c > i is i < c
+        }
+        if (!isDomainVariable(lhs) || rhs->getNodeType() != VCalcParser::INTEGER) return false;
+
         llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
-        llvm::AllocaInst *domainRef = llvm::dyn_cast<llvm::AllocaInst>(t->children[1]->llvmValue);
-        llvm::Value *domainSize = domainRef->getArraySize();
-        
-        // Cast from *Value to integer
-        int domainSizeInteger;
-        if (llvm::ConstantInt* CI = llvm::dyn_cast<llvm::ConstantInt>(domainSize)) {
-            if (CI->getBitWidth() <= 32) {
-                domainSizeInteger = CI->getSExtValue();
-            }
+        llvm::Value *domainRef = t->children[1]->llvmValue;
+        llvm::Value *constant = createEntryAlloca(intTy);
+        ir.CreateStore(llvm::ConstantInt::get(intTy, std::stoi(rhs->token->getText()), true), constant);
+        llvm::FunctionCallee compare = mod.getOrInsertFunction(
+            "vcalcMaskCompare",
+            llvm::FunctionType::get(ir.getVoidTy(), { intTy, ir.getInt64Ty()->getPointerTo(), ir.getInt8PtrTy(), intTy, intTy, ir.getInt8PtrTy(), intTy, intTy, intTy }, false)
+        );
+        ir.CreateCall(compare, {
+            llvm::ConstantInt::get(intTy, opcode, true),
+            mask,
+            ir.CreateBitCast(domainRef, ir.getInt8PtrTy()),
+            llvm::ConstantInt::get(intTy, getVectorElementType(domainRef)->getIntegerBitWidth(), true),
+            llvm::ConstantInt::get(intTy, 1, true),
+            ir.CreateBitCast(constant, ir.getInt8PtrTy()),
+            llvm::ConstantInt::get(intTy, 32, true),
+            llvm::ConstantInt::get(intTy, 0, true),
+            getVectorSize(domainRef)
+        });
+        return true;
+    }
+
+    llvm::Value *LLVMIRGenerator::allocateMask(llvm::Value *size) {
+        // A buffer of 64-bit words like any other, so it is retained and released the same way
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        llvm::Value *words = ir.CreateLShr(ir.CreateAdd(size, llvm::ConstantInt::get(intTy, 63, true)), 6);
+        llvm::Value *mask = allocateVector(ir.getInt64Ty(), words);
+        vectorSizes[mask] = size;
+        masks.insert(mask);
+        return mask;
+    }
+
+    llvm::Value *LLVMIRGenerator::createMask(std::shared_ptr<AST> t) {
+        // The runtime compares a word's worth of elements at a time and packs the results into its bits
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        llvm::Value *op1 = t->children[0]->llvmValue;
+        llvm::Value *op2 = t->children[1]->llvmValue;
+        bool op1IsVector = t->children[0]->evalType->getName() == "vector";
+        bool op2IsVector = t->children[1]->evalType->getName() == "vector";
+        llvm::Value *size = getVectorSize(op1IsVector ? op1 : op2);  // The length of the first vector operand
+        llvm::Value *mask = allocateMask(size);
+        int opcode;
+        switch ( t->getNodeType() ) {
+            case VCalcParser::GREATERTHAN: opcode = 0; break;
+            case VCalcParser::LESSTHAN: opcode = 1; break;
+            case VCalcParser::ISEQUAL: opcode = 2; break;
+            default: opcode = 3; break;
         }
 
-        std::vector<llvm::Value *> llvmValueVector;
-        for (int i = 0; i <= domainSizeInteger; i++) {
-            // Get the element of the domain
-            llvm::Value *pointerToDomainElement = ir.CreateGEP(
-                intTy, 
-                domainRef, 
-                llvm::ArrayRef<llvm::Value *> { 
-                    llvm::ConstantInt::get(intTy, 0, true), 
-                    llvm::ConstantInt::get(intTy, i, true) 
-                }
+        if (opcode >= 2 && masks.count(op1) && masks.count(op2)) {
+            // Two masks are equal where their bits agree: a word at a time
+            llvm::FunctionCallee combine = mod.getOrInsertFunction(
+                "vcalcMaskCombine",
+                llvm::FunctionType::get(ir.getVoidTy(), { intTy, ir.getInt64Ty()->getPointerTo(), ir.getInt64Ty()->getPointerTo(), ir.getInt64Ty()->getPointerTo(), intTy }, false)
             );
-            t->children[0]->llvmValue = ir.CreateLoad(intTy, pointerToDomainElement);
-            visit(t->children[2]);  // Computation based on the value from an element of domain
+            ir.CreateCall(combine, { llvm::ConstantInt::get(intTy, opcode, true), mask, op1, op2, size });
+            return mask;
+        }
 
-            llvm::Value *llvmPredicateResult = ir.CreateICmpEQ(t->children[2]->llvmValue, llvm::ConstantInt::get(intTy, 1, true));
-            // Cast from *Value to integer/boolean
-            int predicateResult;
-            if (llvm::ConstantInt* CIPredicate = llvm::dyn_cast<llvm::ConstantInt>(llvmPredicateResult)) {
-                if (CIPredicate->getBitWidth() <= 32) {
-                    predicateResult = CIPredicate->getSExtValue();
-                }
+        // An int operand is passed as a one-element array with stride 0; a mask is widened first
+        std::vector<llvm::Value *> args = { llvm::ConstantInt::get(intTy, opcode, true), mask };
+        auto operand = [&](llvm::Value *value, bool isVector) {
+            if (!isVector) {
+                llvm::Value *scalar = createEntryAlloca(intTy);
+                ir.CreateStore(value, scalar);
+                value = scalar;
+            } else if (masks.count(value)) {
+                value = widenMask(value);
             }
+            args.push_back(ir.CreateBitCast(value, ir.getInt8PtrTy()));
+            args.push_back(llvm::ConstantInt::get(intTy, value->getType()->getPointerElementType()->getIntegerBitWidth(), true));
+            args.push_back(llvm::ConstantInt::get(intTy, isVector ? 1 : 0, true));
+        };
+        operand(op1, op1IsVector);
+        operand(op2, op2IsVector);
+        args.push_back(size);
+        llvm::FunctionCallee compare = mod.getOrInsertFunction(
+            "vcalcMaskCompare",
+            llvm::FunctionType::get(ir.getVoidTy(), { intTy, ir.getInt64Ty()->getPointerTo(), ir.getInt8PtrTy(), intTy, intTy, ir.getInt8PtrTy(), intTy, intTy, intTy }, false)
+        );
+        ir.CreateCall(compare, args);
+        return mask;
+    }
 
-            if (predicateResult == 1) {
-                // If the domain variable satisfies the predicate, i.e., t->children[0]->llvmValue is true
-                llvmValueVector.push_back(t->children[0]->llvmValue);
-            }
+    llvm::Value *LLVMIRGenerator::createMaskReduction(std::shared_ptr<AST> t, llvm::Value *mask) {
+        // Every element is 0 or 1, so each reduction follows from how many are set
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        llvm::Value *size = getVectorSize(mask);
+        llvm::Value *set = ir.CreateCall(
+            mod.getOrInsertFunction("vcalcMaskCount", llvm::FunctionType::get(intTy, { ir.getInt64Ty()->getPointerTo(), intTy }, false)),
+            { mask, size }
+        );
+        if (t->getNodeType() == VCalcParser::SUM) return set;
+        if (t->getNodeType() == VCalcParser::MIN || t->getNodeType() == VCalcParser::MAX) {
+            llvm::FunctionCallee emptyReduction = mod.getOrInsertFunction(
+                "vcalcEmptyReduction",
+                llvm::FunctionType::get(ir.getVoidTy(), { intTy }, false)
+            );
+            createRuntimeCheck(ir.CreateICmpEQ(size, llvm::ConstantInt::get(intTy, 0, true)), emptyReduction, { llvm::ConstantInt::get(intTy, t->getLine(), true) });
         }
+        // max is 1 when any element is set; min and product only when all of them are
+        llvm::Value *result = t->getNodeType() == VCalcParser::MAX ? ir.CreateICmpSGT(set, llvm::ConstantInt::get(intTy, 0, true)) : ir.CreateICmpEQ(set, size);
+        return ir.CreateZExt(result, intTy);
+    }
 
-        // Store the allocaInst of this FILTER AST node
-        t->symbol->llvmAllocaInst = ir.CreateAlloca(
-            llvm::Type::getInt32Ty(globalCtx), 
-            llvm::ConstantInt::get(intTy, llvmValueVector.size(), true), 
-            "Variable" + std::to_string(++numVariables)
+    llvm::Value *LLVMIRGenerator::widenMask(llvm::Value *mask) {
+        // Byte elements holding 0 or 1, for the consumers that need whole elements
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        llvm::Value *size = getVectorSize(mask);
+        llvm::Value *wide = allocateVector(ir.getInt8Ty(), size);
+        llvm::FunctionCallee widen = mod.getOrInsertFunction(
+            "vcalcMaskWiden",
+            llvm::FunctionType::get(ir.getVoidTy(), { ir.getInt8PtrTy(), intTy, ir.getInt64Ty()->getPointerTo(), intTy }, false)
         );
+        ir.CreateCall(widen, { wide, llvm::ConstantInt::get(intTy, 8, true), mask, size });
+        return wide;
+    }
 
-        for (unsigned int i = 0; i < llvmValueVector.size(); i++) {
-            // Storing result
-            llvm::Value *pointerToResultArrayElement = ir.CreateGEP(
-                intTy, 
-                t->symbol->llvmAllocaInst, 
-                llvm::ArrayRef<llvm::Value *> { 
-                    llvm::ConstantInt::get(intTy, 0, true), 
-                    llvm::ConstantInt::get(intTy, i, true) 
-                }
+    void LLVMIRGenerator::visitINDEX_TOKEN(std::shared_ptr<AST> t) {
+        if (t->isSlice) {
+            visitSlice(t);
+            return;
+        }
+        visitChildren(t);
+        if (t->evalType->getName() == "vector") {
+            visitGather(t);
+            return;
+        }
+        llvm::Value *arrayRef = t->children[0]->llvmValue;
+        llvm::Value *index = t->children[1]->llvmValue;
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        if (!t->indexInBounds) {
+            // RangeAnalysis could not prove the index valid, so check it at runtime.
+            // The unsigned compare also catches negative indices.
+            llvm::Value *arraySize = getVectorSize(arrayRef);
+            llvm::FunctionCallee indexOutOfBounds = mod.getOrInsertFunction(
+                "vcalcIndexOutOfBounds",
+                llvm::FunctionType::get(ir.getVoidTy(), { intTy, intTy, intTy }, false)
             );
-            ir.CreateStore(llvmValueVector[i], pointerToResultArrayElement);
+            createRuntimeCheck(ir.CreateICmpUGE(index, arraySize), indexOutOfBounds, { llvm::ConstantInt::get(intTy, t->getLine(), true), index, arraySize });
         }
+        t->llvmValue = loadElement(arrayRef, index);
     }
 
-    void LLVMIRGenerator::visitINDEX_TOKEN(std::shared_ptr<AST> t) {
-        llvm::AllocaInst *arrayRef = llvm::dyn_cast<llvm::AllocaInst>(t->children[0]->llvmValue);
-        llvm::Value *index = t->children[1]->llvmValue;
+    /* ^(INDEX_TOKEN expr ^(RANGE expr expr)) */
+    void LLVMIRGenerator::visitSlice(std::shared_ptr<AST> t) {
+        visit(t->children[0]);
+        std::shared_ptr<AST> range = t->children[1];
+        while (range->getNodeType() == VCalcParser::PARENTHESIS_TOKEN) range = range->children[0];
+        // Only the bounds are needed, the range itself is never materialized
+        visitChildren(range);
+        llvm::Value *arrayRef = t->children[0]->llvmValue;
+        llvm::Value *lower = range->children[0]->llvmValue;
+        llvm::Value *upper = range->children[1]->llvmValue;
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        llvm::Value *nonEmpty = ir.CreateICmpSLE(lower, upper);
+
+        if (!t->indexInBounds) {
+            // An empty slice never reads, so only a non-empty one needs both bounds inside the vector
+            llvm::Value *arraySize = getVectorSize(arrayRef);
+            llvm::Value *lowerOutside = ir.CreateICmpUGE(lower, arraySize);
+            llvm::Value *upperOutside = ir.CreateICmpUGE(upper, arraySize);
+            llvm::FunctionCallee indexOutOfBounds = mod.getOrInsertFunction(
+                "vcalcIndexOutOfBounds",
+                llvm::FunctionType::get(ir.getVoidTy(), { intTy, intTy, intTy }, false)
+            );
+            createRuntimeCheck(
+                ir.CreateAnd(nonEmpty, ir.CreateOr(lowerOutside, upperOutside)),
+                indexOutOfBounds,
+                { llvm::ConstantInt::get(intTy, t->getLine(), true), ir.CreateSelect(lowerOutside, lower, upper), arraySize }
+            );
+        }
+
+        // The slice points into the base vector's buffer instead of copying it
+        llvm::Value *sliceRef = ir.CreateGEP(getVectorElementType(arrayRef), arrayRef, ir.CreateSelect(nonEmpty, lower, llvm::ConstantInt::get(intTy, 0, true)), nextVariableName());
+        sliceBases[sliceRef] = getBuffer(arrayRef);
+        vectorSizes[sliceRef] = ir.CreateSelect(nonEmpty, ir.CreateAdd(ir.CreateSub(upper, lower), llvm::ConstantInt::get(intTy, 1, true)), llvm::ConstantInt::get(intTy, 0, true));
+        t->llvmValue = sliceRef;
+    }
+
+    /* ^(INDEX_TOKEN expr expr) where the index is a vector */
+    void LLVMIRGenerator::visitGather(std::shared_ptr<AST> t) {
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        llvm::Value *arrayRef = t->children[0]->llvmValue;
+        llvm::Value *indexRef = t->children[1]->llvmValue;
+        llvm::Value *indexCount = getVectorSize(indexRef);
+        llvm::Value *resultArray = allocateVector(getElementType(t), indexCount);
+
+        // The runtime checks every index up front (skipped when RangeAnalysis proved them all valid)
+        // and then gathers with hardware gathers where the CPU has them
+        llvm::FunctionCallee gather = mod.getOrInsertFunction(
+            "vcalcGather",
+            llvm::FunctionType::get(ir.getVoidTy(), { intTy, ir.getInt8PtrTy(), intTy, ir.getInt8PtrTy(), intTy, intTy, ir.getInt8PtrTy(), intTy, intTy, intTy }, false)
+        );
+        ir.CreateCall(gather, {
+            llvm::ConstantInt::get(intTy, t->getLine(), true),
+            ir.CreateBitCast(resultArray, ir.getInt8PtrTy()),
+            llvm::ConstantInt::get(intTy, getVectorElementType(resultArray)->getIntegerBitWidth(), true),
+            ir.CreateBitCast(arrayRef, ir.getInt8PtrTy()),
+            llvm::ConstantInt::get(intTy, getVectorElementType(arrayRef)->getIntegerBitWidth(), true),
+            getVectorSize(arrayRef),
+            ir.CreateBitCast(indexRef, ir.getInt8PtrTy()),
+            llvm::ConstantInt::get(intTy, getVectorElementType(indexRef)->getIntegerBitWidth(), true),
+            indexCount,
+            llvm::ConstantInt::get(intTy, t->indexInBounds ? 0 : 1, true)
+        });
+        t->llvmValue = resultArray;
+    }
+
+    /* ^(MATRIX_INDEX_TOKEN expr expr expr) */
+    void LLVMIRGenerator::visitMATRIX_INDEX_TOKEN(std::shared_ptr<AST> t) {
+        visitChildren(t);
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        llvm::Value *matrix = t->children[0]->llvmValue;
+        llvm::Value *row = t->children[1]->llvmValue;
+        llvm::Value *column = t->children[2]->llvmValue;
+        MatrixShape shape = matrixShapes[matrix];
+        llvm::FunctionCallee indexOutOfBounds = mod.getOrInsertFunction(
+            "vcalcMatrixIndexOutOfBounds",
+            llvm::FunctionType::get(ir.getVoidTy(), { intTy, intTy, intTy, intTy, intTy }, false)
+        );
+        createRuntimeCheck(
+            ir.CreateOr(ir.CreateICmpUGE(row, shape.rows), ir.CreateICmpUGE(column, shape.columns)),
+            indexOutOfBounds,
+            { llvm::ConstantInt::get(intTy, t->getLine(), true), row, column, shape.rows, shape.columns }
+        );
+        t->llvmValue = loadElement(matrix, ir.CreateAdd(ir.CreateMul(row, shape.columns), column));
+    }
+
+    /* ^(MATRIX_GENERATOR_TOKEN ID expression ID expression expression) */
+    void LLVMIRGenerator::visitMATRIX_GENERATOR_TOKEN(std::shared_ptr<AST> t) {
+        visit(t->children[1]);  // Visit both domains
+        visit(t->children[3]);
+        llvm::Value *rowDomain = t->children[1]->llvmValue;
+        llvm::Value *columnDomain = t->children[3]->llvmValue;
+        llvm::Value *rows = getVectorSize(rowDomain);
+        llvm::Value *columns = getVectorSize(columnDomain);
+        profileEnter(t, PROFILE_GENERATOR);
+        llvm::Value *resultMatrix = allocateMatrix(rows, columns);
+        auto enclosingDivisors = hoistedDivisors;
+
+        // rows * columns bodies are too many to unroll like a vector generator, so always loop
+        createElementLoop(rows, [&](llvm::Value *row) {
+            bindDomainVariable(t->children[0], loadElement(rowDomain, row));
+            llvm::Value *rowStart = ir.CreateMul(row, columns);
+            createElementLoop(columns, [&](llvm::Value *column) {
+                // Temporaries of the body die with the element, not with the statement
+                size_t enclosingBuffers = statementBuffers.size();
+                bindDomainVariable(t->children[2], loadElement(columnDomain, column));
+                visit(t->children[4]);
+                storeElement(resultMatrix, ir.CreateAdd(rowStart, column), t->children[4]->llvmValue);
+                for (size_t i = enclosingBuffers; i < statementBuffers.size(); i++) releaseVector(statementBuffers[i]);
+                statementBuffers.resize(enclosingBuffers);
+            });
+        });
+        hoistedDivisors = enclosingDivisors;
+        llvm::Value *elements = getVectorSize(resultMatrix);
+        profileExit(elements, elements);
+        t->llvmValue = resultMatrix;
+    }
+
+    void LLVMIRGenerator::createMatrixOperation(std::shared_ptr<AST> t) {
+        // Matrices are whole buffers, so the runtime's tiled kernels do the element loops
         llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
-        llvm::Value *pointerToElement = ir.CreateGEP(
-            intTy, 
-            arrayRef, 
-            llvm::ArrayRef<llvm::Value *> { 
-                llvm::ConstantInt::get(intTy, 0, true), 
-                index 
+        llvm::Type *intPtrTy = llvm::Type::getInt32PtrTy(globalCtx);
+        llvm::Value *line = llvm::ConstantInt::get(intTy, t->getLine(), true);
+        llvm::Value *zero = llvm::ConstantInt::get(intTy, 0, true);
+        bool op1IsMatrix = t->children[0]->evalType->getName() == "matrix";
+        bool op2IsMatrix = t->children[1]->evalType->getName() == "matrix";
+        bool matmul = t->getNodeType() == VCalcParser::MATMUL;
+        if (t->children[0]->evalType->getName() == "vector" || t->children[1]->evalType->getName() == "vector" || (matmul && !(op1IsMatrix && op2IsMatrix))) {
+            // ExpressionTypeComputation has reported it already
+            t->llvmValue = allocateMatrix(zero, zero);
+            return;
+        }
+        llvm::Value *op1 = t->children[0]->llvmValue;
+        llvm::Value *op2 = t->children[1]->llvmValue;
+
+        if (matmul) {
+            MatrixShape lhs = matrixShapes[op1];
+            MatrixShape rhs = matrixShapes[op2];
+            llvm::Value *resultMatrix = allocateMatrix(lhs.rows, rhs.columns);
+            llvm::FunctionCallee multiply = mod.getOrInsertFunction(
+                "vcalcMatrixMultiply",
+                llvm::FunctionType::get(ir.getVoidTy(), { intTy, intPtrTy, intPtrTy, intTy, intTy, intPtrTy, intTy, intTy }, false)
+            );
+            ir.CreateCall(multiply, { line, resultMatrix, op1, lhs.rows, lhs.columns, op2, rhs.rows, rhs.columns });
+            t->llvmValue = resultMatrix;
+            return;
+        }
+
+        // The result takes the shape of its first matrix operand, and a second matrix must match it
+        MatrixShape shape = matrixShapes[op1IsMatrix ? op1 : op2];
+        if (op1IsMatrix && op2IsMatrix) {
+            MatrixShape other = matrixShapes[op2];
+            llvm::FunctionCallee shapeMismatch = mod.getOrInsertFunction(
+                "vcalcMatrixShapeMismatch",
+                llvm::FunctionType::get(ir.getVoidTy(), { intTy, intTy, intTy, intTy, intTy }, false)
+            );
+            createRuntimeCheck(
+                ir.CreateOr(ir.CreateICmpNE(shape.rows, other.rows), ir.CreateICmpNE(shape.columns, other.columns)),
+                shapeMismatch,
+                { line, shape.rows, shape.columns, other.rows, other.columns }
+            );
+        }
+        // An int operand is passed as a one-element array with stride 0
+        auto operand = [&](llvm::Value *value, bool isMatrix) {
+            if (isMatrix) return value;
+            llvm::Value *scalar = createEntryAlloca(intTy);
+            ir.CreateStore(value, scalar);
+            return scalar;
+        };
+        int opcode;
+        switch (t->getNodeType()) {
+            case VCalcParser::ADD: opcode = 0; break;
+            case VCalcParser::SUB: opcode = 1; break;
+            case VCalcParser::MUL: opcode = 2; break;
+            case VCalcParser::DIV: opcode = 3; break;
+            case VCalcParser::GREATERTHAN: opcode = 4; break;
+            case VCalcParser::LESSTHAN: opcode = 5; break;
+            case VCalcParser::ISEQUAL: opcode = 6; break;
+            default: opcode = 7; break;
+        }
+        llvm::Value *resultMatrix = allocateMatrix(shape.rows, shape.columns);
+        llvm::FunctionCallee elementwise = mod.getOrInsertFunction(
+            "vcalcMatrixElementwise",
+            llvm::FunctionType::get(ir.getVoidTy(), { intTy, intTy, intPtrTy, intPtrTy, intTy, intPtrTy, intTy, intTy }, false)
+        );
+        ir.CreateCall(elementwise, {
+            line,
+            llvm::ConstantInt::get(intTy, opcode, true),
+            resultMatrix,
+            operand(op1, op1IsMatrix),
+            llvm::ConstantInt::get(intTy, op1IsMatrix ? 1 : 0, true),
+            operand(op2, op2IsMatrix),
+            llvm::ConstantInt::get(intTy, op2IsMatrix ? 1 : 0, true),
+            getVectorSize(resultMatrix)
+        });
+        t->llvmValue = resultMatrix;
+    }
+
+    llvm::Value *LLVMIRGenerator::allocateMatrix(llvm::Value *rows, llvm::Value *columns) {
+        // Always 32-bit elements, which is what the runtime kernels work on
+        llvm::Value *matrix = allocateVector(llvm::Type::getInt32Ty(globalCtx), ir.CreateMul(rows, columns));
+        matrixShapes[matrix] = MatrixShape { rows, columns };
+        return matrix;
+    }
+
+    llvm::Value *LLVMIRGenerator::createEntryAlloca(llvm::Type *type) {
+        // At the top of the function, where mem2reg can promote it, even when requested inside a loop
+        llvm::BasicBlock &entry = mainFunction->getEntryBlock();
+        llvm::IRBuilder<> entryBuilder(&entry, entry.begin());
+        return entryBuilder.CreateAlloca(type, nullptr, nextVariableName());
+    }
+
+    void LLVMIRGenerator::bindDomainVariable(std::shared_ptr<AST> id, llvm::Value *element) {
+        // References in the body load the domain variable's symbol, so keep it in a slot of its own
+        id->llvmValue = element;
+        if (!id->symbol) return;
+        // The symbol outlives this module in the REPL and across partitions, so only reuse a slot of this function
+        llvm::AllocaInst *slot = llvm::dyn_cast_or_null<llvm::AllocaInst>(id->symbol->llvmAllocaInst);
+        if (!slot || slot->getFunction() != mainFunction) id->symbol->llvmAllocaInst = createEntryAlloca(llvm::Type::getInt32Ty(globalCtx));
+        ir.CreateStore(element, id->symbol->llvmAllocaInst);
+    }
+
+    llvm::Type *LLVMIRGenerator::getElementType(std::shared_ptr<AST> t) {
+        // RangeAnalysis bounds every element, so store in the narrowest integer that holds them
+        return llvm::IntegerType::get(globalCtx, t->range.minimumBitWidth());
+    }
+
+    llvm::Value *LLVMIRGenerator::getVectorSize(llvm::Value *array) {
+        // A vector is a pointer to its first element. Its length is recorded
+        // when the buffer or slice is created.
+        return vectorSizes[array];
+    }
+
+    llvm::Type *LLVMIRGenerator::getVectorElementType(llvm::Value *array) {
+        return array->getType()->getPointerElementType();
+    }
+
+    int LLVMIRGenerator::getArraySizeInteger(llvm::Value *array) {
+        // Cast from *Value to integer
+        int arraySize = 0;
+        if (llvm::ConstantInt* CI = llvm::dyn_cast<llvm::ConstantInt>(getVectorSize(array))) {
+            if (CI->getBitWidth() <= 32) {
+                arraySize = CI->getSExtValue();
             }
+        }
+        return arraySize;
+    }
+
+    llvm::Value *LLVMIRGenerator::loadElement(llvm::Value *array, llvm::Value *index) {
+        // Narrow elements are widened to int as they are read
+        if (masks.count(array)) {
+            // Bit index % 64 of word index / 64
+            llvm::Type *wordTy = ir.getInt64Ty();
+            llvm::Value *word = ir.CreateLoad(wordTy, ir.CreateGEP(wordTy, array, ir.CreateLShr(index, 6)));
+            llvm::Value *bit = ir.CreateLShr(word, ir.CreateZExt(ir.CreateAnd(index, 63), wordTy));
+            return ir.CreateTrunc(ir.CreateAnd(bit, 1), llvm::Type::getInt32Ty(globalCtx));
+        }
+        llvm::Type *elementTy = getVectorElementType(array);
+        llvm::Value *element = ir.CreateLoad(elementTy, ir.CreateGEP(elementTy, array, index));
+        return ir.CreateSExt(element, llvm::Type::getInt32Ty(globalCtx));
+    }
+
+    void LLVMIRGenerator::storeElement(llvm::Value *array, llvm::Value *index, llvm::Value *value) {
+        llvm::Type *elementTy = getVectorElementType(array);
+        ir.CreateStore(ir.CreateTrunc(value, elementTy), ir.CreateGEP(elementTy, array, index));
+    }
+
+    llvm::Value *LLVMIRGenerator::loadChunk(llvm::Value *array, llvm::Value *index, unsigned lanes) {
+        // `lanes` consecutive elements as one <lanes x i32>. Buffers are only element aligned.
+        llvm::Type *elementTy = getVectorElementType(array);
+        llvm::Type *chunkTy = llvm::VectorType::get(elementTy, lanes);
+        llvm::Value *address = ir.CreateBitCast(ir.CreateGEP(elementTy, array, index), chunkTy->getPointerTo());
+        llvm::Value *chunk = ir.CreateAlignedLoad(chunkTy, address, llvm::Align(elementTy->getIntegerBitWidth() / 8));
+        return ir.CreateSExt(chunk, llvm::VectorType::get(llvm::Type::getInt32Ty(globalCtx), lanes));
+    }
+
+    void LLVMIRGenerator::storeChunk(llvm::Value *array, llvm::Value *index, llvm::Value *chunk) {
+        llvm::Type *elementTy = getVectorElementType(array);
+        llvm::Type *chunkTy = llvm::VectorType::get(elementTy, llvm::cast<llvm::VectorType>(chunk->getType())->getNumElements());
+        llvm::Value *address = ir.CreateBitCast(ir.CreateGEP(elementTy, array, index), chunkTy->getPointerTo());
+        ir.CreateAlignedStore(ir.CreateTrunc(chunk, chunkTy), address, llvm::Align(elementTy->getIntegerBitWidth() / 8));
+    }
+
+    llvm::Value *LLVMIRGenerator::splatLike(llvm::Value *scalar, llvm::Type *like) {
+        if (llvm::VectorType *vectorTy = llvm::dyn_cast<llvm::VectorType>(like)) {
+            return ir.CreateVectorSplat(vectorTy->getNumElements(), scalar);
+        }
+        return scalar;
+    }
+
+    void LLVMIRGenerator::createElementLoop(llvm::Value *size, const std::function<void(llvm::Value *)> &body, uint64_t expectedTrips) {
+        // for (index = 0; index < size; index++) body(index)
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        llvm::BasicBlock *preheader = ir.GetInsertBlock();
+        llvm::BasicBlock *header = llvm::BasicBlock::Create(globalCtx, nextBasicBlockName(), mainFunction);
+        llvm::BasicBlock *bodyBlock = llvm::BasicBlock::Create(globalCtx, nextBasicBlockName(), mainFunction);
+        llvm::BasicBlock *exitBlock = llvm::BasicBlock::Create(globalCtx, nextBasicBlockName(), mainFunction);
+        ir.CreateBr(header);
+
+        ir.SetInsertPoint(header);
+        llvm::PHINode *index = ir.CreatePHI(intTy, 2, nextVariableName());
+        index->addIncoming(llvm::ConstantInt::get(intTy, 0, true), preheader);
+        // A profiled trip count becomes the weights LLVM estimates trip counts from, for unrolling and vectorizing
+        llvm::MDNode *weights = nullptr;
+        if (expectedTrips > 0) weights = llvm::MDBuilder(globalCtx).createBranchWeights(std::min<uint64_t>(expectedTrips, UINT32_MAX), 1);
+        ir.CreateCondBr(ir.CreateICmpSLT(index, size), bodyBlock, exitBlock, weights);
+
+        ir.SetInsertPoint(bodyBlock);
+        body(index);
+        // The body may have split its block for runtime checks, so the latch is wherever it ended
+        index->addIncoming(ir.CreateAdd(index, llvm::ConstantInt::get(intTy, 1, true)), ir.GetInsertBlock());
+        ir.CreateBr(header);
+        ir.SetInsertPoint(exitBlock);
+    }
+
+    void LLVMIRGenerator::createRuntimeCheck(llvm::Value *failed, llvm::FunctionCallee handler, llvm::ArrayRef<llvm::Value *> args) {
+        // The handler reports the error and exits, so the failing path never rejoins
+        llvm::BasicBlock *failBlock = llvm::BasicBlock::Create(globalCtx, nextBasicBlockName(), mainFunction);
+        llvm::BasicBlock *continueBlock = llvm::BasicBlock::Create(globalCtx, nextBasicBlockName(), mainFunction);
+        ir.CreateCondBr(failed, failBlock, continueBlock, llvm::MDBuilder(globalCtx).createBranchWeights(1, 1 << 20));
+
+        ir.SetInsertPoint(failBlock);
+        ir.CreateCall(handler, args);
+        ir.CreateUnreachable();
+        ir.SetInsertPoint(continueBlock);
+    }
+
+    void LLVMIRGenerator::createDivisionCheck(std::shared_ptr<AST> t, llvm::Value *divisor, llvm::Value *evaluated) {
+        // `divisor` may be a whole <N x i32> chunk, which fails when any lane is zero. With `evaluated`,
+        // only fails when that also holds, i.e. when the division would have run.
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        llvm::FunctionCallee divisionByZero = mod.getOrInsertFunction(
+            "vcalcDivisionByZero",
+            llvm::FunctionType::get(ir.getVoidTy(), { intTy }, false)
+        );
+        llvm::Value *isZero = ir.CreateICmpEQ(divisor, llvm::Constant::getNullValue(divisor->getType()));
+        if (isZero->getType()->isVectorTy()) isZero = ir.CreateOrReduce(isZero);
+        if (evaluated) isZero = ir.CreateAnd(evaluated, isZero);
+        createRuntimeCheck(isZero, divisionByZero, { llvm::ConstantInt::get(intTy, t->getLine(), true) });
+    }
+
+    LLVMIRGenerator::DivisorMagic LLVMIRGenerator::prepareDivisor(std::shared_ptr<AST> t, llvm::Value *divisor, llvm::Value *evaluated) {
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        llvm::Type *longTy = llvm::Type::getInt64Ty(globalCtx);
+
+        createDivisionCheck(t, divisor, evaluated);
+        if (evaluated) {
+            // Past the check a zero divisor divides nothing, but the udiv below must still not see it
+            llvm::Value *isZero = ir.CreateICmpEQ(divisor, llvm::ConstantInt::get(intTy, 0, true));
+            divisor = ir.CreateSelect(isZero, llvm::ConstantInt::get(intTy, 1, true), divisor);
+        }
+
+        // |d| as an unsigned value, so that |INT_MIN| is 2^31
+        llvm::Value *sign = ir.CreateAShr(divisor, 31);
+        llvm::Value *absDivisor = ir.CreateSub(ir.CreateXor(divisor, sign), sign);
+
+        // With l = ceil(log2 |d|) and m = floor(2^(32 + l) / |d|) + 1, (n * m) >> (32 + l) == n / |d|
+        // for every 0 <= n <= 2^31, and n * m always fits in 64 bits
+        llvm::Function *ctlz = llvm::Intrinsic::getDeclaration(&mod, llvm::Intrinsic::ctlz, { intTy });
+        llvm::Value *log2 = ir.CreateSub(
+            llvm::ConstantInt::get(intTy, 32, true),
+            ir.CreateCall(ctlz, { ir.CreateSub(absDivisor, llvm::ConstantInt::get(intTy, 1, true)), ir.getFalse() })
+        );
+        llvm::Value *shift = ir.CreateZExt(ir.CreateAdd(log2, llvm::ConstantInt::get(intTy, 32, true)), longTy);
+        llvm::Value *multiplier = ir.CreateAdd(
+            ir.CreateUDiv(ir.CreateShl(llvm::ConstantInt::get(longTy, 1), shift), ir.CreateZExt(absDivisor, longTy)),
+            llvm::ConstantInt::get(longTy, 1)
+        );
+        return DivisorMagic { multiplier, shift, sign };
+    }
+
+    void LLVMIRGenerator::prepareHoistedDivisors(std::shared_ptr<AST> t, llvm::Value *size) {
+        // Called before an element loop over `size` elements whose body is `t`, so that the divisors
+        // DivisorHoisting marked are prepared once in the preheader rather than on every iteration.
+        // Inner divisors first, so that one used by another's divisor is prepared here too.
+        switch ( t->getNodeType() ) {
+            case VCalcParser::GENERATOR_TOKEN:
+            case VCalcParser::FILTER_TOKEN:
+                prepareHoistedDivisors(t->children[1], size);  // The body's divisors are hoisted to its own loop
+                return;
+            case VCalcParser::MATRIX_GENERATOR_TOKEN:
+                prepareHoistedDivisors(t->children[1], size);
+                prepareHoistedDivisors(t->children[3], size);
+                return;
+            default:
+                for ( auto child : t->children ) prepareHoistedDivisors(child, size);
+        }
+        if (t->hoistDivisor && !hoistedDivisors.count(t)) {
+            visit(t->children[1]);
+            llvm::Value *evaluated = ir.CreateICmpSGT(size, llvm::ConstantInt::get(size->getType(), 0, true));
+            hoistedDivisors.emplace(t, prepareDivisor(t, t->children[1]->llvmValue, evaluated));
+        }
+    }
+
+    llvm::Value *LLVMIRGenerator::createMagicDivision(llvm::Value *dividend, DivisorMagic magic) {
+        // Branch free so the loop vectorizer can widen it: divide magnitudes, then apply the sign.
+        // The dividend may be a whole <N x i32> chunk, in which case the magic is splatted.
+        llvm::Type *intTy = dividend->getType();
+        llvm::Type *longTy = llvm::Type::getInt64Ty(globalCtx);
+        if (llvm::VectorType *vectorTy = llvm::dyn_cast<llvm::VectorType>(intTy)) {
+            longTy = llvm::VectorType::get(longTy, vectorTy->getNumElements());
+        }
+        llvm::Value *sign = ir.CreateAShr(dividend, 31);
+        llvm::Value *absDividend = ir.CreateZExt(ir.CreateSub(ir.CreateXor(dividend, sign), sign), longTy);
+        llvm::Value *quotient = ir.CreateTrunc(ir.CreateLShr(ir.CreateMul(absDividend, splatLike(magic.multiplier, longTy)), splatLike(magic.shift, longTy)), intTy);
+        llvm::Value *resultSign = ir.CreateXor(sign, splatLike(magic.sign, intTy));
+        return ir.CreateSub(ir.CreateXor(quotient, resultSign), resultSign);
+    }
+
+    void LLVMIRGenerator::profileEnter(std::shared_ptr<AST> t, ProfileRegion region) {
+        if (!options.profile) return;
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        llvm::FunctionCallee enter = mod.getOrInsertFunction(
+            "vcalcProfileEnter",
+            llvm::FunctionType::get(ir.getVoidTy(), { intTy, intTy }, false)
         );
-        t->llvmValue = ir.CreateLoad(intTy, pointerToElement);
+        ir.CreateCall(enter, { llvm::ConstantInt::get(intTy, t->getLine(), true), llvm::ConstantInt::get(intTy, region, true) });
+    }
+
+    void LLVMIRGenerator::profileExit(llvm::Value *iterations, llvm::Value *elements) {
+        if (!options.profile) return;
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        llvm::FunctionCallee exit = mod.getOrInsertFunction(
+            "vcalcProfileExit",
+            llvm::FunctionType::get(ir.getVoidTy(), { intTy, intTy }, false)
+        );
+        ir.CreateCall(exit, { iterations, elements });
+    }
+
+    void LLVMIRGenerator::profileBranch(std::shared_ptr<AST> t, llvm::Value *condition) {
+        if (!options.profile) return;
+        llvm::Type *intTy = llvm::Type::getInt32Ty(globalCtx);
+        llvm::FunctionCallee branch = mod.getOrInsertFunction(
+            "vcalcProfileBranch",
+            llvm::FunctionType::get(ir.getVoidTy(), { intTy, intTy }, false)
+        );
+        ir.CreateCall(branch, { llvm::ConstantInt::get(intTy, t->getLine(), true), ir.CreateZExt(condition, intTy) });
+    }
+
+    llvm::MDNode *LLVMIRGenerator::profiledBranchWeights(std::shared_ptr<AST> t) {
+        // How often the conditional on this line ran its block in the profiled run. Null without one.
+        if (!options.profileData) return nullptr;
+        const ProfileData::Branch *branch = options.profileData->branch(t->getLine());
+        if (!branch) return nullptr;
+        // Weights are 32 bits, so large counts are scaled down together
+        uint64_t taken = branch->taken, notTaken = branch->notTaken;
+        while (taken >= UINT32_MAX || notTaken >= UINT32_MAX) {
+            taken /= 2;
+            notTaken /= 2;
+        }
+        return llvm::MDBuilder(globalCtx).createBranchWeights(taken + 1, notTaken + 1);
+    }
+
+    uint64_t LLVMIRGenerator::profiledTripCount(std::shared_ptr<AST> t, ProfileRegion region) {
+        return options.profileData ? options.profileData->averageIterations(t->getLine(), region) : 0;
+    }
+
+    void LLVMIRGenerator::setDebugLocation(std::shared_ptr<AST> t) {
+        if (!debugBuilder || t->isNil() || t->getLine() == 0) return;
+        ir.SetCurrentDebugLocation(llvm::DILocation::get(globalCtx, t->getLine(), t->getColumn(), debugScope));
+    }
+
+    void LLVMIRGenerator::createReturn() {
+        if (mainFunction->getReturnType()->isVoidTy()) {
+            ir.CreateRetVoid();
+        } else {
+            ir.CreateRet(ir.getInt32(0));
+        }
+    }
+
+    std::string LLVMIRGenerator::nextVariableName() {
+        if (globalCtx.shouldDiscardValueNames()) return "";
+        return "Variable" + std::to_string(++numVariables);
+    }
+
+    std::string LLVMIRGenerator::nextBasicBlockName() {
+        if (globalCtx.shouldDiscardValueNames()) return "";
+        return "BasicBlock" + std::to_string(++numBasicBlocks);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,193 @@
+#include "Liveness.h"
+#include "VCalcParser.h"
+
+namespace vcalc {
+    Liveness::Liveness() : marking(true) { }
+
+    void Liveness::visit(std::shared_ptr<AST> t) {
+        if ( t->isNil() ) {
+            collectAliases(t);
+            visitStatements(t);
+        } else {
+            switch ( t->getNodeType() ) {
+                case VCalcParser::BLOCK_TOKEN:
+                    visitStatements(t);
+                    break;
+                case VCalcParser::VAR_DECLARATION_TOKEN:
+                    visitVAR_DECLARATION_TOKEN(t);
+                    break;
+                case VCalcParser::ASSIGNMENT_TOKEN:
+                    visitASSIGNMENT_TOKEN(t);
+                    break;
+                case VCalcParser::PRINT_TOKEN:
+                    visitPRINT_TOKEN(t);
+                    break;
+                case VCalcParser::CONDITIONAL_TOKEN:
+                    visitCONDITIONAL_TOKEN(t);
+                    break;
+                case VCalcParser::LOOP_TOKEN:
+                    visitLOOP_TOKEN(t);
+                    break;
+                default: // Only statements change the live set
+                    break;
+            }
+        }
+    }
+
+    void Liveness::visitStatements(std::shared_ptr<AST> t) {
+        // Walk backwards so that `live` always holds the symbols read after the statement
+        for (auto iter = t->children.rbegin(); iter != t->children.rend(); iter++) {
+            visit(*iter);
+        }
+    }
+
+    /* ^(VAR_DECLARATION_TOKEN type ID expression) */
+    void Liveness::visitVAR_DECLARATION_TOKEN(std::shared_ptr<AST> t) {
+        live.erase(t->symbol);
+        useExpression(t->children[2]);
+    }
+
+    /* ^(ASSIGNMENT_TOKEN ID expression) */
+    void Liveness::visitASSIGNMENT_TOKEN(std::shared_ptr<AST> t) {
+        // The old value is overwritten, so `v = v + 1` may reuse v's buffer
+        live.erase(t->symbol);
+        useExpression(t->children[1]);
+    }
+
+    void Liveness::visitPRINT_TOKEN(std::shared_ptr<AST> t) {
+        useExpression(t->children[0]);
+    }
+
+    /* ^(CONDITIONAL_TOKEN expression block) */
+    void Liveness::visitCONDITIONAL_TOKEN(std::shared_ptr<AST> t) {
+        std::set<std::shared_ptr<Symbol>> liveOut = live;
+        visit(t->children[1]);
+        live.insert(liveOut.begin(), liveOut.end()); // The block may be skipped
+        useExpression(t->children[0]);
+    }
+
+    /* ^(LOOP_TOKEN expression block) */
+    void Liveness::visitLOOP_TOKEN(std::shared_ptr<AST> t) {
+        std::set<std::shared_ptr<Symbol>> liveOut = live;
+        std::set<std::shared_ptr<Symbol>> head = liveOut;
+        collectUses(t->children[0], head);
+
+        // Iterate the body until the set live at the loop head stops growing
+        bool wasMarking = marking;
+        marking = false;
+        while (true) {
+            live = head;
+            visit(t->children[1]);
+            std::set<std::shared_ptr<Symbol>> next = liveOut;
+            collectUses(t->children[0], next);
+            next.insert(live.begin(), live.end());
+            if (next == head) break;
+            head = next;
+        }
+        marking = wasMarking;
+
+        // Mark the body once against the fixpoint
+        live = head;
+        visit(t->children[1]);
+        live = head;
+        useExpression(t->children[0]);
+    }
+
+    void Liveness::useExpression(std::shared_ptr<AST> t) {
+        if (marking) {
+            statementRefs.clear();
+            countRefs(t);
+            markExpression(t);
+        }
+        collectUses(t, live);
+    }
+
+    void Liveness::collectAliases(std::shared_ptr<AST> t) {
+        // `vector s = v[a..b];` points s into v's buffer, so neither may be overwritten in place.
+        // Plain `vector b = a;` sharing is handled by the runtime's copy-on-write buffers.
+        std::shared_ptr<AST> value = nullptr;
+        if (!t->isNil() && t->getNodeType() == VCalcParser::VAR_DECLARATION_TOKEN) {
+            value = t->children[2];
+        } else if (!t->isNil() && t->getNodeType() == VCalcParser::ASSIGNMENT_TOKEN) {
+            value = t->children[1];
+        }
+        if (value && t->symbol && t->symbol->type->getName() == "vector") {
+            std::shared_ptr<AST> source = stripWrappers(value);
+            if (source->getNodeType() == VCalcParser::INDEX_TOKEN && source->isSlice) {
+                aliased.insert(t->symbol);
+                source = stripWrappers(source->children[0]);
+                if (source->getNodeType() == VCalcParser::ID && source->symbol) aliased.insert(source->symbol);
+            }
+        }
+        for ( auto child : t->children ) collectAliases(child);
+    }
+
+    void Liveness::collectUses(std::shared_ptr<AST> t, std::set<std::shared_ptr<Symbol>> &uses) {
+        if (!t->isNil() && t->getNodeType() == VCalcParser::ID && t->symbol) {
+            uses.insert(t->symbol);
+        }
+        for ( auto child : t->children ) collectUses(child, uses);
+    }
+
+    void Liveness::countRefs(std::shared_ptr<AST> t) {
+        if (!t->isNil() && t->getNodeType() == VCalcParser::ID && t->symbol) {
+            statementRefs[t->symbol]++;
+        }
+        for ( auto child : t->children ) countRefs(child);
+    }
+
+    std::shared_ptr<AST> Liveness::stripWrappers(std::shared_ptr<AST> t) {
+        while (!t->isNil() && (t->getNodeType() == VCalcParser::EXPR_TOKEN || t->getNodeType() == VCalcParser::PARENTHESIS_TOKEN)) {
+            t = t->children[0];
+        }
+        return t;
+    }
+
+    bool Liveness::isVector(std::shared_ptr<AST> t) {
+        return t->evalType && t->evalType->getName() == "vector";
+    }
+
+    bool Liveness::isDead(std::shared_ptr<AST> operand) {
+        std::shared_ptr<AST> node = stripWrappers(operand);
+        if (node->getNodeType() == VCalcParser::ID) {
+            return node->isLastUse;
+        }
+        // Any other vector-valued node except a slice is a temporary nobody else can observe
+        return isVector(node) && !node->isSlice;
+    }
+
+    void Liveness::markExpression(std::shared_ptr<AST> t) {
+        for ( auto child : t->children ) markExpression(child);
+        if (t->isNil()) return;
+
+        switch ( t->getNodeType() ) {
+            case VCalcParser::ID:
+                // A vector read exactly once in a statement and never after it is dead once consumed
+                if (t->symbol && isVector(t) && !live.count(t->symbol) && !aliased.count(t->symbol) && statementRefs[t->symbol] == 1) {
+                    t->isLastUse = true;
+                }
+                break;
+            case VCalcParser::ADD:
+            case VCalcParser::SUB:
+            case VCalcParser::MUL:
+            case VCalcParser::DIV:
+            case VCalcParser::GREATERTHAN:
+            case VCalcParser::LESSTHAN:
+            case VCalcParser::ISEQUAL:
+            case VCalcParser::ISNOTEQUAL:
+                if (isVector(t)) {
+                    // The result takes the length of its first vector operand, so only that one can host it
+                    std::shared_ptr<AST> candidate = isVector(t->children[0]) ? t->children[0] : t->children[1];
+                    if (isDead(candidate)) t->reuseOperand = stripWrappers(candidate);
+                }
+                break;
+            case VCalcParser::GENERATOR_TOKEN:
+                // Element i of the result only depends on element i of the domain. Filters are left alone
+                // since a vector's length is the size of its buffer and a filter's result is shorter.
+                if (isDead(t->children[1])) t->reuseOperand = stripWrappers(t->children[1]);
+                break;
+            default:
+                break;
+        }
+    }
+}
@@ -0,0 +1,183 @@
+#include "LoopInvariantHoisting.h"
+#include "VCalcParser.h"
+
+#include <cstdint>
+
+namespace vcalc {
+    LoopInvariantHoisting::LoopInvariantHoisting() { }
+
+    void LoopInvariantHoisting::visit(std::shared_ptr<AST> t) {
+        if ( t->isNil() ) {
+            visitChildren(t);
+        } else {
+            switch ( t->getNodeType() ) {
+                case VCalcParser::LOOP_TOKEN:
+                    visitLOOP_TOKEN(t);
+                    break;
+                case VCalcParser::CONDITIONAL_TOKEN:
+                case VCalcParser::BLOCK_TOKEN:
+                    visitChildren(t);
+                    break;
+                default: // Loops are statements, so expressions need no visit
+                    break;
+            }
+        }
+    }
+
+    void LoopInvariantHoisting::visitChildren(std::shared_ptr<AST> t) {
+        for ( auto child : t->children ) visit(child);
+    }
+
+    /* ^(LOOP_TOKEN expression block) */
+    void LoopInvariantHoisting::visitLOOP_TOKEN(std::shared_ptr<AST> t) {
+        std::set<std::shared_ptr<Symbol>> varying;
+        collectVarying(t, varying);
+        hoist(t->children[0], varying, t->loopInvariants);
+        hoistStatements(t->children[1], varying, t->loopInvariants);
+        keepInvariantsIntact(t);
+        visit(t->children[1]);  // Inner loops then hoist what is invariant in them alone
+    }
+
+    void LoopInvariantHoisting::collectVarying(std::shared_ptr<AST> t, std::set<std::shared_ptr<Symbol>> &varying) {
+        // The symbols DefRef resolved the loop's declarations and assignments to, and the vectors
+        // Liveness lets a result overwrite in place
+        if (!t->isNil() && (t->getNodeType() == VCalcParser::VAR_DECLARATION_TOKEN || t->getNodeType() == VCalcParser::ASSIGNMENT_TOKEN) && t->symbol) {
+            varying.insert(t->symbol);
+        }
+        if (!t->isNil() && t->reuseOperand && t->reuseOperand->getNodeType() == VCalcParser::ID && t->reuseOperand->symbol) {
+            varying.insert(t->reuseOperand->symbol);
+        }
+        for ( auto child : t->children ) collectVarying(child, varying);
+    }
+
+    void LoopInvariantHoisting::hoistStatements(std::shared_ptr<AST> block, std::set<std::shared_ptr<Symbol>> &varying, std::vector<std::shared_ptr<AST>> &invariants) {
+        // Statements in nested blocks may not run on every iteration, but what is hoisted cannot fail
+        for ( auto statement : block->children ) {
+            switch ( statement->getNodeType() ) {
+                case VCalcParser::VAR_DECLARATION_TOKEN:
+                    hoist(statement->children[2], varying, invariants);
+                    break;
+                case VCalcParser::ASSIGNMENT_TOKEN:
+                    hoist(statement->children[1], varying, invariants);
+                    break;
+                case VCalcParser::PRINT_TOKEN:
+                    hoist(statement->children[0], varying, invariants);
+                    break;
+                case VCalcParser::CONDITIONAL_TOKEN:
+                case VCalcParser::LOOP_TOKEN:
+                    hoist(statement->children[0], varying, invariants);
+                    hoistStatements(statement->children[1], varying, invariants);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    void LoopInvariantHoisting::hoist(std::shared_ptr<AST> t, std::set<std::shared_ptr<Symbol>> &varying, std::vector<std::shared_ptr<AST>> &invariants) {
+        // The largest invariant expressions; their parts are built along with them
+        if (t->isLoopInvariant) return;
+        if (isCandidate(t) && isInvariant(t, varying) && isSafe(t)) {
+            t->isLoopInvariant = true;
+            invariants.push_back(t);
+            return;
+        }
+        if (t->isProgression) return;  // Its domain is never built
+        switch ( t->getNodeType() ) {
+            case VCalcParser::SUM:
+            case VCalcParser::MIN:
+            case VCalcParser::MAX:
+            case VCalcParser::COUNT: {
+                // Reducing a progression is a closed form, cheaper than a hoisted buffer
+                std::shared_ptr<AST> operand = t->children[0]->children[0];
+                while (operand->getNodeType() == VCalcParser::PARENTHESIS_TOKEN) operand = operand->children[0];
+                if (!operand->isProgression) hoist(t->children[0], varying, invariants);
+                break;
+            }
+            case VCalcParser::GENERATOR_TOKEN:
+            case VCalcParser::FILTER_TOKEN:
+                // The domain variable takes a new value for every element
+                hoist(t->children[1], varying, invariants);
+                varying.insert(t->children[0]->symbol);
+                hoist(t->children[2], varying, invariants);
+                varying.erase(t->children[0]->symbol);
+                break;
+            case VCalcParser::MATRIX_GENERATOR_TOKEN:
+                hoist(t->children[1], varying, invariants);
+                hoist(t->children[3], varying, invariants);
+                varying.insert(t->children[0]->symbol);
+                varying.insert(t->children[2]->symbol);
+                hoist(t->children[4], varying, invariants);
+                varying.erase(t->children[0]->symbol);
+                varying.erase(t->children[2]->symbol);
+                break;
+            default:
+                for ( auto child : t->children ) hoist(child, varying, invariants);
+        }
+    }
+
+    bool LoopInvariantHoisting::isCandidate(std::shared_ptr<AST> t) {
+        // Vectors codegen allocates and fills; names and slices already share a buffer
+        if (!t->evalType || t->evalType->getName() != "vector") return false;
+        switch ( t->getNodeType() ) {
+            case VCalcParser::RANGE:
+            case VCalcParser::GENERATOR_TOKEN:
+            case VCalcParser::FILTER_TOKEN:
+            case VCalcParser::ADD:
+            case VCalcParser::SUB:
+            case VCalcParser::MUL:
+            case VCalcParser::DIV:
+            case VCalcParser::GREATERTHAN:
+            case VCalcParser::LESSTHAN:
+            case VCalcParser::ISEQUAL:
+            case VCalcParser::ISNOTEQUAL:
+                return true;
+            case VCalcParser::INDEX_TOKEN:
+                return !t->isSlice;
+            default:
+                return false;
+        }
+    }
+
+    bool LoopInvariantHoisting::isInvariant(std::shared_ptr<AST> t, const std::set<std::shared_ptr<Symbol>> &varying) {
+        if (t->getNodeType() == VCalcParser::ID && t->symbol && varying.count(t->symbol)) return false;
+        for ( auto child : t->children ) {
+            if (!isInvariant(child, varying)) return false;
+        }
+        return true;
+    }
+
+    bool LoopInvariantHoisting::isSafe(std::shared_ptr<AST> t) {
+        // Nothing in it may report an error
+        if (t->evalType && t->evalType->getName() == "matrix") return false;  // Shapes may not match
+        switch ( t->getNodeType() ) {
+            case VCalcParser::DIV: {
+                ValueRange divisor = t->children[1]->range;
+                if (divisor.contains(ValueRange::exactly(0))) return false;
+                if (divisor.contains(ValueRange::exactly(-1)) && t->children[0]->range.contains(ValueRange::exactly(INT32_MIN))) return false;
+                break;
+            }
+            case VCalcParser::INDEX_TOKEN:
+                if (!t->indexInBounds) return false;
+                break;
+            case VCalcParser::MATRIX_INDEX_TOKEN:
+                return false;
+            case VCalcParser::MIN:
+            case VCalcParser::MAX:
+                if (t->children[0]->evalType->getName() != "int" && t->children[0]->lengthRange.low < 1) return false;
+                break;
+            default:
+                break;
+        }
+        for ( auto child : t->children ) {
+            if (!isSafe(child)) return false;
+        }
+        return true;
+    }
+
+    void LoopInvariantHoisting::keepInvariantsIntact(std::shared_ptr<AST> t) {
+        // The buffer is read again on the next iteration, so nothing may overwrite it in place
+        if (t->reuseOperand && t->reuseOperand->isLoopInvariant) t->reuseOperand = nullptr;
+        for ( auto child : t->children ) keepInvariantsIntact(child);
+    }
+}
@@ -0,0 +1,266 @@
+#include "ModuleEmitter.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/MC/SubtargetFeature.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/IPO/Internalize.h"
+
+#include <iostream>
+
+namespace vcalc {
+    ModuleEmitter::ModuleEmitter(const CodegenOptions &options) : options(options) {
+        if (options.output != OUTPUT_OBJECT && options.output != OUTPUT_EXECUTABLE) return;
+
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+        std::string triple = llvm::sys::getProcessTriple();
+        std::string error;
+        const llvm::Target *target = llvm::TargetRegistry::lookupTarget(triple, error);
+        if (!target) {
+            std::cerr << "Cannot target " << triple << ": " << error << "\n";
+            return;
+        }
+
+        // The program only ever runs where it was compiled, so use everything this CPU has
+        llvm::SubtargetFeatures features;
+        llvm::StringMap<bool> hostFeatures;
+        if (llvm::sys::getHostCPUFeatures(hostFeatures)) {
+            for (auto &feature : hostFeatures) features.AddFeature(feature.first(), feature.second);
+        }
+        targetMachine.reset(target->createTargetMachine(triple, llvm::sys::getHostCPUName(), features.getString(), llvm::TargetOptions(),
+                                                        llvm::Reloc::PIC_, llvm::None, options.optimize ? llvm::CodeGenOpt::Aggressive : llvm::CodeGenOpt::None));
+    }
+
+    void ModuleEmitter::optimize(llvm::Module &mod, llvm::TargetMachine *targetMachine) {
+        llvm::LoopAnalysisManager loopAnalyses;
+        llvm::FunctionAnalysisManager functionAnalyses;
+        llvm::CGSCCAnalysisManager cgsccAnalyses;
+        llvm::ModuleAnalysisManager moduleAnalyses;
+        llvm::PassBuilder passBuilder(targetMachine);
+        passBuilder.registerModuleAnalyses(moduleAnalyses);
+        passBuilder.registerCGSCCAnalyses(cgsccAnalyses);
+        passBuilder.registerFunctionAnalyses(functionAnalyses);
+        passBuilder.registerLoopAnalyses(loopAnalyses);
+        passBuilder.crossRegisterProxies(loopAnalyses, functionAnalyses, cgsccAnalyses, moduleAnalyses);
+        passBuilder.buildPerModuleDefaultPipeline(llvm::PassBuilder::OptimizationLevel::O2).run(mod, moduleAnalyses);
+    }
+
+    bool ModuleEmitter::createTemporaryObject(std::string &objectFileName) {
+        llvm::SmallString<128> name;
+        if (llvm::sys::fs::createTemporaryFile("vcalc", "o", name)) {
+            std::cerr << "Cannot create a temporary object file\n";
+            return false;
+        }
+        objectFileName = std::string(name);
+        return true;
+    }
+
+    void ModuleEmitter::collectUndefined(llvm::Module &mod, std::set<std::string> &names) {
+        for (llvm::Function &function : mod) {
+            if (function.isDeclaration() && !function.isIntrinsic()) names.insert(function.getName().str());
+        }
+        for (llvm::GlobalVariable &global : mod.globals()) {
+            if (global.isDeclaration()) names.insert(global.getName().str());
+        }
+    }
+
+    bool ModuleEmitter::prepare(llvm::Module &mod) {
+        if (targetMachine) {
+            mod.setTargetTriple(targetMachine->getTargetTriple().str());
+            mod.setDataLayout(targetMachine->createDataLayout());
+        } else if (options.output == OUTPUT_OBJECT || options.output == OUTPUT_EXECUTABLE) {
+            return false;  // Already reported by the constructor
+        }
+        if (!options.optimize) return true;
+        linkRuntime(mod, true);  // Without it the calls are simply not inlined
+        optimize(mod, targetMachine.get());
+        return true;
+    }
+
+    bool ModuleEmitter::emit(llvm::Module &mod, const std::string &outputFileName, bool optimized) {
+        // Read before the inliner copies runtime functions in, so that the runtime object has everything the copies use
+        std::set<std::string> undefined;
+        collectUndefined(mod, undefined);
+        if (!optimized && !prepare(mod)) return false;
+
+        if (options.output == OUTPUT_OBJECT || options.output == OUTPUT_EXECUTABLE) {
+            // The program and the runtime functions it calls, an object each, linked together
+            std::string objectFileName, runtimeObjectFileName;
+            if (!createTemporaryObject(objectFileName)) return false;
+            bool runtimeLinked = !options.runtimeBitcode.empty() && createTemporaryObject(runtimeObjectFileName)
+                && writeRuntimeObject(undefined, runtimeObjectFileName);
+            std::vector<std::string> objectFileNames = { objectFileName };
+            if (runtimeLinked) objectFileNames.push_back(runtimeObjectFileName);
+            bool done = writeObject(mod, objectFileName) && linkObjects(objectFileNames, outputFileName, runtimeLinked);
+            llvm::sys::fs::remove(objectFileName);
+            if (!runtimeObjectFileName.empty()) llvm::sys::fs::remove(runtimeObjectFileName);
+            return done;
+        }
+
+        // Bitcode holds the whole program, so what the inliner left of the runtime comes along too
+        if (options.output == OUTPUT_BITCODE) linkRuntime(mod, false);
+        std::error_code errorCode;
+        llvm::raw_fd_ostream out(outputFileName, errorCode);
+        if (errorCode) {
+            std::cerr << "Cannot open " << outputFileName << ": " << errorCode.message() << "\n";
+            return false;
+        }
+        if (options.output == OUTPUT_BITCODE) {
+            llvm::WriteBitcodeToFile(mod, out);
+        } else {
+            mod.print(out, nullptr);
+        }
+        return true;
+    }
+
+    std::unique_ptr<llvm::Module> ModuleEmitter::loadRuntime(llvm::LLVMContext &ctx) {
+        auto buffer = llvm::MemoryBuffer::getFile(options.runtimeBitcode);
+        if (!buffer) {
+            std::cerr << "Cannot read " << options.runtimeBitcode << ": " << buffer.getError().message() << "\n";
+            return nullptr;
+        }
+        auto runtime = llvm::parseBitcodeFile((*buffer)->getMemBufferRef(), ctx);
+        if (!runtime) {
+            std::cerr << "Cannot read " << options.runtimeBitcode << ": " << llvm::toString(runtime.takeError()) << "\n";
+            return nullptr;
+        }
+        // Every module gets copies of the runtime functions it calls, and the copies must share the runtime's
+        // state: its mutable statics become hidden globals, named the same wherever the bitcode is loaded
+        for (llvm::GlobalVariable &global : (*runtime)->globals()) {
+            if (!global.hasLocalLinkage() || global.isConstant()) continue;
+            std::string name = "vcalcrt." + global.getName().str();
+            global.setName(name);
+            global.setLinkage(llvm::GlobalValue::ExternalLinkage);
+            global.setVisibility(llvm::GlobalValue::HiddenVisibility);
+        }
+        return std::move(*runtime);
+    }
+
+    bool ModuleEmitter::linkRuntime(llvm::Module &mod, bool inlineOnly) {
+        if (options.runtimeBitcode.empty()) return false;
+        std::unique_ptr<llvm::Module> runtime = loadRuntime(mod.getContext());
+        if (!runtime) return false;
+        runtime->setTargetTriple(mod.getTargetTriple());
+        runtime->setDataLayout(mod.getDataLayout());
+
+        // Definitions survive linking, so they tell the program's own globals from the ones the runtime brings
+        std::set<llvm::GlobalValue *> programDefinitions;
+        for (llvm::Function &function : mod) {
+            if (!function.isDeclaration()) programDefinitions.insert(&function);
+        }
+        for (llvm::GlobalVariable &global : mod.globals()) {
+            if (!global.isDeclaration()) programDefinitions.insert(&global);
+        }
+
+        // Only the runtime functions the program calls come along
+        if (llvm::Linker::linkModules(mod, std::move(runtime), llvm::Linker::LinkOnlyNeeded)) {
+            std::cerr << "Cannot link " << options.runtimeBitcode << "\n";
+            return false;
+        }
+        if (!inlineOnly) {
+            // Nothing outside the program calls into the runtime now, so the inliner may drop whatever it has fully inlined
+            llvm::internalizeModule(mod, [&](const llvm::GlobalValue &value) { return value.getName() == options.entryName; });
+            return true;
+        }
+
+        // The copies are only for the inliner. The calls it leaves, and the runtime's state, resolve to the runtime object.
+        for (llvm::Function &function : mod) {
+            if (function.isDeclaration() || function.hasLocalLinkage() || programDefinitions.count(&function)) continue;
+            function.setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+        }
+        for (llvm::GlobalVariable &global : mod.globals()) {
+            if (global.isDeclaration() || programDefinitions.count(&global)) continue;
+            if (global.hasLocalLinkage() && global.isConstant()) continue;  // Constant data may be copied freely
+            global.setInitializer(nullptr);
+            global.setLinkage(llvm::GlobalValue::ExternalLinkage);
+        }
+        return true;
+    }
+
+    bool ModuleEmitter::writeObject(llvm::Module &mod, const std::string &objectFileName) {
+        std::error_code errorCode;
+        llvm::raw_fd_ostream out(objectFileName, errorCode, llvm::sys::fs::OF_None);
+        if (errorCode) {
+            std::cerr << "Cannot open " << objectFileName << ": " << errorCode.message() << "\n";
+            return false;
+        }
+        llvm::legacy::PassManager passes;
+        if (targetMachine->addPassesToEmitFile(passes, out, nullptr, llvm::CGFT_ObjectFile)) {
+            std::cerr << "Cannot emit an object file for " << mod.getTargetTriple() << "\n";
+            return false;
+        }
+        passes.run(mod);
+        return true;
+    }
+
+    bool ModuleEmitter::writeRuntimeObject(const std::set<std::string> &names, const std::string &objectFileName) {
+        if (!targetMachine) return false;
+        llvm::LLVMContext ctx;
+        std::unique_ptr<llvm::Module> runtime = loadRuntime(ctx);
+        if (!runtime) return false;
+
+        // Only what the program uses, and whatever that uses in turn
+        llvm::Module used("vcalcrt", ctx);
+        used.setTargetTriple(targetMachine->getTargetTriple().str());
+        used.setDataLayout(targetMachine->createDataLayout());
+        runtime->setTargetTriple(used.getTargetTriple());
+        runtime->setDataLayout(used.getDataLayout());
+        for (const std::string &name : names) {
+            if (llvm::Function *function = runtime->getFunction(name)) {
+                if (!function->isDeclaration()) used.getOrInsertFunction(name, function->getFunctionType());
+            } else if (llvm::GlobalVariable *global = runtime->getGlobalVariable(name)) {
+                if (!global->isDeclaration()) used.getOrInsertGlobal(name, global->getValueType());
+            }
+        }
+        if (llvm::Linker::linkModules(used, std::move(runtime), llvm::Linker::LinkOnlyNeeded)) {
+            std::cerr << "Cannot link " << options.runtimeBitcode << "\n";
+            return false;
+        }
+        if (options.optimize) optimize(used, targetMachine.get());
+        return writeObject(used, objectFileName);
+    }
+
+    bool ModuleEmitter::linkObjects(const std::vector<std::string> &objectFileNames, const std::string &outputFileName, bool runtimeLinked) {
+        auto compiler = llvm::sys::findProgramByName("cc");
+        if (!compiler) {
+            std::cerr << "Cannot find cc to link " << outputFileName << "\n";
+            return false;
+        }
+        std::vector<std::string> args = { *compiler };
+        args.insert(args.end(), objectFileNames.begin(), objectFileNames.end());
+        args.push_back("-o");
+        args.push_back(outputFileName);
+        if (options.output == OUTPUT_OBJECT) {
+            // A relocatable link: one object out of several, still to be linked into a program
+            args.push_back("-r");
+            args.push_back("-nostdlib");
+        } else {
+            args.push_back("-lpthread");
+            if (!runtimeLinked) {
+                // No bitcode to compile, so call into the shared library where it sits
+                std::string runtimeDir(llvm::sys::path::parent_path(options.runtimeLibrary));
+                args.push_back(options.runtimeLibrary);
+                args.push_back("-Wl,-rpath," + runtimeDir);
+            }
+        }
+        std::vector<llvm::StringRef> argRefs(args.begin(), args.end());
+        std::string error;
+        if (llvm::sys::ExecuteAndWait(*compiler, argRefs, llvm::None, {}, 0, 0, &error) != 0) {
+            std::cerr << "Cannot link " << outputFileName << (error.empty() ? "" : ": " + error) << "\n";
+            return false;
+        }
+        return true;
+    }
+}
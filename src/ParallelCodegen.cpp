@@ -0,0 +1,346 @@
+#include "ParallelCodegen.h"
+
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "ModuleEmitter.h"
+#include "ValueNumbering.h"
+#include "VCalcParser.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+namespace vcalc {
+    // Smaller partitions cost more in cross-module loads than they win back in parallelism
+    static const size_t MIN_PARTITION_NODES = 512;
+
+    // Extra partitions per thread so that uneven partitions still balance out
+    static const unsigned PARTITIONS_PER_JOB = 4;
+
+    // Profiled statements quicker than this cost less run inline than handed to another thread
+    static const int64_t MIN_TASK_NS = 50000;
+
+    ParallelCodegen::ParallelCodegen(std::shared_ptr<SymbolTable> symtab, const CodegenOptions &options, unsigned jobs)
+        // The profiler keeps one stack of open regions, which concurrent statements would interleave
+        : symtab(symtab), options(options), jobs(std::max(jobs, 1u)), tasks(options.tasks && !options.profile), numGlobals(0) { }
+
+    bool ParallelCodegen::isGlobal(std::shared_ptr<Symbol> sym) {
+        return sym && symtab->globals->resolve(sym->getName()) == sym;
+    }
+
+    size_t ParallelCodegen::countNodes(std::shared_ptr<AST> t) {
+        size_t count = 1;
+        for ( auto child : t->children ) count += countNodes(child);
+        return count;
+    }
+
+    bool ParallelCodegen::worksOnVectors(std::shared_ptr<AST> t) {
+        // Statements that only compute ints are too cheap to be worth a task of their own
+        if (!t->isNil() && t->evalType && t->evalType->getName() != "int") return true;
+        if (!t->isNil() && t->symbol && t->symbol->type && t->symbol->type->getName() != "int") return true;
+        for ( auto child : t->children ) {
+            if (worksOnVectors(child)) return true;
+        }
+        return false;
+    }
+
+    bool ParallelCodegen::isCheap(std::shared_ptr<AST> t) {
+        if (!options.profileData) return false;
+        int64_t ns = options.profileData->averageNs(t->getLine(), LLVMIRGenerator::PROFILE_STATEMENT);
+        return ns >= 0 && ns < MIN_TASK_NS;
+    }
+
+    bool ParallelCodegen::containsPrint(std::shared_ptr<AST> t) {
+        if (!t->isNil() && t->getNodeType() == VCalcParser::PRINT_TOKEN) return true;
+        for ( auto child : t->children ) {
+            if (containsPrint(child)) return true;
+        }
+        return false;
+    }
+
+    void ParallelCodegen::collectAssigned(std::shared_ptr<AST> t, std::set<std::shared_ptr<Symbol>> &assigned) {
+        if (!t->isNil() && (t->getNodeType() == VCalcParser::VAR_DECLARATION_TOKEN || t->getNodeType() == VCalcParser::ASSIGNMENT_TOKEN) && isGlobal(t->symbol)) {
+            assigned.insert(t->symbol);
+        }
+        for ( auto child : t->children ) collectAssigned(child, assigned);
+    }
+
+    void ParallelCodegen::collectClobbered(std::shared_ptr<AST> t, std::set<std::shared_ptr<Symbol>> &clobbered) {
+        // A vector Liveness lets a result overwrite is written to, though it is never assigned
+        if (!t->isNil() && t->reuseOperand && t->reuseOperand->getNodeType() == VCalcParser::ID && t->reuseOperand->symbol) {
+            clobbered.insert(t->reuseOperand->symbol);
+        }
+        for ( auto child : t->children ) collectClobbered(child, clobbered);
+    }
+
+    void ParallelCodegen::collectReferences(std::shared_ptr<AST> t, std::set<std::shared_ptr<Symbol>> &refs) {
+        if (!t->isNil() && (t->getNodeType() == VCalcParser::ID || t->getNodeType() == VCalcParser::ASSIGNMENT_TOKEN) && t->symbol) {
+            refs.insert(t->symbol);
+        }
+        for ( auto child : t->children ) collectReferences(child, refs);
+    }
+
+    void ParallelCodegen::collectBindings(std::shared_ptr<AST> t, std::vector<std::shared_ptr<Symbol>> &bound) {
+        std::set<std::shared_ptr<Symbol>> assigned;
+        collectAssigned(t, assigned);
+        bound.assign(assigned.begin(), assigned.end());
+    }
+
+    std::vector<ParallelCodegen::Partition> ParallelCodegen::partition(std::shared_ptr<AST> ast) {
+        size_t total = 0;
+        for ( auto statement : ast->children ) total += countNodes(statement);
+        size_t target = jobs == 1 ? total + 1 : std::max(MIN_PARTITION_NODES, total / (jobs * PARTITIONS_PER_JOB) + 1);
+
+        std::vector<Partition> partitions;
+        Partition current = { std::make_shared<AST>(), {} };
+        size_t currentNodes = 0;
+        std::map<std::shared_ptr<Symbol>, int32_t> lengths;
+        std::set<std::shared_ptr<Symbol>> inexact;  // Vectors whose length is only known at runtime
+        bool currentLight = false;
+        for ( auto statement : ast->children ) {
+            if (tasks) {
+                // A task per statement that works on vectors; runs of int-only statements share one,
+                // as do statements a profiled run found quick
+                bool light = !worksOnVectors(statement) || isCheap(statement);
+                if (!current.statements->children.empty() && !(light && currentLight)) {
+                    partitions.push_back(current);
+                    current = { std::make_shared<AST>(), lengths };
+                    currentNodes = 0;
+                }
+                currentLight = light;
+            }
+            current.statements->addChild(statement);
+            currentNodes += countNodes(statement);
+
+            std::set<std::shared_ptr<Symbol>> assigned;
+            collectAssigned(statement, assigned);
+            for (auto sym : assigned) {
+                if (sym->type->getName() == "matrix") {
+                    // Shapes are not tracked across partitions, so a matrix keeps later statements together
+                    inexact.insert(sym);
+                    continue;
+                }
+                if (sym->type->getName() != "vector") continue;
+                // Only a top-level binding pins the length; one inside a block may or may not run
+                bool topLevel = statement->getNodeType() == VCalcParser::VAR_DECLARATION_TOKEN || statement->getNodeType() == VCalcParser::ASSIGNMENT_TOKEN;
+                std::shared_ptr<AST> value = topLevel ? statement->children.back() : nullptr;
+                if (value && value->lengthRange.isExact()) {
+                    inexact.erase(sym);
+                    lengths[sym] = value->lengthRange.low;
+                } else {
+                    inexact.insert(sym);
+                    lengths.erase(sym);
+                }
+            }
+
+            if (!tasks && currentNodes >= target && inexact.empty()) {
+                partitions.push_back(current);
+                current = { std::make_shared<AST>(), lengths };
+                currentNodes = 0;
+            }
+        }
+        if (!current.statements->children.empty()) partitions.push_back(current);
+        return partitions;
+    }
+
+    std::vector<std::vector<size_t>> ParallelCodegen::dependencies(const std::vector<Partition> &partitions) {
+        // A task waits for an earlier one that writes a variable it touches or touches one it writes.
+        // Printing waits for everything before it, since any earlier statement may stop the program.
+        std::vector<std::set<std::shared_ptr<Symbol>>> reads(partitions.size());
+        std::vector<std::set<std::shared_ptr<Symbol>>> writes(partitions.size());
+        std::vector<std::vector<size_t>> dependsOn(partitions.size());
+        for (size_t i = 0; i < partitions.size(); i++) {
+            collectReferences(partitions[i].statements, reads[i]);
+            collectAssigned(partitions[i].statements, writes[i]);
+            collectClobbered(partitions[i].statements, writes[i]);
+            bool prints = containsPrint(partitions[i].statements);
+            for (size_t j = 0; j < i; j++) {
+                auto overlaps = [](const std::set<std::shared_ptr<Symbol>> &a, const std::set<std::shared_ptr<Symbol>> &b) {
+                    for (auto sym : a) {
+                        if (b.count(sym)) return true;
+                    }
+                    return false;
+                };
+                if (prints || overlaps(writes[j], reads[i]) || overlaps(writes[j], writes[i]) || overlaps(reads[j], writes[i])) {
+                    dependsOn[i].push_back(j);
+                }
+            }
+        }
+        return dependsOn;
+    }
+
+    void ParallelCodegen::createTaskLaunch(llvm::Module &mod, llvm::IRBuilder<> &ir, const std::vector<Partition> &partitions) {
+        // vcalcRunTasks(count, tasks, firstDependency, dependencies), with the graph as constant arrays
+        llvm::Type *intTy = ir.getInt32Ty();
+        llvm::FunctionType *partitionTy = llvm::FunctionType::get(ir.getVoidTy(), false);
+        llvm::PointerType *taskTy = partitionTy->getPointerTo();
+        std::vector<llvm::Constant *> taskFunctions, firstDependency, dependsOn;
+        std::vector<std::vector<size_t>> graph = dependencies(partitions);
+        for (size_t i = 0; i < partitions.size(); i++) {
+            taskFunctions.push_back(llvm::cast<llvm::Constant>(mod.getOrInsertFunction("vcalc.partition" + std::to_string(i), partitionTy).getCallee()));
+            firstDependency.push_back(llvm::ConstantInt::get(intTy, dependsOn.size(), true));
+            for (size_t j : graph[i]) dependsOn.push_back(llvm::ConstantInt::get(intTy, j, true));
+        }
+        firstDependency.push_back(llvm::ConstantInt::get(intTy, dependsOn.size(), true));
+
+        auto constantArray = [&](llvm::Type *elementTy, const std::vector<llvm::Constant *> &elements, const std::string &name) {
+            llvm::ArrayType *arrayTy = llvm::ArrayType::get(elementTy, elements.size());
+            llvm::GlobalVariable *array = new llvm::GlobalVariable(mod, arrayTy, true, llvm::GlobalValue::PrivateLinkage, llvm::ConstantArray::get(arrayTy, elements), name);
+            return ir.CreateConstInBoundsGEP2_32(arrayTy, array, 0, 0);
+        };
+        llvm::FunctionCallee runTasks = mod.getOrInsertFunction(
+            "vcalcRunTasks",
+            llvm::FunctionType::get(ir.getVoidTy(), { intTy, taskTy->getPointerTo(), intTy->getPointerTo(), intTy->getPointerTo() }, false)
+        );
+        ir.CreateCall(runTasks, {
+            llvm::ConstantInt::get(intTy, partitions.size(), true),
+            constantArray(taskTy, taskFunctions, "vcalc.tasks"),
+            constantArray(intTy, firstDependency, "vcalc.tasks.first"),
+            constantArray(intTy, dependsOn, "vcalc.tasks.dependencies")
+        });
+    }
+
+    llvm::orc::ThreadSafeModule ParallelCodegen::generateMain(const std::vector<Partition> &partitions) {
+        // main has a module of its own, which only declares the partitions it runs
+        auto ctx = std::make_unique<llvm::LLVMContext>();
+        ctx->setDiscardValueNames(!options.debugInfo);
+        auto mod = std::make_unique<llvm::Module>("vcalc", *ctx);
+        llvm::IRBuilder<> ir(*ctx);
+        llvm::FunctionType *partitionTy = llvm::FunctionType::get(ir.getVoidTy(), false);
+        llvm::Function *mainFunction = llvm::Function::Create(llvm::FunctionType::get(ir.getInt32Ty(), false), llvm::GlobalValue::ExternalLinkage, "main", *mod);
+        ir.SetInsertPoint(llvm::BasicBlock::Create(*ctx, "BasicBlock1", mainFunction));
+        if (tasks && partitions.size() > 1) {
+            createTaskLaunch(*mod, ir, partitions);
+        } else {
+            for (size_t i = 0; i < partitions.size(); i++) {
+                ir.CreateCall(mod->getOrInsertFunction("vcalc.partition" + std::to_string(i), partitionTy));
+            }
+        }
+        ir.CreateRet(ir.getInt32(0));  // Exit status
+        return llvm::orc::ThreadSafeModule(std::move(mod), std::move(ctx));
+    }
+
+    llvm::orc::ThreadSafeModule ParallelCodegen::generate(const Partition &part, const std::string &entryName) {
+        CodegenOptions partitionOptions = options;
+        partitionOptions.entryName = entryName;
+        std::string outputFileName;
+        LLVMIRGenerator generator(outputFileName, partitionOptions);
+
+        std::set<std::shared_ptr<Symbol>> refs;
+        collectReferences(part.statements, refs);
+        for (auto sym : refs) {
+            auto find_s = variables.find(sym);
+            if ( find_s == variables.end() ) continue;
+            if (sym->type->getName() != "int") {
+                // Read the length from its global when it is not known exactly here
+                auto length = part.entryLengths.find(sym);
+                find_s->second.size = length != part.entryLengths.end() ? length->second : -1;
+            }
+            generator.importVariable(sym, find_s->second);
+        }
+        // Reused buffers live in one module, so identical vectors are only looked for within the partition
+        ValueNumbering valueNumbering;
+        valueNumbering.visit(part.statements);
+        generator.visit(part.statements);
+
+        std::vector<std::shared_ptr<Symbol>> bound;
+        collectBindings(part.statements, bound);
+        for (auto sym : bound) {
+            PersistentVariable &var = variables[sym];
+            bool define = var.globalName.empty();  // First bound here
+            if (define) var.globalName = "vcalc." + sym->getName() + "." + std::to_string(++numGlobals);
+            generator.exportVariable(sym, var, define);
+        }
+        generator.finalize();
+        return generator.takeModule();
+    }
+
+    bool ParallelCodegen::run(std::shared_ptr<AST> ast, const std::string &outputFileName) {
+        // IR generation walks the shared AST and symbols, so it stays on this thread
+        std::vector<Partition> partitions = partition(ast);
+        std::vector<llvm::orc::ThreadSafeModule> modules;
+        for (size_t i = 0; i < partitions.size(); i++) {
+            modules.push_back(generate(partitions[i], "vcalc.partition" + std::to_string(i)));
+        }
+        modules.push_back(generateMain(partitions));
+
+        // Native output is an object per module, plus one for the runtime functions they call, linked at the end.
+        // Otherwise the optimized modules come back as bitcode and are linked into one.
+        bool native = options.output == OUTPUT_OBJECT || options.output == OUTPUT_EXECUTABLE;
+        std::atomic<bool> runtimeLinked(native && !options.runtimeBitcode.empty());
+        std::set<std::string> undefined;  // Read before the inliner copies runtime functions in
+        std::vector<std::string> objectFileNames(native ? modules.size() + (runtimeLinked ? 1 : 0) : 0);
+        for (size_t i = 0; i < modules.size(); i++) {
+            if (runtimeLinked) modules[i].withModuleDo([&](llvm::Module &mod) { ModuleEmitter::collectUndefined(mod, undefined); });
+        }
+        for (std::string &objectFileName : objectFileNames) {
+            if (!ModuleEmitter::createTemporaryObject(objectFileName)) {
+                for (const std::string &created : objectFileNames) {
+                    if (!created.empty()) llvm::sys::fs::remove(created);
+                }
+                return false;
+            }
+        }
+
+        // Every module owns its context, so threads can optimize and compile them independently. Each thread
+        // has an emitter of its own, all set up here because setting up the target is not thread-safe.
+        size_t numItems = modules.size() + (runtimeLinked ? 1 : 0);
+        size_t numThreads = std::min<size_t>(jobs, numItems);
+        std::vector<std::unique_ptr<ModuleEmitter>> emitters;
+        for (size_t j = 0; j < numThreads; j++) emitters.push_back(std::make_unique<ModuleEmitter>(options));
+        std::vector<llvm::SmallVector<char, 0>> bitcode(modules.size());
+        std::atomic<size_t> next(0);
+        std::atomic<bool> failed(false);
+        auto worker = [&](ModuleEmitter &emitter) {
+            for (size_t i = next++; i < numItems; i = next++) {
+                if (i == modules.size()) {
+                    // Without the runtime object the program calls into libvcalcrt.so instead
+                    if (!emitter.writeRuntimeObject(undefined, objectFileNames[i])) runtimeLinked = false;
+                    continue;
+                }
+                modules[i].withModuleDo([&](llvm::Module &mod) {
+                    if (!emitter.prepare(mod)) {
+                        failed = true;
+                    } else if (native) {
+                        if (!emitter.writeObject(mod, objectFileNames[i])) failed = true;
+                    } else {
+                        llvm::raw_svector_ostream out(bitcode[i]);
+                        llvm::WriteBitcodeToFile(mod, out);
+                    }
+                });
+            }
+        };
+        std::vector<std::thread> threads;
+        for (size_t j = 1; j < numThreads; j++) threads.emplace_back(worker, std::ref(*emitters[j]));
+        worker(*emitters[0]);
+        for (auto &thread : threads) thread.join();
+
+        if (native) {
+            std::vector<std::string> linkedObjects(objectFileNames.begin(), objectFileNames.begin() + modules.size());
+            if (runtimeLinked) linkedObjects.push_back(objectFileNames.back());
+            bool done = !failed && emitters[0]->linkObjects(linkedObjects, outputFileName, runtimeLinked);
+            for (const std::string &objectFileName : objectFileNames) llvm::sys::fs::remove(objectFileName);
+            return done;
+        }
+        if (failed) return false;
+
+        // Bring the modules back into one context
+        llvm::LLVMContext ctx;
+        ctx.setDiscardValueNames(!options.debugInfo);
+        llvm::Module linked("vcalc", ctx);
+        llvm::Linker linker(linked);
+        for (size_t i = 0; i < bitcode.size(); i++) {
+            auto mod = llvm::parseBitcodeFile(llvm::MemoryBufferRef(llvm::StringRef(bitcode[i].data(), bitcode[i].size()), "partition"), ctx);
+            if (!mod || linker.linkInModule(std::move(*mod))) {
+                std::cerr << "Cannot link partition " << i << "\n";
+                return false;
+            }
+        }
+        return emitters[0]->emit(linked, outputFileName, true);
+    }
+}
@@ -0,0 +1,393 @@
+#include "PartialEvaluator.h"
+#include "VCalcParser.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace vcalc {
+    // Statements, expression nodes and vector elements evaluated before giving up
+    static const uint64_t MAX_STEPS = 100000000;
+
+    // Live vectors plus the output so far. Past this the program is better off computing it at runtime.
+    static const uint64_t MAX_BYTES = 64 << 20;
+
+    // Wall-clock budget for the whole program
+    static const int64_t MAX_MILLISECONDS = 2000;
+
+    // Steps between looks at the clock
+    static const uint64_t CLOCK_INTERVAL = 4096;
+
+    PartialEvaluator::PartialEvaluator() : steps(0), nextClockCheck(0), liveBytes(0), failed(false) { }
+
+    bool PartialEvaluator::run(std::shared_ptr<AST> ast) {
+        variables.clear();
+        output.clear();
+        steps = 0;
+        nextClockCheck = CLOCK_INTERVAL;
+        failed = false;
+        deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(MAX_MILLISECONDS);
+        execute(ast);
+        variables.clear();  // Frees the vectors
+        return !failed;
+    }
+
+    const std::string &PartialEvaluator::getOutput() {
+        return output;
+    }
+
+    bool PartialEvaluator::step(uint64_t count) {
+        steps += count;
+        if (steps > MAX_STEPS) failed = true;
+        if (!failed && steps >= nextClockCheck) {
+            nextClockCheck = steps + CLOCK_INTERVAL;
+            if (std::chrono::steady_clock::now() > deadline) failed = true;
+        }
+        return !failed;
+    }
+
+    PartialEvaluator::Value PartialEvaluator::integer(int32_t value) {
+        Value result;
+        result.scalar = value;
+        return result;
+    }
+
+    PartialEvaluator::Value PartialEvaluator::newVector(size_t size) {
+        // The elements give their bytes back to the budget when the last reference goes
+        Value result;
+        uint64_t bytes = (uint64_t) size * sizeof(int32_t);
+        if (liveBytes + bytes + output.size() > MAX_BYTES) {
+            failed = true;
+            return result;
+        }
+        liveBytes += bytes;
+        result.isVector = true;
+        result.elements = std::shared_ptr<std::vector<int32_t>>(new std::vector<int32_t>(size), [this, bytes](std::vector<int32_t> *elements) {
+            liveBytes -= bytes;
+            delete elements;
+        });
+        return result;
+    }
+
+    void PartialEvaluator::execute(std::shared_ptr<AST> t) {
+        if (failed) return;
+        if (t->isNil()) {
+            for ( auto child : t->children ) execute(child);  // Top-level statements
+            return;
+        }
+        if (!step()) return;
+        switch ( t->getNodeType() ) {
+            case VCalcParser::VAR_DECLARATION_TOKEN:
+                // A declaration without a value has nothing to reproduce
+                if (t->children.size() < 3) {
+                    failed = true;
+                    return;
+                }
+                bind(t, t->children[2]);
+                break;
+            case VCalcParser::ASSIGNMENT_TOKEN:
+                bind(t, t->children[1]);
+                break;
+            case VCalcParser::PRINT_TOKEN: {
+                Value value = evaluate(t->children[0]);
+                if (!failed) print(value);
+                break;
+            }
+            case VCalcParser::CONDITIONAL_TOKEN: {
+                Value condition = evaluate(t->children[0]);
+                if (failed || condition.isVector) {
+                    failed = true;
+                    return;
+                }
+                if (condition.scalar != 0) execute(t->children[1]);
+                break;
+            }
+            case VCalcParser::LOOP_TOKEN:
+                // Every test takes a step, so a loop that never ends runs out of budget
+                while (!failed) {
+                    Value condition = evaluate(t->children[0]);
+                    if (failed || condition.isVector) {
+                        failed = true;
+                        return;
+                    }
+                    if (condition.scalar == 0) break;
+                    execute(t->children[1]);
+                    step();
+                }
+                break;
+            case VCalcParser::BLOCK_TOKEN:
+                for ( auto statement : t->children ) execute(statement);
+                break;
+            default:
+                failed = true;
+        }
+    }
+
+    void PartialEvaluator::bind(std::shared_ptr<AST> t, std::shared_ptr<AST> expression) {
+        // Only ints and vectors whose value matches the declared type; matrices stay with codegen
+        if (!t->symbol || !t->symbol->type) {
+            failed = true;
+            return;
+        }
+        std::string type = t->symbol->type->getName();
+        Value value = evaluate(expression);
+        if (failed || (type != "int" && type != "vector") || value.isVector != (type == "vector")) {
+            failed = true;
+            return;
+        }
+        variables[t->symbol] = value;
+    }
+
+    PartialEvaluator::Value PartialEvaluator::evaluate(std::shared_ptr<AST> t) {
+        if (failed || !step()) return Value();
+        switch ( t->getNodeType() ) {
+            case VCalcParser::EXPR_TOKEN:
+            case VCalcParser::PARENTHESIS_TOKEN:
+                return evaluate(t->children[0]);
+            case VCalcParser::INTEGER:
+                return integer(std::stoi(t->token->getText()));
+            case VCalcParser::ID: {
+                auto found = variables.find(t->symbol);
+                if (!t->symbol || found == variables.end()) break;
+                return found->second;
+            }
+            case VCalcParser::ADD:
+            case VCalcParser::SUB:
+            case VCalcParser::MUL:
+            case VCalcParser::DIV:
+            case VCalcParser::GREATERTHAN:
+            case VCalcParser::LESSTHAN:
+            case VCalcParser::ISEQUAL:
+            case VCalcParser::ISNOTEQUAL:
+                return evaluateBinaryOperation(t);
+            case VCalcParser::SUM:
+            case VCalcParser::MIN:
+            case VCalcParser::MAX:
+            case VCalcParser::COUNT:
+            case VCalcParser::PRODUCT:
+                return evaluateReduction(t);
+            case VCalcParser::RANGE:
+                return evaluateRange(t);
+            case VCalcParser::INDEX_TOKEN:
+                return evaluateIndex(t);
+            case VCalcParser::GENERATOR_TOKEN:
+            case VCalcParser::FILTER_TOKEN:
+                return evaluateGenerator(t);
+            default:  // Matrices
+                break;
+        }
+        failed = true;
+        return Value();
+    }
+
+    bool PartialEvaluator::combine(size_t op, int32_t lhs, int32_t rhs, int32_t &result) {
+        // Arithmetic wraps like the generated code. False where the program would stop with an error.
+        switch (op) {
+            case VCalcParser::ADD:
+                result = (int32_t) ((uint32_t) lhs + (uint32_t) rhs);
+                return true;
+            case VCalcParser::SUB:
+                result = (int32_t) ((uint32_t) lhs - (uint32_t) rhs);
+                return true;
+            case VCalcParser::MUL:
+                result = (int32_t) ((uint32_t) lhs * (uint32_t) rhs);
+                return true;
+            case VCalcParser::DIV:
+                if (rhs == 0 || (lhs == INT32_MIN && rhs == -1)) return false;
+                result = lhs / rhs;
+                return true;
+            case VCalcParser::GREATERTHAN:
+                result = lhs > rhs;
+                return true;
+            case VCalcParser::LESSTHAN:
+                result = lhs < rhs;
+                return true;
+            case VCalcParser::ISEQUAL:
+                result = lhs == rhs;
+                return true;
+            case VCalcParser::ISNOTEQUAL:
+                result = lhs != rhs;
+                return true;
+        }
+        return false;
+    }
+
+    PartialEvaluator::Value PartialEvaluator::evaluateBinaryOperation(std::shared_ptr<AST> t) {
+        Value lhs = evaluate(t->children[0]);
+        Value rhs = evaluate(t->children[1]);
+        if (failed) return Value();
+        size_t op = t->getNodeType();
+        if (!lhs.isVector && !rhs.isVector) {
+            int32_t result = 0;
+            if (!combine(op, lhs.scalar, rhs.scalar, result)) failed = true;
+            return integer(result);
+        }
+
+        // The result takes the length of its first vector operand. Codegen checks a scalar
+        // divisor even when there is nothing to divide, and never reads past a shorter second vector.
+        size_t size = (lhs.isVector ? lhs : rhs).elements->size();
+        if ((lhs.isVector && rhs.isVector && rhs.elements->size() < size) || (op == VCalcParser::DIV && !rhs.isVector && rhs.scalar == 0)) {
+            failed = true;
+            return Value();
+        }
+        if (!step(size)) return Value();
+        Value result = newVector(size);
+        if (failed) return Value();
+        for (size_t i = 0; i < size; i++) {
+            int32_t a = lhs.isVector ? (*lhs.elements)[i] : lhs.scalar;
+            int32_t b = rhs.isVector ? (*rhs.elements)[i] : rhs.scalar;
+            if (!combine(op, a, b, (*result.elements)[i])) {
+                failed = true;
+                return Value();
+            }
+        }
+        return result;
+    }
+
+    PartialEvaluator::Value PartialEvaluator::evaluateReduction(std::shared_ptr<AST> t) {
+        Value operand = evaluate(t->children[0]);
+        if (failed) return Value();
+        size_t op = t->getNodeType();
+        if (!operand.isVector) return integer(op == VCalcParser::COUNT ? 1 : operand.scalar);  // A vector of one element
+
+        const std::vector<int32_t> &elements = *operand.elements;
+        if (op == VCalcParser::COUNT) return integer((int32_t) elements.size());
+        if ((op == VCalcParser::MIN || op == VCalcParser::MAX) && elements.empty()) {
+            failed = true;  // An error at runtime
+            return Value();
+        }
+        if (!step(elements.size())) return Value();
+        uint32_t accumulator = op == VCalcParser::PRODUCT ? 1u : 0u;
+        if (op == VCalcParser::MIN || op == VCalcParser::MAX) accumulator = (uint32_t) elements[0];
+        for (int32_t element : elements) {
+            if (op == VCalcParser::SUM) {
+                accumulator += (uint32_t) element;
+            } else if (op == VCalcParser::PRODUCT) {
+                accumulator *= (uint32_t) element;
+            } else if (op == VCalcParser::MIN) {
+                accumulator = (uint32_t) std::min((int32_t) accumulator, element);
+            } else {
+                accumulator = (uint32_t) std::max((int32_t) accumulator, element);
+            }
+        }
+        return integer((int32_t) accumulator);
+    }
+
+    PartialEvaluator::Value PartialEvaluator::evaluateRange(std::shared_ptr<AST> t) {
+        Value lower = evaluate(t->children[0]);
+        Value upper = evaluate(t->children[1]);
+        // A range that runs backwards is left to codegen
+        if (failed || lower.isVector || upper.isVector || upper.scalar < lower.scalar) {
+            failed = true;
+            return Value();
+        }
+        size_t size = (size_t) ((int64_t) upper.scalar - (int64_t) lower.scalar + 1);
+        if (!step(size)) return Value();
+        Value result = newVector(size);
+        if (failed) return Value();
+        for (size_t i = 0; i < size; i++) (*result.elements)[i] = (int32_t) (lower.scalar + (int64_t) i);
+        return result;
+    }
+
+    PartialEvaluator::Value PartialEvaluator::evaluateIndex(std::shared_ptr<AST> t) {
+        Value base = evaluate(t->children[0]);
+        if (failed || !base.isVector) {
+            failed = true;
+            return Value();
+        }
+        const std::vector<int32_t> &elements = *base.elements;
+        auto inBounds = [&](int32_t index) { return index >= 0 && (size_t) index < elements.size(); };
+
+        if (t->isSlice) {
+            // Only the bounds of the range are needed. An empty slice never reads, so any bounds do.
+            std::shared_ptr<AST> range = t->children[1];
+            while (range->getNodeType() == VCalcParser::PARENTHESIS_TOKEN) range = range->children[0];
+            Value lower = evaluate(range->children[0]);
+            Value upper = evaluate(range->children[1]);
+            if (failed || lower.isVector || upper.isVector) {
+                failed = true;
+                return Value();
+            }
+            if (lower.scalar > upper.scalar) return newVector(0);
+            if (!inBounds(lower.scalar) || !inBounds(upper.scalar)) {
+                failed = true;
+                return Value();
+            }
+            size_t size = (size_t) (upper.scalar - lower.scalar) + 1;
+            if (!step(size)) return Value();
+            Value result = newVector(size);
+            if (failed) return Value();
+            std::copy(elements.begin() + lower.scalar, elements.begin() + upper.scalar + 1, result.elements->begin());
+            return result;
+        }
+
+        Value index = evaluate(t->children[1]);
+        if (failed) return Value();
+        if (!index.isVector) {
+            if (!inBounds(index.scalar)) {
+                failed = true;
+                return Value();
+            }
+            return integer(elements[index.scalar]);
+        }
+        // A gather, with every index checked like the runtime does
+        const std::vector<int32_t> &indices = *index.elements;
+        if (!step(indices.size())) return Value();
+        Value result = newVector(indices.size());
+        if (failed) return Value();
+        for (size_t i = 0; i < indices.size(); i++) {
+            if (!inBounds(indices[i])) {
+                failed = true;
+                return Value();
+            }
+            (*result.elements)[i] = elements[indices[i]];
+        }
+        return result;
+    }
+
+    /* ^(GENERATOR_TOKEN ID expression expression) or ^(FILTER_TOKEN ID expression expression) */
+    PartialEvaluator::Value PartialEvaluator::evaluateGenerator(std::shared_ptr<AST> t) {
+        bool isFilter = t->getNodeType() == VCalcParser::FILTER_TOKEN;
+        std::shared_ptr<Symbol> variable = t->children[0]->symbol;
+        Value domain = evaluate(t->children[1]);
+        if (failed || !domain.isVector || !variable) {
+            failed = true;
+            return Value();
+        }
+        // A filter keeps at most the whole domain; its spare elements stay counted until it is freed
+        Value result = newVector(domain.elements->size());
+        if (failed) return Value();
+        size_t kept = 0;
+        for (int32_t element : *domain.elements) {
+            variables[variable] = integer(element);
+            Value body = evaluate(t->children[2]);
+            if (failed || body.isVector) {
+                failed = true;
+                return Value();
+            }
+            if (!isFilter) {
+                (*result.elements)[kept++] = body.scalar;
+            } else if (body.scalar != 0) {
+                (*result.elements)[kept++] = element;
+            }
+        }
+        variables.erase(variable);
+        result.elements->resize(kept);
+        return result;
+    }
+
+    void PartialEvaluator::print(const Value &value) {
+        // The text vcalcPrintInt and vcalcPrintVector would write
+        if (!value.isVector) {
+            output += std::to_string(value.scalar) + "\n";
+        } else {
+            if (!step(value.elements->size())) return;
+            output += "[";
+            for (size_t i = 0; i < value.elements->size(); i++) {
+                if (i > 0) output += " ";
+                output += std::to_string((*value.elements)[i]);
+            }
+            output += "]\n";
+        }
+        if (liveBytes + output.size() > MAX_BYTES) failed = true;
+    }
+}
@@ -0,0 +1,60 @@
+#include "ProfileData.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace vcalc {
+    bool ProfileData::load(const std::string &path) {
+        std::ifstream file(path);
+        if (!file) {
+            std::cerr << "Cannot read profile data " << path << "\n";
+            return false;
+        }
+        std::string text;
+        for (size_t number = 1; std::getline(file, text); number++) {
+            std::istringstream record(text);
+            std::string kind;
+            size_t line;
+            bool parsed = false;
+            if (!(record >> kind)) continue;  // Blank line
+            if (kind == "region") {
+                int regionKind;
+                Region r;
+                parsed = static_cast<bool>(record >> line >> regionKind >> r.count >> r.totalNs >> r.selfNs >> r.iterations >> r.elements);
+                if (parsed) regions[{ line, regionKind }] = r;
+            } else if (kind == "branch") {
+                Branch b;
+                parsed = static_cast<bool>(record >> line >> b.taken >> b.notTaken);
+                if (parsed) branches[line] = b;
+            }
+            if (!parsed) {
+                std::cerr << path << ":" << number << ": not a profile record\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const ProfileData::Region *ProfileData::region(size_t line, int kind) const {
+        auto found = regions.find({ line, kind });
+        return found == regions.end() ? nullptr : &found->second;
+    }
+
+    const ProfileData::Branch *ProfileData::branch(size_t line) const {
+        auto found = branches.find(line);
+        return found == branches.end() ? nullptr : &found->second;
+    }
+
+    uint64_t ProfileData::averageIterations(size_t line, int kind) const {
+        const Region *r = region(line, kind);
+        if (!r || r->count <= 0 || r->iterations <= 0) return 0;
+        return r->iterations / r->count;
+    }
+
+    int64_t ProfileData::averageNs(size_t line, int kind) const {
+        const Region *r = region(line, kind);
+        if (!r || r->count <= 0) return -1;
+        return r->totalNs / r->count;
+    }
+}
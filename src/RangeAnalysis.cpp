@@ -0,0 +1,301 @@
+#include "RangeAnalysis.h"
+#include "VCalcParser.h"
+
+#include <algorithm>
+
+namespace vcalc {
+    static ValueRange lookup(std::map<std::shared_ptr<Symbol>, ValueRange> &ranges, std::shared_ptr<Symbol> sym, ValueRange unknown) {
+        auto find_s = ranges.find(sym);
+        if ( find_s != ranges.end() ) return find_s->second;
+        return unknown;
+    }
+
+    RangeAnalysis::RangeAnalysis() { }
+
+    void RangeAnalysis::visit(std::shared_ptr<AST> t) {
+        if ( t->isNil() ) {
+            visitChildren(t);
+        } else {
+            switch ( t->getNodeType() ) {
+                case VCalcParser::VAR_DECLARATION_TOKEN:
+                    visitVAR_DECLARATION_TOKEN(t);
+                    break;
+                case VCalcParser::ASSIGNMENT_TOKEN:
+                    visitASSIGNMENT_TOKEN(t);
+                    break;
+                case VCalcParser::CONDITIONAL_TOKEN:
+                    visitCONDITIONAL_TOKEN(t);
+                    break;
+                case VCalcParser::LOOP_TOKEN:
+                    visitLOOP_TOKEN(t);
+                    break;
+                case VCalcParser::EXPR_TOKEN:
+                    visitEXPR_TOKEN(t);
+                    break;
+                case VCalcParser::PARENTHESIS_TOKEN:
+                    visitPARENTHESIS_TOKEN(t);
+                    break;
+                case VCalcParser::INTEGER:
+                    visitINTEGER(t);
+                    break;
+                case VCalcParser::ID:
+                    visitID(t);
+                    break;
+                case VCalcParser::ADD:
+                case VCalcParser::SUB:
+                case VCalcParser::MUL:
+                case VCalcParser::DIV:
+                case VCalcParser::GREATERTHAN:
+                case VCalcParser::LESSTHAN:
+                case VCalcParser::ISEQUAL:
+                case VCalcParser::ISNOTEQUAL:
+                case VCalcParser::MATMUL:
+                    visitBinaryOperationToken(t);
+                    break;
+                case VCalcParser::SUM:
+                case VCalcParser::MIN:
+                case VCalcParser::MAX:
+                case VCalcParser::COUNT:
+                case VCalcParser::PRODUCT:
+                    visitReductionToken(t);
+                    break;
+                case VCalcParser::RANGE:
+                    visitRANGE(t);
+                    break;
+                case VCalcParser::INDEX_TOKEN:
+                    visitINDEX_TOKEN(t);
+                    break;
+                case VCalcParser::MATRIX_INDEX_TOKEN:
+                    visitMATRIX_INDEX_TOKEN(t);
+                    break;
+                case VCalcParser::MATRIX_GENERATOR_TOKEN:
+                    visitMATRIX_GENERATOR_TOKEN(t);
+                    break;
+                case VCalcParser::GENERATOR_TOKEN:
+                    visitGENERATOR_TOKEN(t);
+                    break;
+                case VCalcParser::FILTER_TOKEN:
+                    visitFILTER_TOKEN(t);
+                    break;
+                default: // The other nodes we don't care about just have their children visited
+                    visitChildren(t);
+            }
+        }
+    }
+
+    void RangeAnalysis::visitChildren(std::shared_ptr<AST> t) {
+        for ( auto child : t->children ) visit(child);
+    }
+
+    void RangeAnalysis::bind(std::shared_ptr<Symbol> sym, std::shared_ptr<AST> value) {
+        values[sym] = value->range;
+        lengths[sym] = value->lengthRange;
+    }
+
+    /* ^(VAR_DECLARATION_TOKEN type ID expression) */
+    void RangeAnalysis::visitVAR_DECLARATION_TOKEN(std::shared_ptr<AST> t) {
+        visitChildren(t);
+        bind(t->symbol, t->children[2]);
+    }
+
+    /* ^(ASSIGNMENT_TOKEN ID expression) */
+    void RangeAnalysis::visitASSIGNMENT_TOKEN(std::shared_ptr<AST> t) {
+        visitChildren(t);
+        bind(t->symbol, t->children[1]);
+    }
+
+    void RangeAnalysis::collectAssigned(std::shared_ptr<AST> t, std::set<std::shared_ptr<Symbol>> &assigned) {
+        if (!t->isNil() && t->getNodeType() == VCalcParser::ASSIGNMENT_TOKEN) {
+            assigned.insert(t->symbol);
+        }
+        for ( auto child : t->children ) collectAssigned(child, assigned);
+    }
+
+    void RangeAnalysis::forget(const std::set<std::shared_ptr<Symbol>> &assigned) {
+        for (auto sym : assigned) {
+            values.erase(sym);
+            lengths.erase(sym);
+        }
+    }
+
+    /* ^(CONDITIONAL_TOKEN expression block) */
+    void RangeAnalysis::visitCONDITIONAL_TOKEN(std::shared_ptr<AST> t) {
+        visit(t->children[0]);
+        std::set<std::shared_ptr<Symbol>> assigned;
+        collectAssigned(t->children[1], assigned);
+        std::map<std::shared_ptr<Symbol>, ValueRange> valuesBefore = values;
+        std::map<std::shared_ptr<Symbol>, ValueRange> lengthsBefore = lengths;
+
+        visit(t->children[1]);
+
+        // The block may or may not have run
+        for (auto sym : assigned) {
+            values[sym] = lookup(valuesBefore, sym, ValueRange::full()).join(lookup(values, sym, ValueRange::full()));
+            lengths[sym] = lookup(lengthsBefore, sym, ValueRange::length()).join(lookup(lengths, sym, ValueRange::length()));
+        }
+    }
+
+    /* ^(LOOP_TOKEN expression block) */
+    void RangeAnalysis::visitLOOP_TOKEN(std::shared_ptr<AST> t) {
+        // Anything the body assigns can hold any value on any iteration and after the loop
+        std::set<std::shared_ptr<Symbol>> assigned;
+        collectAssigned(t->children[1], assigned);
+        forget(assigned);
+        visitChildren(t);
+        forget(assigned);
+    }
+
+    void RangeAnalysis::visitEXPR_TOKEN(std::shared_ptr<AST> t) {
+        visitChildren(t);
+        t->range = t->children[0]->range;
+        t->lengthRange = t->children[0]->lengthRange;
+    }
+
+    void RangeAnalysis::visitPARENTHESIS_TOKEN(std::shared_ptr<AST> t) {
+        visitChildren(t);
+        t->range = t->children[0]->range;
+        t->lengthRange = t->children[0]->lengthRange;
+    }
+
+    void RangeAnalysis::visitINTEGER(std::shared_ptr<AST> t) {
+        t->range = ValueRange::exactly(std::stoll(t->token->getText())).clampToInt();
+    }
+
+    void RangeAnalysis::visitID(std::shared_ptr<AST> t) {
+        if (t->symbol) { // Only ID references carry a symbol
+            t->range = lookup(values, t->symbol, ValueRange::full());
+            t->lengthRange = lookup(lengths, t->symbol, ValueRange::length());
+        }
+    }
+
+    ValueRange RangeAnalysis::applyBinary(size_t op, ValueRange lhs, ValueRange rhs) {
+        switch (op) {
+            case VCalcParser::ADD:
+                return ValueRange(lhs.low + rhs.low, lhs.high + rhs.high).clampToInt();
+            case VCalcParser::SUB:
+                return ValueRange(lhs.low - rhs.high, lhs.high - rhs.low).clampToInt();
+            case VCalcParser::MUL: {
+                int64_t products[] = { lhs.low * rhs.low, lhs.low * rhs.high, lhs.high * rhs.low, lhs.high * rhs.high };
+                return ValueRange(*std::min_element(products, products + 4), *std::max_element(products, products + 4)).clampToInt();
+            }
+            case VCalcParser::DIV: {
+                if (rhs.low <= 0 && rhs.high >= 0) return ValueRange::full(); // May divide by zero
+                // Truncating division is monotonic in each operand while the divisor keeps its sign
+                int64_t quotients[] = { lhs.low / rhs.low, lhs.low / rhs.high, lhs.high / rhs.low, lhs.high / rhs.high };
+                return ValueRange(*std::min_element(quotients, quotients + 4), *std::max_element(quotients, quotients + 4)).clampToInt();
+            }
+            case VCalcParser::GREATERTHAN:
+                if (lhs.low > rhs.high) return ValueRange::exactly(1);
+                if (lhs.high <= rhs.low) return ValueRange::exactly(0);
+                return ValueRange(0, 1);
+            case VCalcParser::LESSTHAN:
+                if (lhs.high < rhs.low) return ValueRange::exactly(1);
+                if (lhs.low >= rhs.high) return ValueRange::exactly(0);
+                return ValueRange(0, 1);
+            case VCalcParser::ISEQUAL:
+                if (lhs.isExact() && rhs.isExact() && lhs.low == rhs.low) return ValueRange::exactly(1);
+                if (lhs.high < rhs.low || rhs.high < lhs.low) return ValueRange::exactly(0);
+                return ValueRange(0, 1);
+            case VCalcParser::ISNOTEQUAL:
+                if (lhs.isExact() && rhs.isExact() && lhs.low == rhs.low) return ValueRange::exactly(0);
+                if (lhs.high < rhs.low || rhs.high < lhs.low) return ValueRange::exactly(1);
+                return ValueRange(0, 1);
+        }
+        return ValueRange::full();  // Including **, whose elements sum as many products as the matrices have columns
+    }
+
+    void RangeAnalysis::visitBinaryOperationToken(std::shared_ptr<AST> t) {
+        visitChildren(t);
+        // Vectors are combined element by element, so element ranges combine like scalars
+        t->range = applyBinary(t->getNodeType(), t->children[0]->range, t->children[1]->range);
+        if (t->evalType->getName() == "vector") {
+            // The result takes the length of its first vector operand
+            if (t->children[0]->evalType->getName() == "vector") {
+                t->lengthRange = t->children[0]->lengthRange;
+            } else {
+                t->lengthRange = t->children[1]->lengthRange;
+            }
+        }
+    }
+
+    /* ^(op expression) */
+    void RangeAnalysis::visitReductionToken(std::shared_ptr<AST> t) {
+        visitChildren(t);
+        ValueRange elements = t->children[0]->range;
+        // Matrices are reduced over all their elements, but their shape is not tracked
+        std::string operandType = t->children[0]->evalType->getName();
+        ValueRange length = operandType == "int" ? ValueRange::exactly(1) : operandType == "matrix" ? ValueRange::length() : t->children[0]->lengthRange;
+        switch (t->getNodeType()) {
+            case VCalcParser::SUM: {
+                // Between length copies of the smallest element and length copies of the largest
+                int64_t bounds[] = { elements.low * length.low, elements.low * length.high, elements.high * length.low, elements.high * length.high };
+                t->range = ValueRange(*std::min_element(bounds, bounds + 4), *std::max_element(bounds, bounds + 4)).clampToInt();
+                break;
+            }
+            case VCalcParser::MIN:
+            case VCalcParser::MAX:
+                t->range = elements;
+                break;
+            case VCalcParser::COUNT:
+                t->range = length;
+                break;
+            default:
+                t->range = ValueRange::full();
+        }
+    }
+
+    /* ^(RANGE expr expr) */
+    void RangeAnalysis::visitRANGE(std::shared_ptr<AST> t) {
+        visitChildren(t);
+        ValueRange lower = t->children[0]->range;
+        ValueRange upper = t->children[1]->range;
+        t->range = ValueRange(lower.low, upper.high);
+        t->lengthRange = ValueRange(std::max<int64_t>(0, upper.low - lower.high + 1), std::max<int64_t>(0, upper.high - lower.low + 1));
+    }
+
+    /* ^(INDEX_TOKEN expr expr) */
+    void RangeAnalysis::visitINDEX_TOKEN(std::shared_ptr<AST> t) {
+        visitChildren(t);
+        t->range = t->children[0]->range;
+        t->lengthRange = t->children[1]->lengthRange; // One element per index when indexing with a vector
+        // In bounds if every possible index is below every possible length. The
+        // range of a vector index is the range of its elements.
+        ValueRange index = t->children[1]->range;
+        t->indexInBounds = index.low >= 0 && index.high < t->children[0]->lengthRange.low;
+    }
+
+    /* ^(MATRIX_INDEX_TOKEN expr expr expr) */
+    void RangeAnalysis::visitMATRIX_INDEX_TOKEN(std::shared_ptr<AST> t) {
+        visitChildren(t);
+        t->range = t->children[0]->range;
+    }
+
+    /* ^(MATRIX_GENERATOR_TOKEN ID expression ID expression expression) */
+    void RangeAnalysis::visitMATRIX_GENERATOR_TOKEN(std::shared_ptr<AST> t) {
+        visit(t->children[1]);
+        visit(t->children[3]);
+        values[t->children[0]->symbol] = t->children[1]->range;
+        values[t->children[2]->symbol] = t->children[3]->range;
+        visit(t->children[4]);
+        t->range = t->children[4]->range;
+    }
+
+    /* ^(GENERATOR_TOKEN ID expression expression) */
+    void RangeAnalysis::visitGENERATOR_TOKEN(std::shared_ptr<AST> t) {
+        visit(t->children[1]);
+        // The domain variable takes each element of the domain in turn
+        values[t->children[0]->symbol] = t->children[1]->range;
+        visit(t->children[2]);
+        t->range = t->children[2]->range;
+        t->lengthRange = t->children[1]->lengthRange;
+    }
+
+    /* ^(FILTER_TOKEN ID expression expression) */
+    void RangeAnalysis::visitFILTER_TOKEN(std::shared_ptr<AST> t) {
+        visit(t->children[1]);
+        values[t->children[0]->symbol] = t->children[1]->range;
+        visit(t->children[2]);
+        t->range = t->children[1]->range;
+        t->lengthRange = ValueRange(0, t->children[1]->lengthRange.high);
+    }
+}
@@ -0,0 +1,216 @@
+#include "Repl.h"
+
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/Support/TargetSelect.h"
+
+#include "VCalcLexer.h"
+#include "VCalcParser.h"
+#include "ANTLRInputStream.h"
+#include "CommonTokenStream.h"
+#include "ASTBuilder.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace vcalc {
+    Repl::Repl(const CodegenOptions &options, const std::string &runtimePath)
+        : symtab(std::make_shared<SymbolTable>()), defref(symtab), expressionTypeComputation(symtab), options(options), numStatements(0) {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+
+        // Tell gdb about every object we link, and perf too when LLVM was built with it
+        auto jitOrError = llvm::orc::LLJITBuilder()
+            .setObjectLinkingLayerCreator([](llvm::orc::ExecutionSession &session, const llvm::Triple &) {
+                auto layer = std::make_unique<llvm::orc::RTDyldObjectLinkingLayer>(session, []() { return std::make_unique<llvm::SectionMemoryManager>(); });
+                layer->registerJITEventListener(*llvm::JITEventListener::createGDBRegistrationListener());
+                if (llvm::JITEventListener *perf = llvm::JITEventListener::createPerfJITEventListener()) {
+                    layer->registerJITEventListener(*perf);
+                }
+                return layer;
+            })
+            .create();
+        if (!jitOrError) {
+            std::cerr << "Cannot start the JIT: " << llvm::toString(jitOrError.takeError()) << "\n";
+            exit(1);
+        }
+        jit = std::move(*jitOrError);
+
+        // Statements call into libvcalcrt
+        auto runtime = llvm::orc::DynamicLibrarySearchGenerator::Load(runtimePath.c_str(), jit->getDataLayout().getGlobalPrefix());
+        if (!runtime) {
+            std::cerr << "Cannot load " << runtimePath << ": " << llvm::toString(runtime.takeError()) << "\n";
+            exit(1);
+        }
+        jit->getMainJITDylib().addGenerator(std::move(*runtime));
+    }
+
+    int Repl::loop() {
+        std::string text;
+        std::string line;
+        std::cout << "vcalc> " << std::flush;
+        while (std::getline(std::cin, line)) {
+            text += line + "\n";
+            if (isComplete(text)) {
+                run(text);
+                text.clear();
+                std::cout << "vcalc> " << std::flush;
+            } else {
+                std::cout << "  ...> " << std::flush;
+            }
+        }
+        std::cout << "\n";
+        return 0;
+    }
+
+    bool Repl::isComplete(const std::string &text) {
+        // Wait for the closing `;` of a statement, and for every `if` and `loop` to be closed
+        antlr4::ANTLRInputStream input(text);
+        VCalcLexer lexer(&input);
+        int depth = 0;
+        std::string last;
+        for (auto &token : lexer.getAllTokens()) {
+            if (token->getType() == VCalcParser::IF || token->getType() == VCalcParser::LOOP) depth++;
+            if (token->getType() == VCalcParser::FI || token->getType() == VCalcParser::POOL) depth--;
+            last = token->getText();
+        }
+        return last.empty() || (depth <= 0 && last == ";");
+    }
+
+    void Repl::run(const std::string &text) {
+        antlr4::ANTLRInputStream input(text);
+        VCalcLexer lexer(&input);
+        antlr4::CommonTokenStream tokens(&lexer);
+        VCalcParser parser(&tokens);
+        antlr4::tree::ParseTree *tree = parser.compilationUnit();
+        if (parser.getNumberOfSyntaxErrors() > 0) return;  // The parser has already reported them
+
+        ASTBuilder builder;
+        std::shared_ptr<AST> ast = std::any_cast<std::shared_ptr<AST>>(builder.visit(tree));
+        if (ast->children.empty()) return;
+
+        defref.visit(ast);
+        if (hasUnresolvedReference(ast)) return;  // DefRef has already reported them
+        size_t typeErrors = expressionTypeComputation.getNumErrors();
+        expressionTypeComputation.visit(ast);
+        if (expressionTypeComputation.getNumErrors() > typeErrors) return;  // Already reported
+        rangeAnalysis.visit(ast);
+        // No Liveness: any variable may be read by a statement that has not been typed yet,
+        // so none of them is ever dead
+        DivisorHoisting divisorHoisting;
+        divisorHoisting.visit(ast);
+        IfConversion ifConversion(options.profileData.get());
+        ifConversion.visit(ast);
+        AffineRecognition affineRecognition;
+        affineRecognition.visit(ast);
+        LoopInvariantHoisting loopInvariantHoisting;
+        loopInvariantHoisting.visit(ast);
+        ValueNumbering valueNumbering;
+        valueNumbering.visit(ast);
+
+        CodegenOptions statementOptions = options;
+        statementOptions.entryName = "vcalc.statement" + std::to_string(++numStatements);
+        std::string outputFileName;
+        LLVMIRGenerator generator(outputFileName, statementOptions);
+
+        std::set<std::shared_ptr<Symbol>> refs;
+        collectReferences(ast, refs);
+        for (auto sym : refs) {
+            auto find_s = variables.find(sym);
+            if ( find_s != variables.end() ) generator.importVariable(sym, find_s->second);
+        }
+        generator.visit(ast);
+
+        std::vector<std::shared_ptr<Symbol>> bound;
+        collectBindings(ast, bound);
+        for (auto sym : bound) {
+            bool define = !variables.count(sym);
+            PersistentVariable &var = variables[sym];
+            if (define) var.globalName = "vcalc." + sym->getName() + "." + std::to_string(numStatements);
+            generator.exportVariable(sym, var, define);
+        }
+        generator.finalize();
+
+        if (llvm::Error error = jit->addIRModule(generator.takeModule())) {
+            std::cerr << "Cannot compile statement: " << llvm::toString(std::move(error)) << "\n";
+            return;
+        }
+        auto statement = reinterpret_cast<void (*)()>(lookup(statementOptions.entryName));
+        if (!statement) return;
+        statement();
+
+        for (auto sym : bound) {
+            PersistentVariable &var = variables[sym];
+            if (sym->type->getName() != "int") {
+                var.size = *reinterpret_cast<int32_t *>(lookup(var.globalName + ".size"));
+            }
+            if (sym->type->getName() == "matrix") {
+                var.columns = *reinterpret_cast<int32_t *>(lookup(var.globalName + ".columns"));
+            }
+            echo(sym);
+        }
+    }
+
+    uint64_t Repl::lookup(const std::string &name) {
+        auto symbol = jit->lookup(name);
+        if (!symbol) {
+            std::cerr << "Cannot find " << name << ": " << llvm::toString(symbol.takeError()) << "\n";
+            return 0;
+        }
+        return symbol->getAddress();
+    }
+
+    void Repl::echo(std::shared_ptr<Symbol> sym) {
+        PersistentVariable &var = variables[sym];
+        std::cout << sym->getName() << " = ";
+        if (sym->type->getName() == "int") {
+            std::cout << *reinterpret_cast<int32_t *>(lookup(var.globalName)) << "\n";
+            return;
+        }
+        const char *data = *reinterpret_cast<const char **>(lookup(var.globalName));
+        bool isMatrix = sym->type->getName() == "matrix";
+        std::cout << "[";
+        for (int32_t i = 0; i < var.size; i++) {
+            // A matrix prints row by row, like vcalcPrintMatrix
+            if (isMatrix && var.columns && i % var.columns == 0) std::cout << (i > 0 ? "] [" : "[");
+            else if (i > 0) std::cout << " ";
+            if (var.elementBits == 8) {
+                std::cout << int32_t(reinterpret_cast<const int8_t *>(data)[i]);
+            } else if (var.elementBits == 16) {
+                std::cout << reinterpret_cast<const int16_t *>(data)[i];
+            } else {
+                std::cout << reinterpret_cast<const int32_t *>(data)[i];
+            }
+        }
+        if (isMatrix && var.size > 0) std::cout << "]";
+        std::cout << "]\n";
+    }
+
+    bool Repl::hasUnresolvedReference(std::shared_ptr<AST> t) {
+        // DefRef gives every reference a scope, and leaves the symbol empty when it cannot resolve it
+        if (!t->isNil() && t->getNodeType() == VCalcParser::ID && t->scope && !t->symbol) return true;
+        for ( auto child : t->children ) {
+            if (hasUnresolvedReference(child)) return true;
+        }
+        return false;
+    }
+
+    void Repl::collectReferences(std::shared_ptr<AST> t, std::set<std::shared_ptr<Symbol>> &refs) {
+        if (!t->isNil() && (t->getNodeType() == VCalcParser::ID || t->getNodeType() == VCalcParser::ASSIGNMENT_TOKEN) && t->symbol) {
+            refs.insert(t->symbol);
+        }
+        for ( auto child : t->children ) collectReferences(child, refs);
+    }
+
+    void Repl::collectBindings(std::shared_ptr<AST> t, std::vector<std::shared_ptr<Symbol>> &bound) {
+        // Only globals outlive the statement; block locals and domain variables do not
+        if (!t->isNil() && (t->getNodeType() == VCalcParser::VAR_DECLARATION_TOKEN || t->getNodeType() == VCalcParser::ASSIGNMENT_TOKEN)
+                && t->symbol && symtab->globals->resolve(t->symbol->getName()) == t->symbol
+                && std::find(bound.begin(), bound.end(), t->symbol) == bound.end()) {
+            bound.push_back(t->symbol);
+        }
+        for ( auto child : t->children ) collectBindings(child, bound);
+    }
+}
@@ -0,0 +1,85 @@
+#include "StreamingCompiler.h"
+
+#include "VCalcLexer.h"
+#include "VCalcParser.h"
+#include "ANTLRInputStream.h"
+#include "CommonTokenStream.h"
+#include "ASTBuilder.h"
+#include "AffineRecognition.h"
+#include "DivisorHoisting.h"
+#include "IfConversion.h"
+#include "LoopInvariantHoisting.h"
+#include "ValueNumbering.h"
+#include "ModuleEmitter.h"
+#include "Repl.h"
+
+#include <fstream>
+#include <iostream>
+
+namespace vcalc {
+    StreamingCompiler::StreamingCompiler(const CodegenOptions &options, const std::string &outputFileName)
+        : symtab(std::make_shared<SymbolTable>()), defref(symtab), expressionTypeComputation(symtab), outputFileName(outputFileName), generator(this->outputFileName, options) { }
+
+    int StreamingCompiler::run(const std::string &inputFileName) {
+        std::ifstream input(inputFileName);
+        if (!input) {
+            std::cerr << "Cannot open " << inputFileName << "\n";
+            return 1;
+        }
+
+        // Gather lines until they hold whole statements, the same way the REPL does
+        std::string text;
+        std::string line;
+        size_t lineNumber = 0;
+        size_t firstLine = 1;
+        while (std::getline(input, line)) {
+            lineNumber++;
+            if (text.empty()) firstLine = lineNumber;
+            text += line + "\n";
+            if (Repl::isComplete(text)) {
+                compile(text, firstLine);
+                text.clear();
+            }
+        }
+        if (!text.empty()) compile(text, firstLine);  // Let the parser report the unfinished statement
+        if (expressionTypeComputation.getNumErrors() > 0) return 1;  // Already reported
+        generator.finalize();
+
+        llvm::orc::ThreadSafeModule module = generator.takeModule();
+        ModuleEmitter emitter(generator.options);
+        bool emitted = false;
+        module.withModuleDo([&](llvm::Module &mod) { emitted = emitter.emit(mod, outputFileName, false); });
+        return emitted ? 0 : 1;
+    }
+
+    void StreamingCompiler::compile(const std::string &text, size_t firstLine) {
+        // Everything built from `text` goes out of scope at the end of this call
+        antlr4::ANTLRInputStream input(text);
+        VCalcLexer lexer(&input);
+        lexer.setLine(firstLine);  // Keep diagnostics and debug locations on the file's own lines
+        antlr4::CommonTokenStream tokens(&lexer);
+        VCalcParser parser(&tokens);
+        antlr4::tree::ParseTree *tree = parser.compilationUnit();
+
+        ASTBuilder builder;
+        std::shared_ptr<AST> ast = std::any_cast<std::shared_ptr<AST>>(builder.visit(tree));
+        if (ast->children.empty()) return;
+
+        defref.visit(ast);
+        size_t typeErrors = expressionTypeComputation.getNumErrors();
+        expressionTypeComputation.visit(ast);
+        if (expressionTypeComputation.getNumErrors() > typeErrors) return;  // Nothing is emitted once run() sees it
+        rangeAnalysis.visit(ast);
+        DivisorHoisting divisorHoisting;
+        divisorHoisting.visit(ast);
+        IfConversion ifConversion(generator.options.profileData.get());
+        ifConversion.visit(ast);
+        AffineRecognition affineRecognition;
+        affineRecognition.visit(ast);
+        LoopInvariantHoisting loopInvariantHoisting;
+        loopInvariantHoisting.visit(ast);
+        ValueNumbering valueNumbering;
+        valueNumbering.visit(ast);
+        generator.visit(ast);
+    }
+}
@@ -6,6 +6,7 @@ namespace vcalc {
     void SymbolTable::initTypeSystem() {
         globals->define(std::make_shared<BuiltInTypeSymbol>("int"));
         globals->define(std::make_shared<BuiltInTypeSymbol>("vector"));
+        globals->define(std::make_shared<BuiltInTypeSymbol>("matrix"));
     }
 
     SymbolTable::SymbolTable() : globals(std::make_shared<GlobalScope>()) { 
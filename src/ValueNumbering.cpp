@@ -0,0 +1,205 @@
+#include "ValueNumbering.h"
+#include "VCalcParser.h"
+
+namespace vcalc {
+    ValueNumbering::ValueNumbering() { }
+
+    void ValueNumbering::visit(std::shared_ptr<AST> t) {
+        if ( t->isNil() ) {
+            visitStatements(t);
+            // Tell each reused node where its last reuse is, which hands back the reference it keeps
+            for (auto &reuse : lastReuse) {
+                reuse.first->keepValue = true;
+                reuse.second->isLastValueUse = true;
+            }
+            keepOperandsIntact(t);
+        } else {
+            switch ( t->getNodeType() ) {
+                case VCalcParser::BLOCK_TOKEN:
+                    visitBLOCK_TOKEN(t);
+                    break;
+                case VCalcParser::VAR_DECLARATION_TOKEN:
+                    number(t->children[2], true);
+                    break;
+                case VCalcParser::ASSIGNMENT_TOKEN:
+                    number(t->children[1], true);
+                    invalidate({ t->symbol });
+                    break;
+                case VCalcParser::PRINT_TOKEN:
+                    visitPRINT_TOKEN(t);
+                    break;
+                case VCalcParser::CONDITIONAL_TOKEN:
+                    number(t->children[0], true);
+                    visit(t->children[1]);
+                    break;
+                case VCalcParser::LOOP_TOKEN:
+                    // The condition runs once per iteration, so nothing in it is kept or reused
+                    visit(t->children[1]);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    void ValueNumbering::visitStatements(std::shared_ptr<AST> t) {
+        for ( auto statement : t->children ) visit(statement);
+    }
+
+    /* ^(BLOCK_TOKEN statement*) */
+    void ValueNumbering::visitBLOCK_TOKEN(std::shared_ptr<AST> t) {
+        // A block may run any number of times, so it neither reuses vectors from outside nor leaves
+        // any behind, and what it assigns is stale afterwards
+        std::map<std::string, Available> enclosing;
+        enclosing.swap(available);
+        visitStatements(t);
+        available.swap(enclosing);
+        std::set<std::shared_ptr<Symbol>> assigned;
+        collectAssigned(t, assigned);
+        invalidate(assigned);
+    }
+
+    /* ^(PRINT_TOKEN ^(EXPR_TOKEN expr)) */
+    void ValueNumbering::visitPRINT_TOKEN(std::shared_ptr<AST> t) {
+        // Printed generators, filters and ranges are streamed, never built, so they can only reuse
+        std::shared_ptr<AST> value = strip(t->children[0]);
+        if (value->isLoopInvariant) return;
+        if (value->getNodeType() != VCalcParser::GENERATOR_TOKEN && value->getNodeType() != VCalcParser::FILTER_TOKEN && value->getNodeType() != VCalcParser::RANGE) {
+            number(t->children[0], true);
+            return;
+        }
+        if (reuse(value) || value->getNodeType() == VCalcParser::RANGE) return;
+        // Nor is a range domain
+        std::shared_ptr<AST> domain = strip(value->children[1]);
+        if (domain->getNodeType() != VCalcParser::RANGE && !value->isProgression) number(value->children[1], true);
+    }
+
+    std::shared_ptr<AST> ValueNumbering::strip(std::shared_ptr<AST> t) {
+        while (t->getNodeType() == VCalcParser::EXPR_TOKEN || t->getNodeType() == VCalcParser::PARENTHESIS_TOKEN) t = t->children[0];
+        return t;
+    }
+
+    bool ValueNumbering::isCandidate(std::shared_ptr<AST> t) {
+        // Vectors that codegen allocates and fills; names and slices share a buffer already
+        if (!t->evalType || t->evalType->getName() != "vector") return false;
+        if (t->isMask) return false;  // Packed bits, which no other consumer could read
+        switch ( t->getNodeType() ) {
+            case VCalcParser::RANGE:
+            case VCalcParser::GENERATOR_TOKEN:
+            case VCalcParser::FILTER_TOKEN:
+            case VCalcParser::ADD:
+            case VCalcParser::SUB:
+            case VCalcParser::MUL:
+            case VCalcParser::DIV:
+            case VCalcParser::GREATERTHAN:
+            case VCalcParser::LESSTHAN:
+            case VCalcParser::ISEQUAL:
+            case VCalcParser::ISNOTEQUAL:
+                return true;
+            case VCalcParser::INDEX_TOKEN:
+                return !t->isSlice;
+            default:
+                return false;
+        }
+    }
+
+    bool ValueNumbering::computeKey(std::shared_ptr<AST> t, std::map<std::shared_ptr<Symbol>, size_t> &bound, std::set<std::shared_ptr<Symbol>> &reads, std::string &key) {
+        // Domain variables are numbered by nesting depth, so [i in v | i * 2] matches [j in v | j * 2]
+        if (t->getNodeType() == VCalcParser::ID) {
+            if (!t->symbol) return false;
+            auto found = bound.find(t->symbol);
+            if (found != bound.end()) {
+                key += "$" + std::to_string(found->second);
+                return true;
+            }
+            auto number = symbolNumbers.emplace(t->symbol, symbolNumbers.size()).first;
+            key += "#" + std::to_string(number->second);
+            reads.insert(t->symbol);
+            return true;
+        }
+        if (t->getNodeType() == VCalcParser::INTEGER) {
+            key += t->token->getText();
+            return true;
+        }
+        key += "(" + std::to_string(t->getNodeType());
+        bool binds = t->getNodeType() == VCalcParser::GENERATOR_TOKEN || t->getNodeType() == VCalcParser::FILTER_TOKEN;
+        for (size_t i = binds ? 1 : 0; i < t->children.size(); i++) {
+            if (binds && i == 2) bound.emplace(t->children[0]->symbol, bound.size());
+            key += " ";
+            if (!computeKey(t->children[i], bound, reads, key)) return false;
+        }
+        if (binds) bound.erase(t->children[0]->symbol);
+        key += ")";
+        return true;
+    }
+
+    bool ValueNumbering::reuse(std::shared_ptr<AST> t) {
+        std::string key;
+        std::set<std::shared_ptr<Symbol>> reads;
+        std::map<std::shared_ptr<Symbol>, size_t> bound;
+        if (!isCandidate(t) || !computeKey(t, bound, reads, key)) return false;
+        auto found = available.find(key);
+        if (found == available.end()) return false;
+        t->valueNumberOf = found->second.node;
+        lastReuse[found->second.node] = t;
+        return true;
+    }
+
+    void ValueNumbering::number(std::shared_ptr<AST> t, bool materialized) {
+        if (t->isLoopInvariant) return;  // Built once before its loop, which holds the buffer
+        if (reuse(t)) return;
+
+        // Generator and filter bodies run once per element, so only their domains are looked into
+        switch ( t->getNodeType() ) {
+            case VCalcParser::GENERATOR_TOKEN:
+            case VCalcParser::FILTER_TOKEN:
+                if (!t->isProgression) number(t->children[1], true);  // A progression never builds its domain
+                break;
+            case VCalcParser::MATRIX_GENERATOR_TOKEN:
+                number(t->children[1], true);
+                number(t->children[3], true);
+                break;
+            case VCalcParser::SUM:
+            case VCalcParser::MIN:
+            case VCalcParser::MAX:
+            case VCalcParser::COUNT:
+            case VCalcParser::PRODUCT: {
+                // A reduction accumulates a generator or filter as it goes instead of building it
+                std::shared_ptr<AST> operand = strip(t->children[0]);
+                bool fused = operand->getNodeType() == VCalcParser::GENERATOR_TOKEN || operand->getNodeType() == VCalcParser::FILTER_TOKEN;
+                number(fused ? operand : t->children[0], !fused);
+                break;
+            }
+            case VCalcParser::INDEX_TOKEN:
+                // A slice's range only supplies its bounds
+                number(t->children[0], true);
+                if (!t->isSlice) number(t->children[1], true);
+                break;
+            default:
+                for ( auto child : t->children ) number(child, true);
+        }
+        std::string key;
+        std::set<std::shared_ptr<Symbol>> reads;
+        std::map<std::shared_ptr<Symbol>, size_t> bound;
+        if (materialized && isCandidate(t) && computeKey(t, bound, reads, key)) available[key] = Available { t, reads };
+    }
+
+    void ValueNumbering::invalidate(const std::set<std::shared_ptr<Symbol>> &assigned) {
+        for (auto iter = available.begin(); iter != available.end(); ) {
+            bool stale = false;
+            for (auto sym : assigned) stale = stale || iter->second.reads.count(sym);
+            iter = stale ? available.erase(iter) : std::next(iter);
+        }
+    }
+
+    void ValueNumbering::collectAssigned(std::shared_ptr<AST> t, std::set<std::shared_ptr<Symbol>> &assigned) {
+        if (t->getNodeType() == VCalcParser::ASSIGNMENT_TOKEN && t->symbol) assigned.insert(t->symbol);
+        for ( auto child : t->children ) collectAssigned(child, assigned);
+    }
+
+    void ValueNumbering::keepOperandsIntact(std::shared_ptr<AST> t) {
+        // A shared buffer must not be overwritten in place by the expression that consumes it
+        if (t->reuseOperand && (t->reuseOperand->keepValue || t->reuseOperand->valueNumberOf)) t->reuseOperand = nullptr;
+        for ( auto child : t->children ) keepOperandsIntact(child);
+    }
+}
@@ -0,0 +1,44 @@
+#include "ValueRange.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace vcalc {
+    ValueRange::ValueRange() : low(std::numeric_limits<int32_t>::min()), high(std::numeric_limits<int32_t>::max()) {}
+    ValueRange::ValueRange(int64_t low, int64_t high) : low(low), high(high) {}
+
+    ValueRange ValueRange::full() { return ValueRange(); }
+    ValueRange ValueRange::exactly(int64_t value) { return ValueRange(value, value); }
+    ValueRange ValueRange::length() { return ValueRange(0, std::numeric_limits<int32_t>::max()); }
+
+    bool ValueRange::isFull() {
+        return low <= std::numeric_limits<int32_t>::min() && high >= std::numeric_limits<int32_t>::max();
+    }
+
+    bool ValueRange::isExact() { return low == high; }
+
+    bool ValueRange::contains(const ValueRange &other) {
+        return low <= other.low && other.high <= high;
+    }
+
+    ValueRange ValueRange::join(const ValueRange &other) {
+        return ValueRange(std::min(low, other.low), std::max(high, other.high));
+    }
+
+    ValueRange ValueRange::clampToInt() {
+        if (low < std::numeric_limits<int32_t>::min() || high > std::numeric_limits<int32_t>::max() || low > high) {
+            return full(); // The operation may wrap, so nothing is known
+        }
+        return *this;
+    }
+
+    unsigned ValueRange::minimumBitWidth() {
+        if (low >= std::numeric_limits<int8_t>::min() && high <= std::numeric_limits<int8_t>::max()) return 8;
+        if (low >= std::numeric_limits<int16_t>::min() && high <= std::numeric_limits<int16_t>::max()) return 16;
+        return 32;
+    }
+
+    std::string ValueRange::toString() {
+        return '[' + std::to_string(low) + ", " + std::to_string(high) + ']';
+    }
+}
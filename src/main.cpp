@@ -11,22 +11,164 @@
 #include "DefRef.h"
 #include "SymbolTable.h"
 #include "ExpressionTypeComputation.h"
+#include "Liveness.h"
+#include "LoopInvariantHoisting.h"
+#include "DivisorHoisting.h"
+#include "IfConversion.h"
+#include "AffineRecognition.h"
+#include "ModuleEmitter.h"
+#include "PartialEvaluator.h"
+#include "ProfileData.h"
+#include "RangeAnalysis.h"
 #include "LLVMIRGenerator.h"
+#include "ParallelCodegen.h"
+#include "Repl.h"
+#include "StreamingCompiler.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Path.h"
 
 #include <iostream>
+#include <algorithm>
+#include <cstdlib>
 #include <fstream>
 #include <string>
+#include <vector>
+
+// libvcalcrt is linked next to the vcalc executable unless VCALC_RUNTIME says otherwise.
+static std::string runtimePath(const char *argv0) {
+  static int anchor;
+  if (const char *path = std::getenv("VCALC_RUNTIME")) return path;
+  llvm::SmallString<256> path(llvm::sys::path::parent_path(llvm::sys::fs::getMainExecutable(argv0, &anchor)));
+  llvm::sys::path::append(path, "libvcalcrt.so");
+  return std::string(path);
+}
+
+// libvcalcrt.bc sits beside libvcalcrt.so when clang was found to build it; VCALC_RUNTIME_BC overrides.
+// Empty when there is none, and native programs call the shared library instead.
+static std::string runtimeBitcodePath(const std::string &runtimeLibrary) {
+  if (const char *path = std::getenv("VCALC_RUNTIME_BC")) return path;
+  llvm::SmallString<256> path(runtimeLibrary);
+  llvm::sys::path::replace_extension(path, "bc");
+  return llvm::sys::fs::exists(path) ? std::string(path) : "";
+}
+
+// Width of the host's widest integer SIMD registers.
+static unsigned hostVectorBits() {
+  llvm::StringMap<bool> features;
+  if (llvm::sys::getHostCPUFeatures(features)) {
+    if (features.lookup("avx512f")) return 512;
+    if (features.lookup("avx2")) return 256;
+  }
+  return 128;
+}
+
+// A module whose main only writes the output PartialEvaluator computed.
+static bool emitPrecomputed(const vcalc::CodegenOptions &options, const std::string &text, std::string &outputFileName) {
+  vcalc::LLVMIRGenerator generator(outputFileName, options);
+  generator.createPrecomputedOutput(text);
+  generator.finalize();
+  llvm::orc::ThreadSafeModule module = generator.takeModule();
+  vcalc::ModuleEmitter emitter(options);
+  bool emitted = false;
+  module.withModuleDo([&](llvm::Module &mod) { emitted = emitter.emit(mod, outputFileName, false); });
+  return emitted;
+}
 
 int main(int argc, char **argv) {
-  if (argc < 3) {
+  // Flags may appear anywhere; everything else is positional.
+  vcalc::CodegenOptions options;
+  options.vectorBits = hostVectorBits();
+  bool repl = false;
+  bool stream = false;
+  bool precompute = false;
+  bool objectOnly = false;
+  std::string outputFileName;
+  unsigned jobs = 1;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--profile") {
+      options.profile = true;
+    } else if (arg == "-g") {
+      options.debugInfo = true;
+    } else if (arg == "--repl") {
+      repl = true;
+    } else if (arg == "--stream") {
+      stream = true;
+    } else if (arg == "--precompute") {
+      precompute = true;
+    } else if (arg == "--tasks") {
+      options.tasks = true;
+    } else if (arg.rfind("--profile-use=", 0) == 0) {
+      auto profileData = std::make_shared<vcalc::ProfileData>();
+      if (!profileData->load(arg.substr(14))) return 1;
+      options.profileData = profileData;
+    } else if (arg.rfind("--jobs=", 0) == 0) {
+      jobs = std::max(1, std::atoi(arg.c_str() + 7));
+    } else if (arg == "-O0") {
+      options.optimize = false;
+    } else if (arg == "-c") {
+      objectOnly = true;
+    } else if (arg == "-o" && i + 1 < argc) {
+      outputFileName = argv[++i];
+    } else {
+      files.push_back(arg);
+    }
+  }
+
+  if (repl) {
+    options.sourceFileName = "<repl>";
+    vcalc::Repl session(options, runtimePath(argv[0]));
+    return session.loop();
+  }
+
+  // A second positional is the output for IR, bitcode (by its .bc extension) or, with -c, an object.
+  // -o names the output instead, which is a native executable unless -c is given too.
+  if (outputFileName.empty() && files.size() >= 2) {
+    outputFileName = files[1];
+    options.output = llvm::sys::path::extension(outputFileName) == ".bc" ? vcalc::OUTPUT_BITCODE : vcalc::OUTPUT_IR;
+  } else {
+    options.output = vcalc::OUTPUT_EXECUTABLE;
+  }
+  if (objectOnly) options.output = vcalc::OUTPUT_OBJECT;
+  if (options.output != vcalc::OUTPUT_IR) {
+    options.runtimeLibrary = runtimePath(argv[0]);
+    options.runtimeBitcode = runtimeBitcodePath(options.runtimeLibrary);
+  }
+
+  if (files.empty() || outputFileName.empty()) {
     std::cout << "Missing required argument.\n"
-              << "Required arguments: <input file path> <output file path>\n";
+              << "Required arguments: <input file path> <output file path>\n"
+              << "                or: <input file path> -o <executable path>\n"
+              << "Options: --profile  time each statement, loop body, generator and filter at runtime,\n"
+              << "                    and count how often each conditional ran its block\n"
+              << "         --profile-use=FILE\n"
+              << "                    optimize for the counts a --profile run wrote to FILE (its vcalc-profile.txt)\n"
+              << "         -g         emit DWARF line info so debuggers and perf map code to source lines\n"
+              << "         --repl     read statements interactively and run each one as it is entered\n"
+              << "         --jobs=N   generate and optimize the program as up to N modules in parallel\n"
+              << "         --stream   compile one statement at a time to keep compiler memory low\n"
+              << "         --tasks    run independent statements that work on vectors at the same time\n"
+              << "         --precompute\n"
+              << "                    run the program while compiling it and, if it finishes quickly, emit only its output\n"
+              << "         -c         write a native object file\n"
+              << "         -o FILE    write a native executable, or an object file with -c\n"
+              << "         -O0        skip optimization\n";
     return 1;
   }
 
+  if (stream) {
+    options.sourceFileName = files[0];
+    vcalc::StreamingCompiler compiler(options, outputFileName);
+    return compiler.run(files[0]);
+  }
+
   // Open the file then parse and lex it.
   antlr4::ANTLRFileStream afs;
-  afs.loadFromFile(argv[1]);
+  afs.loadFromFile(files[0]);
   vcalc::VCalcLexer lexer(&afs);
   antlr4::CommonTokenStream tokens(&lexer);
   vcalc::VCalcParser parser(&tokens);
@@ -48,10 +190,40 @@ int main(int argc, char **argv) {
   // Expression Type Computation
   vcalc::ExpressionTypeComputation expressionTypeComputation(symtab);
   expressionTypeComputation.visit(ast);
+  if (expressionTypeComputation.getNumErrors() > 0) return 1;  // Already reported, and codegen relies on the types
+
+  // Partial evaluation: the program reads no input, so its output may be known already
+  options.sourceFileName = files[0];
+  if (precompute) {
+    vcalc::PartialEvaluator partialEvaluator;
+    if (partialEvaluator.run(ast)) return emitPrecomputed(options, partialEvaluator.getOutput(), outputFileName) ? 0 : 1;
+  }
+
+  // Range Analysis
+  vcalc::RangeAnalysis rangeAnalysis;
+  rangeAnalysis.visit(ast);
+
+  // Liveness Analysis
+  vcalc::Liveness liveness;
+  liveness.visit(ast);
+
+  // Division Strength Reduction
+  vcalc::DivisorHoisting divisorHoisting;
+  divisorHoisting.visit(ast);
+
+  // If-conversion of small conditionals
+  vcalc::IfConversion ifConversion(options.profileData.get());
+  ifConversion.visit(ast);
+
+  // Closed forms for affine ranges, generators and filters
+  vcalc::AffineRecognition affineRecognition;
+  affineRecognition.visit(ast);
+
+  // Loop-invariant vectors, built once before their loop
+  vcalc::LoopInvariantHoisting loopInvariantHoisting;
+  loopInvariantHoisting.visit(ast);
 
   // LLVM IR Codegen Pass
-  std::string outputFileName(argv[2]);
-  vcalc::LLVMIRGenerator llvmIRGenerator(outputFileName);
-  
-  return 0;
+  vcalc::ParallelCodegen parallelCodegen(symtab, options, jobs);
+  return parallelCodegen.run(ast, outputFileName) ? 0 : 1;
 }